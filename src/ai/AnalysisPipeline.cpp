@@ -0,0 +1,333 @@
+#include "AnalysisPipeline.h"
+#include "../core/DocumentParser.h"
+#include "../core/FileIdentity.h"
+#include "../core/FileScanner.h"
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <sstream>
+
+static double secondsSince(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+const char* AnalysisPipeline::stageName(Stage stage)
+{
+    static const char* names[StageCount] = {"scan", "extract", "tokenize", "propagate", "infer", "persist"};
+    return stage >= 0 && stage < StageCount ? names[stage] : "";
+}
+
+AnalysisPipeline::Source AnalysisPipeline::scanSource(const std::string& root, bool recursive)
+{
+    auto files = std::make_shared<std::vector<std::string>>();
+    auto next = std::make_shared<size_t>(0);
+    auto scanned = std::make_shared<bool>(false);
+    return [=](std::string& path) {
+        if (!*scanned) {
+            *files = FileScanner().scanDirectory(root, recursive);
+            *scanned = true;
+        }
+        if (*next >= files->size()) return false;
+        path = (*files)[(*next)++];
+        return true;
+    };
+}
+
+AnalysisPipeline::Source AnalysisPipeline::listSource(std::vector<std::string> paths)
+{
+    auto files = std::make_shared<std::vector<std::string>>(std::move(paths));
+    auto next = std::make_shared<size_t>(0);
+    return [=](std::string& path) {
+        if (*next >= files->size()) return false;
+        path = (*files)[(*next)++];
+        return true;
+    };
+}
+
+AnalysisPipeline::AnalysisPipeline(InferenceBackend& b)
+    : backend(b)
+{
+}
+
+AnalysisPipeline::~AnalysisPipeline()
+{
+    cancel();
+    wait();
+}
+
+bool AnalysisPipeline::start(Source src, PersistFn fn, const Config& c, PropagateFn propagateFn)
+{
+    if (running) return false;
+    wait();
+
+    config = c;
+    config.extractWorkers = std::max(1, config.extractWorkers);
+    config.tokenizeWorkers = std::max(1, config.tokenizeWorkers);
+    config.propagateWorkers = std::max(1, config.propagateWorkers);
+    config.inferWorkers = std::max(1, config.inferWorkers);
+    config.persistWorkers = std::max(1, config.persistWorkers);
+    config.batchSize = std::max(1, config.batchSize);
+    source = std::move(src);
+    persist = std::move(fn);
+    propagate = std::move(propagateFn);
+    cancelled = std::make_shared<std::atomic<bool>>(false);
+
+    const int workers[StageCount] = {1, config.extractWorkers, config.tokenizeWorkers, config.propagateWorkers,
+                                     config.inferWorkers, config.persistWorkers};
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        for (int s = 0; s < StageCount; ++s) {
+            totals[s] = StageStats();
+            totals[s].stage = Stage(s);
+            totals[s].workers = workers[s];
+            size_t capacity = s < Persist && config.feedCapacity ? config.feedCapacity : config.queueCapacity;
+            queues[s].reset(s == Scan ? nullptr : new BoundedQueue<Item>(capacity));
+        }
+        started = std::chrono::steady_clock::now();
+        stopped = started;
+    }
+    nFound = 0;
+    nFinished = 0;
+    nFailed = 0;
+    running = true;
+
+    spawn(Scan, 1, &AnalysisPipeline::scanLoop);
+    spawn(Extract, config.extractWorkers, &AnalysisPipeline::extractLoop);
+    spawn(Tokenize, config.tokenizeWorkers, &AnalysisPipeline::tokenizeLoop);
+    spawn(Propagate, config.propagateWorkers, &AnalysisPipeline::propagateLoop);
+    spawn(Infer, config.inferWorkers, &AnalysisPipeline::inferLoop);
+    spawn(Persist, config.persistWorkers, &AnalysisPipeline::persistLoop);
+    return true;
+}
+
+void AnalysisPipeline::spawn(Stage stage, int workers, void (AnalysisPipeline::*loop)(Stage))
+{
+    active[stage] = workers;
+    for (int i = 0; i < workers; ++i) {
+        threads.emplace_back([this, stage, loop]() {
+            (this->*loop)(stage);
+            workerDone(stage);
+        });
+    }
+}
+
+void AnalysisPipeline::cancel()
+{
+    if (!running) return;
+    *cancelled = true;
+    // Waiting files are dropped; what already left inference still gets persisted
+    for (int s = Extract; s < Persist; ++s) {
+        if (queues[s]) queues[s]->clear();
+    }
+}
+
+void AnalysisPipeline::wait()
+{
+    for (auto& t : threads) {
+        if (t.joinable()) t.join();
+    }
+    threads.clear();
+}
+
+void AnalysisPipeline::workerDone(Stage stage)
+{
+    if (--active[stage] > 0) return;
+    if (stage + 1 < StageCount) {
+        queues[stage + 1]->close();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stopped = std::chrono::steady_clock::now();
+    running = false;
+}
+
+bool AnalysisPipeline::forward(Stage stage, Item item)
+{
+    double blocked = 0;
+    bool ok = queues[stage + 1]->push(std::move(item), &blocked);
+    account(stage, 0, blocked, 0);
+    return ok;
+}
+
+void AnalysisPipeline::account(Stage stage, double busy, double blocked, uint64_t items)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    totals[stage].busySeconds += busy;
+    totals[stage].blockedSeconds += blocked;
+    totals[stage].processed += items;
+}
+
+void AnalysisPipeline::scanLoop(Stage stage)
+{
+    std::string path;
+    while (!*cancelled) {
+        auto t0 = std::chrono::steady_clock::now();
+        bool more = source(path);
+        account(stage, secondsSince(t0), 0, more ? 1 : 0);
+        if (!more) break;
+        nFound++;
+
+        Item item;
+        item.path = path;
+        if (!forward(stage, std::move(item))) break;
+    }
+}
+
+void AnalysisPipeline::extractLoop(Stage stage)
+{
+    Item item;
+    while (queues[stage]->pop(item)) {
+        auto t0 = std::chrono::steady_clock::now();
+        item.filename = std::filesystem::path(item.path).filename().string();
+        // Pictures by what they show; ones that fail to decode by name and whatever the parser finds
+        bool image = backend.canSeeImages() && ImageLoader::isImage(item.path) &&
+                     ImageLoader::load(item.path, config.maxImageSide, item.image);
+        if (image) {
+            item.image.key = FileIdentity::fingerprintFile(item.path);
+        } else {
+            item.content = DocumentParser::extractContent(item.path);
+        }
+        account(stage, secondsSince(t0), 0, 1);
+        if (!forward(stage, std::move(item))) break;
+        item = Item();
+    }
+}
+
+void AnalysisPipeline::tokenizeLoop(Stage stage)
+{
+    Item item;
+    while (queues[stage]->pop(item)) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (item.image.empty()) item.request = backend.prepareTags(item.filename, item.content);
+        account(stage, secondsSince(t0), 0, 1);
+        if (!forward(stage, std::move(item))) break;
+        item = Item();
+    }
+}
+
+void AnalysisPipeline::propagateLoop(Stage stage)
+{
+    BoundedQueue<Item>& in = *queues[stage];
+    Item first;
+    while (in.pop(first)) {
+        std::deque<Item> batch;
+        batch.push_back(std::move(first));
+        if (propagate) in.popMore(batch, config.batchSize - 1);
+
+        auto t0 = std::chrono::steady_clock::now();
+        // Pictures and cache hits have nothing to gain
+        std::vector<Item*> texts;
+        for (Item& item : batch) {
+            if (item.image.empty() && item.request.cached.empty() && !*cancelled) texts.push_back(&item);
+        }
+        if (propagate && !texts.empty()) propagate(texts);
+        account(stage, secondsSince(t0), 0, batch.size());
+
+        for (Item& item : batch) {
+            if (!forward(stage, std::move(item))) return;
+        }
+    }
+}
+
+void AnalysisPipeline::inferLoop(Stage stage)
+{
+    BoundedQueue<Item>& in = *queues[stage];
+    Item first;
+    while (in.pop(first)) {
+        // Whatever else is ready goes into the same call, up to a batch
+        std::deque<Item> batch;
+        batch.push_back(std::move(first));
+        in.popMore(batch, config.batchSize - 1);
+
+        auto t0 = std::chrono::steady_clock::now();
+        InferenceOptions options;
+        options.cancel = cancelled;
+        std::vector<TagRequest> requests;
+        std::vector<size_t> texts;
+        std::vector<std::pair<std::string, ImageData>> images;
+        std::vector<size_t> pictures;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Item& item = batch[i];
+            if (!item.result.empty()) {
+                continue; // Tagged by propagation
+            } else if (options.stopped()) {
+                item.result = options.stopReason();
+            } else if (!item.image.empty()) {
+                images.push_back({item.filename, std::move(item.image)});
+                pictures.push_back(i);
+            } else {
+                requests.push_back(std::move(item.request));
+                texts.push_back(i);
+            }
+        }
+        // Pictures of one batch share a context as parallel sequences, like the texts
+        if (!images.empty()) {
+            std::vector<std::string> results = backend.suggestImageTagsBatch(images, options);
+            for (size_t j = 0; j < pictures.size(); ++j) batch[pictures[j]].result = results[j];
+        }
+        if (!requests.empty()) {
+            std::vector<std::string> results = backend.suggestPreparedTags(requests, options);
+            for (size_t j = 0; j < texts.size(); ++j) batch[texts[j]].result = results[j];
+        }
+        account(stage, secondsSince(t0), 0, batch.size());
+
+        for (Item& item : batch) {
+            item.image = ImageData(); // Done with the pixels
+            if (!forward(stage, std::move(item))) return;
+        }
+    }
+}
+
+void AnalysisPipeline::persistLoop(Stage stage)
+{
+    Item item;
+    while (queues[stage]->pop(item)) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (item.result.empty() || item.result.rfind("Error:", 0) == 0) nFailed++;
+        if (persist) persist(item);
+        nFinished++;
+        account(stage, secondsSince(t0), 0, 1);
+        item = Item();
+    }
+}
+
+std::vector<AnalysisPipeline::StageStats> AnalysisPipeline::stats() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    double elapsed = std::chrono::duration<double>((running ? std::chrono::steady_clock::now() : stopped) - started).count();
+    std::vector<StageStats> out(totals.begin(), totals.end());
+    for (int s = 0; s < StageCount; ++s) {
+        if (queues[s]) {
+            out[s].backlog = queues[s]->size();
+            out[s].capacity = queues[s]->capacity();
+        }
+        if (elapsed > 0 && out[s].workers > 0) {
+            out[s].utilization = std::min(1.0, out[s].busySeconds / (out[s].workers * elapsed));
+        }
+    }
+    return out;
+}
+
+AnalysisPipeline::Stage AnalysisPipeline::bottleneck() const
+{
+    std::vector<StageStats> all = stats();
+    auto busiest = std::max_element(all.begin(), all.end(), [](const StageStats& a, const StageStats& b) {
+        return a.utilization < b.utilization;
+    });
+    return busiest->stage;
+}
+
+std::string AnalysisPipeline::report() const
+{
+    std::vector<StageStats> all = stats();
+    std::ostringstream out;
+    out << nFinished << "/" << nFound << " files";
+    if (nFailed) out << " (" << nFailed << " failed)";
+    for (const auto& s : all) {
+        out << ", " << stageName(s.stage) << " " << int(s.utilization * 100 + 0.5) << "%";
+        if (s.capacity) out << " [" << s.backlog << "/" << s.capacity << "]";
+    }
+    out << ", bottleneck " << stageName(bottleneck());
+    return out.str();
+}
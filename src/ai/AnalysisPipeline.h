@@ -0,0 +1,130 @@
+#ifndef ANALYSISPIPELINE_H
+#define ANALYSISPIPELINE_H
+
+#include "InferenceBackend.h"
+#include "../core/BoundedQueue.h"
+#include "../core/ImageLoader.h"
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+// Bulk analysis in six stages with a bounded queue in front of each:
+//   scan -> extract -> tokenize -> propagate -> infer -> persist
+// Every stage has its own threads, so parsing the next files overlaps
+// decoding the current ones, and a full queue stalls the stages before it
+// instead of piling up extracted text. stats() shows which stage is the
+// bottleneck: it is busy all the time while the others wait for it.
+// Propagate only does something when start() is given a PropagateFn; files
+// it tags skip Infer.
+class AnalysisPipeline
+{
+public:
+    enum Stage { Scan, Extract, Tokenize, Propagate, Infer, Persist, StageCount };
+    static const char* stageName(Stage stage);
+
+    struct Config {
+        int extractWorkers = 2;     // Parsing is CPU-bound and independent per file
+        int tokenizeWorkers = 1;
+        int propagateWorkers = 1;
+        int inferWorkers = 1;       // Each holds a context; more only help with several contexts
+        int persistWorkers = 1;
+        int batchSize = 4;          // Files per infer call, decoded as parallel sequences
+        size_t queueCapacity = 32;  // Per queue
+        // Queues in front of Infer, if not 0. Files there are already taken
+        // from the source, so keeping them near one batch per infer worker
+        // lets a prioritized source still decide what is decoded next.
+        size_t feedCapacity = 0;
+        int maxImageSide = 768;     // Images are tagged by content when the backend can see them
+    };
+
+    struct Item {
+        std::string path;       // Full path
+        std::string filename;
+        std::string content;    // Extracted text
+        ImageData image;        // Decoded picture, for images tagged by content
+        TagRequest request;     // Prepared prompt
+        std::string result;     // Tags or "Error: ..."
+        std::vector<float> embedding; // Computed by propagation, if it ran; for the caller to index
+    };
+
+    struct StageStats {
+        Stage stage = Scan;
+        int workers = 0;
+        uint64_t processed = 0;
+        size_t backlog = 0;         // Waiting in the stage's input queue
+        size_t capacity = 0;
+        double busySeconds = 0;     // Summed over workers
+        double blockedSeconds = 0;  // Waiting for room in the next queue
+        double utilization = 0;     // busy / (workers * elapsed), 0..1
+    };
+
+    // Next file to analyze (full path); false once there are none left. Called on the scan thread.
+    using Source = std::function<bool(std::string& path)>;
+    // Every finished item, errors included; called on persist threads
+    using PersistFn = std::function<void(const Item&)>;
+    // Up to batchSize text files that still need tags; sets `result` of the ones
+    // it can tag without generating. Called on propagate threads.
+    using PropagateFn = std::function<void(std::vector<Item*>& items)>;
+
+    // Walks `root` on the scan thread the first time it is called
+    static Source scanSource(const std::string& root, bool recursive);
+    static Source listSource(std::vector<std::string> paths);
+
+    explicit AnalysisPipeline(InferenceBackend& backend);
+    ~AnalysisPipeline(); // Cancels and joins
+    AnalysisPipeline(const AnalysisPipeline&) = delete;
+    AnalysisPipeline& operator=(const AnalysisPipeline&) = delete;
+
+    // Returns at once; false if a run is still going
+    bool start(Source source, PersistFn persist, const Config& config, PropagateFn propagate = {});
+    void cancel(); // Stops feeding; items already being decoded finish first
+    void wait();   // Joins the threads of a finished or cancelled run
+    bool isRunning() const { return running; }
+
+    std::vector<StageStats> stats() const;
+    Stage bottleneck() const;   // Highest utilization
+    std::string report() const; // One line for the status bar
+    uint64_t found() const { return nFound; }
+    uint64_t finished() const { return nFinished; }
+    uint64_t failed() const { return nFailed; }
+
+private:
+    InferenceBackend& backend;
+    Config config;
+    Source source;
+    PersistFn persist;
+    PropagateFn propagate;
+
+    std::array<std::unique_ptr<BoundedQueue<Item>>, StageCount> queues; // Input of each stage; none for Scan
+    std::vector<std::thread> threads;
+    std::array<std::atomic<int>, StageCount> active{}; // Workers still running per stage
+    std::atomic<bool> running{false};
+    InferenceBackend::CancelFlag cancelled;
+    std::chrono::steady_clock::time_point started, stopped;
+
+    mutable std::mutex statsMutex;
+    std::array<StageStats, StageCount> totals;
+    std::atomic<uint64_t> nFound{0};
+    std::atomic<uint64_t> nFinished{0};
+    std::atomic<uint64_t> nFailed{0};
+
+    void spawn(Stage stage, int workers, void (AnalysisPipeline::*loop)(Stage));
+    void scanLoop(Stage stage);
+    void extractLoop(Stage stage);
+    void tokenizeLoop(Stage stage);
+    void propagateLoop(Stage stage);
+    void inferLoop(Stage stage);
+    void persistLoop(Stage stage);
+    // Hands `item` to the next stage; false if the run is over
+    bool forward(Stage stage, Item item);
+    void account(Stage stage, double busy, double blocked, uint64_t items);
+    void workerDone(Stage stage); // The last worker of a stage closes the next queue
+};
+
+#endif // ANALYSISPIPELINE_H
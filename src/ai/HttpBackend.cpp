@@ -0,0 +1,363 @@
+#include "HttpBackend.h"
+#include "PromptBuilder.h"
+#include "../core/FileIdentity.h"
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QEventLoop>
+#include <QTimer>
+#include <QUrl>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+
+struct HttpBackend::Call
+{
+    std::string path; // Appended to the endpoint
+    nlohmann::json body;
+    InferenceOptions options;
+    bool stream = false;            // Server-sent events; pieces go to options.onToken
+    QNetworkReply* reply = nullptr; // While in flight
+    QByteArray pending;             // Incomplete event line
+    std::string streamed;           // Text of a stream so far
+    nlohmann::json response;        // Body of a plain request
+    std::string error;              // "Error: ..." if it failed
+};
+
+void HttpBackend::setConfig(const Config& c)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    if (c.endpoint != config.endpoint || c.model != config.model) dimension = 0;
+    config = c;
+    while (!config.endpoint.empty() && config.endpoint.back() == '/') config.endpoint.pop_back();
+}
+
+HttpBackend::Config HttpBackend::getConfig() const
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    return config;
+}
+
+std::string HttpBackend::name() const
+{
+    Config c = getConfig();
+    return "HTTP " + c.endpoint + (c.model.empty() ? "" : " (" + c.model + ")");
+}
+
+bool HttpBackend::isReady() const
+{
+    return !getConfig().endpoint.empty();
+}
+
+// "data: {...}" lines of a chat completion stream; anything else is skipped
+static void readStream(QByteArray& pending, const QByteArray& data, std::string& text, const InferenceOptions& options)
+{
+    pending += data;
+    int nl;
+    while ((nl = pending.indexOf('\n')) >= 0) {
+        QByteArray line = pending.left(nl).trimmed();
+        pending.remove(0, nl + 1);
+        if (!line.startsWith("data:")) continue;
+        QByteArray payload = line.mid(5).trimmed();
+        if (payload == "[DONE]") continue;
+        try {
+            nlohmann::json j = nlohmann::json::parse(payload.toStdString());
+            nlohmann::json delta = j.at("choices").at(0).value("delta", nlohmann::json::object());
+            if (!delta.contains("content") || !delta["content"].is_string()) continue;
+            std::string piece = delta["content"].get<std::string>();
+            if (piece.empty()) continue;
+            text += piece;
+            if (options.onToken) options.onToken(piece);
+        } catch (const std::exception&) {
+            // Keep-alives and vendor extensions
+        }
+    }
+}
+
+void HttpBackend::run(const Config& c, std::vector<Call>& calls)
+{
+    if (calls.empty()) return;
+
+    // Lives on this thread; QtConcurrent workers have an event dispatcher for it
+    QNetworkAccessManager manager;
+    QEventLoop loop;
+    size_t next = 0;
+    int running = 0;
+
+    std::function<void()> startMore = [&] {
+        while (next < calls.size() && running < std::max(1, c.maxInFlight)) {
+            Call& call = calls[next++];
+            if (call.options.stopped()) {
+                call.error = call.options.stopReason();
+                continue;
+            }
+
+            QNetworkRequest request(QUrl(QString::fromStdString(c.endpoint + call.path)));
+            request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+            if (!c.apiKey.empty()) request.setRawHeader("Authorization", "Bearer " + QByteArray::fromStdString(c.apiKey));
+            request.setTransferTimeout(c.timeoutMs);
+            QNetworkReply* reply = manager.post(request, QByteArray::fromStdString(call.body.dump()));
+            call.reply = reply;
+            running++;
+
+            if (call.stream) {
+                QObject::connect(reply, &QNetworkReply::readyRead, [&call, reply] {
+                    readStream(call.pending, reply->readAll(), call.streamed, call.options);
+                });
+            }
+            QObject::connect(reply, &QNetworkReply::finished, [&, reply, target = &call] {
+                Call& done = *target;
+                if (reply->error() != QNetworkReply::NoError) {
+                    if (done.options.stopped()) {
+                        done.error = done.options.stopReason();
+                    } else {
+                        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                        done.error = "Error: HTTP " + (status ? std::to_string(status) + " " : std::string()) +
+                                     reply->errorString().toStdString();
+                    }
+                } else if (done.stream) {
+                    readStream(done.pending, reply->readAll() + "\n", done.streamed, done.options);
+                } else {
+                    try {
+                        done.response = nlohmann::json::parse(reply->readAll().toStdString());
+                    } catch (const std::exception& e) {
+                        done.error = std::string("Error: Bad response: ") + e.what();
+                    }
+                }
+                done.reply = nullptr;
+                reply->deleteLater();
+                running--;
+                startMore();
+                if (running == 0) loop.quit();
+            });
+        }
+    };
+
+    // Cancel flags and deadlines are not signals, so look at them now and then
+    QTimer poll;
+    poll.setInterval(50);
+    QObject::connect(&poll, &QTimer::timeout, [&] {
+        for (Call& call : calls) {
+            if (call.reply && call.options.stopped()) call.reply->abort();
+        }
+    });
+
+    startMore();
+    if (running > 0) {
+        poll.start();
+        loop.exec();
+    }
+}
+
+std::string HttpBackend::answerOf(const Call& call)
+{
+    if (!call.error.empty()) return call.error;
+    if (call.stream) return call.streamed;
+    try {
+        const auto& content = call.response.at("choices").at(0).at("message").at("content");
+        if (content.is_string()) return content.get<std::string>();
+    } catch (const std::exception&) {
+    }
+    return "Error: No answer in response";
+}
+
+nlohmann::json HttpBackend::chatBody(const Config& c, const std::string& system, const std::string& user, bool stream) const
+{
+    nlohmann::json messages = nlohmann::json::array();
+    if (!system.empty()) messages.push_back({{"role", "system"}, {"content", system}});
+    messages.push_back({{"role", "user"}, {"content", user}});
+
+    nlohmann::json body = {
+        {"messages", messages},
+        {"temperature", 0},
+        {"max_tokens", kMaxTokens},
+        {"stream", stream}
+    };
+    if (!c.model.empty()) body["model"] = c.model;
+    return body;
+}
+
+std::string HttpBackend::generateResponse(const std::string& prompt, const InferenceOptions& options)
+{
+    Config c = getConfig();
+    if (c.endpoint.empty()) return "Error: No endpoint configured";
+
+    std::vector<Call> calls(1);
+    calls[0].path = "/chat/completions";
+    calls[0].stream = bool(options.onToken);
+    calls[0].body = chatBody(c, "", prompt, calls[0].stream);
+    calls[0].options = options;
+    run(c, calls);
+    return answerOf(calls[0]);
+}
+
+std::string HttpBackend::tagCacheKey(const Config& c, const std::string& filename, const std::string& content) const
+{
+    std::string input = content.empty() ? "name:" + filename : content;
+    std::string prompt = tagInstructions() + "\nbytes " + std::to_string(c.maxContentBytes);
+    return InferenceCache::makeKey(FileIdentity::fingerprintData(input), "http:" + c.endpoint + "#" + c.model,
+                                   FileIdentity::fingerprintData(prompt));
+}
+
+HttpBackend::Call HttpBackend::tagCall(const Config& c, const std::string& filename, const std::string& content) const
+{
+    Call call;
+    call.path = "/chat/completions";
+    call.body = chatBody(c, tagInstructions(),
+                         tagUserMessage(filename, PromptBuilder::presample(content, c.maxContentBytes, PromptBuilder::Policy())),
+                         false);
+    return call;
+}
+
+std::string HttpBackend::tagsOf(const Call& call, const std::string& key)
+{
+    std::string answer = answerOf(call);
+    if (answer.rfind("Error:", 0) == 0) return answer;
+
+    // No grammar over HTTP, so the answer may need tidying
+    std::string tags = normalizeTags(answer);
+    if (tags.empty()) return "Error: No tags in answer";
+    if (cache && !key.empty()) cache->store(key, tags);
+    return tags;
+}
+
+std::string HttpBackend::suggestTags(const std::string& filename, const std::string& content,
+                                     const InferenceOptions& options)
+{
+    Config c = getConfig();
+    if (c.endpoint.empty()) return "Error: No endpoint configured";
+
+    std::string key;
+    if (cache) {
+        key = tagCacheKey(c, filename, content);
+        std::string tags;
+        if (cache->lookup(key, tags)) {
+            if (options.onToken) options.onToken(tags);
+            return tags;
+        }
+    }
+
+    std::vector<Call> calls;
+    calls.push_back(tagCall(c, filename, content));
+    calls[0].stream = bool(options.onToken);
+    calls[0].body["stream"] = calls[0].stream;
+    calls[0].options = options;
+    run(c, calls);
+    return tagsOf(calls[0], key);
+}
+
+std::vector<std::string> HttpBackend::suggestTagsBatch(const std::vector<std::pair<std::string, std::string>>& files,
+                                                       const InferenceOptions& options)
+{
+    Config c = getConfig();
+    if (c.endpoint.empty()) return std::vector<std::string>(files.size(), "Error: No endpoint configured");
+
+    // Only cache misses go to the server, all of them at once
+    std::vector<std::string> results(files.size());
+    std::vector<std::string> keys(files.size());
+    std::vector<size_t> todo;
+    std::vector<Call> calls;
+    for (size_t i = 0; i < files.size(); ++i) {
+        const auto& [filename, content] = files[i];
+        if (cache) {
+            keys[i] = tagCacheKey(c, filename, content);
+            if (cache->lookup(keys[i], results[i])) continue;
+        }
+        todo.push_back(i);
+        calls.push_back(tagCall(c, filename, content));
+        calls.back().options.cancel = options.cancel;
+        calls.back().options.deadline = options.deadline;
+    }
+    run(c, calls);
+
+    for (size_t j = 0; j < todo.size(); ++j) results[todo[j]] = tagsOf(calls[j], keys[todo[j]]);
+    return results;
+}
+
+static int64_t steadyMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool HttpBackend::canEmbed() const
+{
+    return isReady() && (dimension >= 0 || steadyMs() - probedAt >= kProbeRetryMs);
+}
+
+int HttpBackend::embeddingSize() const
+{
+    // Servers don't advertise it; one probe tells. The answer is kept, a
+    // missing /embeddings too, so callers can ask as often as they like.
+    if (dimension > 0) return dimension;
+    std::lock_guard<std::mutex> lock(probeMutex);
+    if (dimension > 0) return dimension;
+    if (dimension < 0 && steadyMs() - probedAt < kProbeRetryMs) return 0;
+    fetchEmbeddings(getConfig(), {"dimension"});
+    if (dimension > 0) return dimension;
+    probedAt = steadyMs();
+    dimension = -1;
+    return 0;
+}
+
+std::string HttpBackend::embeddingId() const
+{
+    Config c = getConfig();
+    return "http:" + c.endpoint + "#" + c.model;
+}
+
+std::vector<float> HttpBackend::embed(const std::string& text)
+{
+    return fetchEmbeddings(getConfig(), {text})[0];
+}
+
+std::vector<std::vector<float>> HttpBackend::embedBatch(const std::vector<std::string>& texts)
+{
+    return fetchEmbeddings(getConfig(), texts);
+}
+
+std::vector<std::vector<float>> HttpBackend::fetchEmbeddings(const Config& c, const std::vector<std::string>& texts) const
+{
+    std::vector<std::vector<float>> vectors(texts.size());
+    if (c.endpoint.empty() || texts.empty()) return vectors;
+
+    // A few texts per request; the requests themselves run concurrently
+    std::vector<Call> calls;
+    for (size_t i = 0; i < texts.size(); i += kEmbedBatch) {
+        nlohmann::json input = nlohmann::json::array();
+        for (size_t j = i; j < std::min(texts.size(), i + kEmbedBatch); ++j) {
+            input.push_back(PromptBuilder::presample(texts[j], kEmbedBytes, PromptBuilder::Policy()));
+        }
+        Call call;
+        call.path = "/embeddings";
+        call.body = {{"input", input}};
+        if (!c.model.empty()) call.body["model"] = c.model;
+        calls.push_back(std::move(call));
+    }
+    run(c, calls);
+
+    for (size_t k = 0; k < calls.size(); ++k) {
+        if (!calls[k].error.empty()) {
+            std::cerr << "Embedding request failed: " << calls[k].error << std::endl;
+            continue;
+        }
+        try {
+            for (const auto& d : calls[k].response.at("data")) {
+                size_t i = k * kEmbedBatch + d.value("index", 0);
+                if (i >= texts.size()) continue;
+                std::vector<float> v = d.at("embedding").get<std::vector<float>>();
+                double norm = 0;
+                for (float x : v) norm += double(x) * x;
+                if (norm <= 0) continue;
+                for (float& x : v) x = float(x / std::sqrt(norm));
+                if (dimension <= 0) dimension = (int) v.size();
+                vectors[i] = std::move(v);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error reading embeddings: " << e.what() << std::endl;
+        }
+    }
+    return vectors;
+}
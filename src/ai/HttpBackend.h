@@ -0,0 +1,75 @@
+#ifndef HTTPBACKEND_H
+#define HTTPBACKEND_H
+
+#include "InferenceBackend.h"
+#include "InferenceCache.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <nlohmann/json.hpp>
+
+// Talks to a local OpenAI-compatible server (llama-server, vLLM, Ollama, ...)
+// over /chat/completions and /embeddings. Each call runs its requests in a
+// local event loop on the calling thread; batches keep up to maxInFlight
+// requests open at once so the server can batch them on its side.
+class HttpBackend : public InferenceBackend
+{
+public:
+    struct Config {
+        std::string endpoint = "http://localhost:8080/v1"; // /chat/completions etc. are appended
+        std::string model;          // Sent as "model" when set; llama-server ignores it
+        std::string apiKey;         // Bearer token, if the server wants one
+        int maxInFlight = 4;        // Concurrent requests per batch
+        int timeoutMs = 120000;     // Per request, without any data
+        size_t maxContentBytes = 12000; // File content per tag prompt, presampled like PromptBuilder does
+    };
+
+    HttpBackend() = default;
+
+    void setConfig(const Config& c);
+    Config getConfig() const;
+    // Tag suggestions are cached like LlamaEngine's; the endpoint and model stand in for the model file
+    void setCache(InferenceCache* c) { cache = c; }
+
+    std::string name() const override;
+    bool isReady() const override;
+
+    std::string generateResponse(const std::string& prompt, const InferenceOptions& options = {}) override;
+    std::string suggestTags(const std::string& filename, const std::string& content,
+                            const InferenceOptions& options = {}) override;
+    std::vector<std::string> suggestTagsBatch(const std::vector<std::pair<std::string, std::string>>& files,
+                                              const InferenceOptions& options = {}) override;
+
+    bool canEmbed() const override; // False for a while after the server turned out to have no /embeddings
+    int embeddingSize() const override; // Asks the server once
+    std::string embeddingId() const override;
+    std::vector<float> embed(const std::string& text) override;
+    std::vector<std::vector<float>> embedBatch(const std::vector<std::string>& texts) override;
+
+    static constexpr int kMaxTokens = 256;      // Per answer
+    static constexpr size_t kEmbedBatch = 64;   // Texts per /embeddings request
+    static constexpr size_t kEmbedBytes = 1500; // Per text; keeps it within a default 512-token ubatch
+    static constexpr int64_t kProbeRetryMs = 5 * 60 * 1000; // Before asking a server without embeddings again
+
+private:
+    struct Call; // One request and what came back
+
+    mutable std::mutex configMutex;
+    Config config;
+    InferenceCache* cache = nullptr;
+    mutable std::mutex probeMutex;           // One dimension probe at a time
+    mutable std::atomic<int> dimension{0};   // Of embeddings once known, -1 if the server has none
+    mutable std::atomic<int64_t> probedAt{0}; // When it turned out to have none, steady ms
+
+    nlohmann::json chatBody(const Config& c, const std::string& system, const std::string& user, bool stream) const;
+    std::string tagCacheKey(const Config& c, const std::string& filename, const std::string& content) const;
+    Call tagCall(const Config& c, const std::string& filename, const std::string& content) const;
+    std::string tagsOf(const Call& call, const std::string& key); // Normalized and cached, or "Error: ..."
+    std::vector<std::vector<float>> fetchEmbeddings(const Config& c, const std::vector<std::string>& texts) const;
+    // Sends every call, at most maxInFlight at a time, and returns once all have finished
+    static void run(const Config& c, std::vector<Call>& calls);
+    static std::string answerOf(const Call& call);
+};
+
+#endif // HTTPBACKEND_H
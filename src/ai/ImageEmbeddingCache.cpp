@@ -0,0 +1,119 @@
+#include "ImageEmbeddingCache.h"
+#include "../core/FileIdentity.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+// "SFIE", version, float count, then the floats in native byte order
+static const char kMagic[4] = {'S', 'F', 'I', 'E'};
+static constexpr uint32_t kVersion = 1;
+
+ImageEmbeddingCache::ImageEmbeddingCache(uint64_t max)
+    : maxBytes(max)
+{
+}
+
+void ImageEmbeddingCache::open(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    dir = directory;
+    totalBytes = 0;
+    if (dir.empty()) return;
+
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file(ec)) totalBytes += entry.file_size(ec);
+    }
+    prune();
+}
+
+bool ImageEmbeddingCache::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !dir.empty();
+}
+
+std::string ImageEmbeddingCache::fileOf(const std::string& key) const
+{
+    return (fs::path(dir) / (FileIdentity::fingerprintData(key) + ".emb")).string();
+}
+
+bool ImageEmbeddingCache::load(const std::string& key, size_t count, std::vector<float>& out) const
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dir.empty()) return false;
+        path = fileOf(key);
+    }
+
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t n = 0;
+    f.read(magic, 4);
+    f.read(reinterpret_cast<char*>(&version), sizeof(version));
+    f.read(reinterpret_cast<char*>(&n), sizeof(n));
+    if (!f || std::memcmp(magic, kMagic, 4) != 0 || version != kVersion || n != count) return false;
+
+    out.resize(count);
+    f.read(reinterpret_cast<char*>(out.data()), count * sizeof(float));
+    if (!f) return false;
+
+    // Recently used files survive pruning longer
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+void ImageEmbeddingCache::store(const std::string& key, const float* data, size_t count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (dir.empty()) return;
+
+    std::string path = fileOf(key);
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        uint64_t n = count;
+        f.write(kMagic, 4);
+        f.write(reinterpret_cast<const char*>(&kVersion), sizeof(kVersion));
+        f.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        f.write(reinterpret_cast<const char*>(data), count * sizeof(float));
+        if (!f) {
+            std::cerr << "Error writing image embedding cache " << tmp << std::endl;
+            return;
+        }
+    }
+    std::error_code ec;
+    uint64_t old = fs::exists(path, ec) ? fs::file_size(path, ec) : 0;
+    fs::rename(tmp, path, ec);
+    if (ec) return;
+    totalBytes = totalBytes - std::min(totalBytes, old) + fs::file_size(path, ec);
+    if (totalBytes > maxBytes) prune();
+}
+
+void ImageEmbeddingCache::prune()
+{
+    if (totalBytes <= maxBytes) return;
+
+    struct File { fs::path path; fs::file_time_type time; uint64_t size; };
+    std::vector<File> files;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file(ec)) files.push_back({entry.path(), entry.last_write_time(ec), entry.file_size(ec)});
+    }
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.time < b.time; });
+
+    // Down to 90%, so that not every store() prunes again
+    for (const auto& f : files) {
+        if (totalBytes <= maxBytes / 10 * 9) break;
+        if (fs::remove(f.path, ec)) totalBytes -= std::min(totalBytes, f.size);
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef IMAGEEMBEDDINGCACHE_H
+#define IMAGEEMBEDDINGCACHE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+// Encoded images (projector output, n_tokens x n_embd floats) on disk, one
+// file per key, so re-tagging a photo skips the vision encoder. A few MB per
+// image; the oldest files are removed once the directory outgrows maxBytes.
+class ImageEmbeddingCache
+{
+public:
+    explicit ImageEmbeddingCache(uint64_t maxBytes = 1ull << 30);
+
+    void open(const std::string& directory); // Created if missing; empty: disabled
+    bool isOpen() const;
+
+    // False unless exactly `count` floats were stored under `key`
+    bool load(const std::string& key, size_t count, std::vector<float>& out) const;
+    void store(const std::string& key, const float* data, size_t count);
+
+private:
+    mutable std::mutex mutex;
+    std::string dir;
+    uint64_t maxBytes;
+    uint64_t totalBytes = 0;
+
+    std::string fileOf(const std::string& key) const;
+    void prune(); // Requires mutex
+};
+
+#endif // IMAGEEMBEDDINGCACHE_H
@@ -0,0 +1,109 @@
+#include "InferenceBackend.h"
+#include <set>
+
+bool InferenceOptions::stopped() const
+{
+    if (cancel && *cancel) return true;
+    return deadline != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() >= deadline;
+}
+
+std::string InferenceOptions::stopReason() const
+{
+    return cancel && *cancel ? "Error: Cancelled" : "Error: Deadline exceeded";
+}
+
+std::string InferenceBackend::suggestImageTags(const std::string&, const ImageData&, const InferenceOptions&)
+{
+    return "Error: This backend cannot read images";
+}
+
+std::vector<std::string> InferenceBackend::suggestImageTagsBatch(const std::vector<std::pair<std::string, ImageData>>& images,
+                                                                 const InferenceOptions& options)
+{
+    std::vector<std::string> results;
+    for (const auto& [filename, image] : images) results.push_back(suggestImageTags(filename, image, options));
+    return results;
+}
+
+TagRequest InferenceBackend::prepareTags(const std::string& filename, const std::string& content)
+{
+    TagRequest request;
+    request.filename = filename;
+    request.content = content;
+    return request;
+}
+
+std::vector<std::string> InferenceBackend::suggestPreparedTags(const std::vector<TagRequest>& requests,
+                                                               const InferenceOptions& options)
+{
+    std::vector<std::string> results(requests.size());
+    std::vector<std::pair<std::string, std::string>> files;
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        if (!requests[i].cached.empty()) {
+            results[i] = requests[i].cached;
+            continue;
+        }
+        files.push_back({requests[i].filename, requests[i].content});
+        todo.push_back(i);
+    }
+    if (files.empty()) return results;
+
+    std::vector<std::string> generated = suggestTagsBatch(files, options);
+    for (size_t j = 0; j < todo.size(); ++j) results[todo[j]] = generated[j];
+    return results;
+}
+
+const std::string& InferenceBackend::tagInstructions()
+{
+    static const std::string instructions =
+        "You are a helpful file organization assistant. Analyze the given file metadata and content to suggest strict tags.\n"
+        "Rules:\n"
+        "1. Output ONLY a comma-separated list of tags.\n"
+        "2. Suggest 3-5 tags.\n"
+        "3. Use Traditional Chinese (繁體中文) for general concepts.\n"
+        "4. Keep tags concise (under 5 words).\n";
+    return instructions;
+}
+
+std::string InferenceBackend::tagUserMessage(const std::string& filename, const std::string& content)
+{
+    return "Filename: " + filename + "\n"
+           "Content Preview: " + (content.empty() ? std::string("(No content)") : content);
+}
+
+static std::string trim(const std::string& s)
+{
+    const char* ws = " \t\r\n\"'`*-."; // Quotes, bullets and full stops too; ASCII only, so UTF-8 stays intact
+    size_t b = s.find_first_not_of(ws);
+    if (b == std::string::npos) return "";
+    return s.substr(b, s.find_last_not_of(ws) - b + 1);
+}
+
+std::string InferenceBackend::normalizeTags(const std::string& answer)
+{
+    // Half- and full-width separators; models without a grammar use all of them
+    static const char* separators[] = {",", "，", "、", "\n", ";", "；", "。"};
+
+    std::vector<std::string> tags;
+    std::set<std::string> seen;
+    size_t start = 0;
+    while (start <= answer.size() && tags.size() < 5) {
+        size_t end = std::string::npos, len = 0;
+        for (const char* sep : separators) {
+            size_t p = answer.find(sep, start);
+            if (p < end) {
+                end = p;
+                len = std::char_traits<char>::length(sep);
+            }
+        }
+        std::string tag = trim(answer.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (!tag.empty() && tag.size() <= 64 && seen.insert(tag).second) tags.push_back(tag);
+        if (end == std::string::npos) break;
+        start = end + len;
+    }
+
+    std::string result;
+    for (const auto& t : tags) result += (result.empty() ? "" : ", ") + t;
+    return result;
+}
@@ -0,0 +1,88 @@
+#ifndef INFERENCEBACKEND_H
+#define INFERENCEBACKEND_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "../core/ImageLoader.h"
+
+// Per request, all optional. A cancelled or late request returns
+// "Error: Cancelled" / "Error: Deadline exceeded" and is not cached.
+struct InferenceOptions
+{
+    std::function<void(const std::string& piece)> onToken; // Each new piece, on the generating thread
+    std::shared_ptr<std::atomic<bool>> cancel;              // Checked between decodes / while waiting
+    std::chrono::steady_clock::time_point deadline{};       // Default: none
+
+    bool stopped() const;
+    std::string stopReason() const; // The error string to return
+};
+
+// A tag request whose prompt was built ahead of generation, see prepareTags()
+struct TagRequest
+{
+    std::string filename;
+    std::string content;
+    std::string cacheKey;        // Empty: not cached
+    std::string cached;          // The cache's answer; nothing left to generate
+    std::vector<int32_t> tokens; // The backend's prompt; empty: built when generating
+};
+
+// Whatever answers our prompts: the in-process llama.cpp engine, a local
+// OpenAI-compatible server, or a mock. All calls may block and are made from
+// worker threads; failures come back as "Error: ..." strings / empty vectors.
+class InferenceBackend
+{
+public:
+    using CancelFlag = std::shared_ptr<std::atomic<bool>>;
+
+    virtual ~InferenceBackend() = default;
+
+    virtual std::string name() const = 0; // For the status bar
+    virtual bool isReady() const = 0;
+
+    virtual std::string generateResponse(const std::string& prompt, const InferenceOptions& options = {}) = 0;
+    // 3-5 comma-separated tags
+    virtual std::string suggestTags(const std::string& filename, const std::string& content,
+                                    const InferenceOptions& options = {}) = 0;
+    // Results in input order
+    virtual std::vector<std::string> suggestTagsBatch(const std::vector<std::pair<std::string, std::string>>& files,
+                                                      const InferenceOptions& options = {}) = 0;
+
+    // The CPU part of a tag request (cache lookup, packing, tokenizing) apart
+    // from generation, so a pipeline can prepare the next files while earlier
+    // ones decode. By default nothing is done ahead.
+    virtual TagRequest prepareTags(const std::string& filename, const std::string& content);
+    // Results in input order
+    virtual std::vector<std::string> suggestPreparedTags(const std::vector<TagRequest>& requests,
+                                                         const InferenceOptions& options = {});
+
+    // Image understanding; without it images are tagged by name only
+    virtual bool canSeeImages() const { return false; }
+    virtual std::string suggestImageTags(const std::string& filename, const ImageData& image,
+                                         const InferenceOptions& options = {});
+    // (filename, image) pairs; results in input order. By default one by one.
+    virtual std::vector<std::string> suggestImageTagsBatch(const std::vector<std::pair<std::string, ImageData>>& images,
+                                                           const InferenceOptions& options = {});
+
+    // Unit length
+    virtual bool canEmbed() const = 0;
+    virtual int embeddingSize() const = 0;
+    // Which vector space embed() maps into; vectors from different ones can't be compared
+    virtual std::string embeddingId() const { return name(); }
+    virtual std::vector<float> embed(const std::string& text) = 0;
+    virtual std::vector<std::vector<float>> embedBatch(const std::vector<std::string>& texts) = 0;
+
+    // The tag prompt, shared so every backend asks the same question
+    static const std::string& tagInstructions();
+    static std::string tagUserMessage(const std::string& filename, const std::string& content);
+    // Cleans up an unconstrained answer: splits on any comma, trims, drops
+    // duplicates, keeps at most 5. Empty if nothing usable is left.
+    static std::string normalizeTags(const std::string& answer);
+};
+
+#endif // INFERENCEBACKEND_H
@@ -0,0 +1,181 @@
+#include "InferenceCache.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+// Snapshot: { "version": 1, "entries": [ ["<key>", "<value>"], ... ] }, most recently used first
+// Log: one ["<key>", "<value>"] per store, newest last
+InferenceCache::InferenceCache(size_t cap)
+    : capacity(cap)
+{
+}
+
+void InferenceCache::open(const std::string& file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (log.is_open()) log.close();
+    path = file;
+    entries.clear();
+    byKey.clear();
+    logLines = 0;
+
+    auto touch = [this](const std::string& key, const std::string& value) {
+        auto it = byKey.find(key);
+        if (it != byKey.end()) {
+            it->second->second = value;
+            entries.splice(entries.begin(), entries, it->second);
+        } else {
+            entries.emplace_front(key, value);
+            byKey[key] = entries.begin();
+        }
+    };
+    try {
+        if (fs::exists(path)) {
+            std::ifstream f(path);
+            nlohmann::json j = nlohmann::json::parse(f);
+            if (j.value("version", 0) == 1) {
+                for (const auto& e : j["entries"]) {
+                    std::string key = e.at(0).get<std::string>();
+                    if (byKey.count(key)) continue;
+                    entries.emplace_back(key, e.at(1).get<std::string>());
+                    byKey[key] = std::prev(entries.end());
+                }
+            }
+        }
+        // A torn last line from a crash is skipped
+        std::ifstream f(path + ".log", std::ios::binary);
+        std::string line;
+        while (std::getline(f, line)) {
+            nlohmann::json e = nlohmann::json::parse(line, nullptr, false);
+            if (!e.is_array() || e.size() != 2 || !e[0].is_string() || !e[1].is_string()) continue;
+            logLines++;
+            touch(e[0].get<std::string>(), e[1].get<std::string>());
+        }
+        evict();
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading inference cache: " << e.what() << std::endl;
+        entries.clear();
+        byKey.clear();
+    }
+}
+
+void InferenceCache::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (log.is_open()) log.flush();
+}
+
+std::string InferenceCache::makeKey(const std::string& input, const std::string& model, const std::string& prompt)
+{
+    return model + "/" + prompt + "/" + input;
+}
+
+bool InferenceCache::lookup(const std::string& key, std::string& value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = byKey.find(key);
+    if (it == byKey.end()) {
+        missCount++;
+        return false;
+    }
+    // Reordering alone is not worth a write; the next store() persists it
+    entries.splice(entries.begin(), entries, it->second);
+    value = it->second->second;
+    hitCount++;
+    return true;
+}
+
+void InferenceCache::store(const std::string& key, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = byKey.find(key);
+    if (it != byKey.end()) {
+        it->second->second = value;
+        entries.splice(entries.begin(), entries, it->second);
+    } else {
+        entries.emplace_front(key, value);
+        byKey[key] = entries.begin();
+        evict();
+    }
+    append({key, value});
+}
+
+void InferenceCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    byKey.clear();
+    if (!path.empty()) writeSnapshot();
+}
+
+void InferenceCache::setCapacity(size_t cap)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = cap;
+    evict(); // The next snapshot leaves the evicted entries out; until then loading evicts them again
+}
+
+size_t InferenceCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+void InferenceCache::evict()
+{
+    while (entries.size() > capacity) {
+        byKey.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+void InferenceCache::append(const nlohmann::json& line)
+{
+    if (path.empty()) return;
+    if (logLines >= std::max<size_t>(1024, capacity)) {
+        writeSnapshot();
+        return;
+    }
+    if (!log.is_open()) {
+        std::error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+        log.open(path + ".log", std::ios::binary | std::ios::app);
+    }
+    log << line.dump() << '\n';
+    if (!log) {
+        std::cerr << "Error writing inference cache log " << path << ".log" << std::endl;
+        log.close();
+        return;
+    }
+    logLines++;
+}
+
+void InferenceCache::writeSnapshot()
+{
+    // Temp file + rename like the other metadata; a crash before the log is
+    // emptied only replays stores the snapshot already has
+    try {
+        std::error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+        std::string tmp = path + ".tmp";
+        {
+            nlohmann::json list = nlohmann::json::array();
+            for (const auto& [key, value] : entries) list.push_back({key, value});
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            f << nlohmann::json{ {"version", 1}, {"entries", std::move(list)} }.dump();
+            f.flush();
+            if (!f) {
+                std::cerr << "Error saving inference cache: write failed for " << tmp << std::endl;
+                return;
+            }
+        }
+        fs::rename(tmp, path);
+        if (log.is_open()) log.close();
+        std::ofstream(path + ".log", std::ios::binary | std::ios::trunc);
+        logLines = 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error saving inference cache: " << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef INFERENCECACHE_H
+#define INFERENCECACHE_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+// Persistent LRU cache of generated answers, e.g. tags per file. Keys combine
+// the input fingerprint with the model and prompt fingerprints, so a new model
+// or prompt template never sees old answers; those simply age out.
+// Thread-safe. Stored as a JSON snapshot plus <path>.log, which gets a line
+// per store and is folded back into the snapshot once it outgrows the cache,
+// so a store costs one short append instead of writing every entry.
+class InferenceCache
+{
+public:
+    explicit InferenceCache(size_t capacity = 20000);
+
+    // Loads <path> if it exists; later stores are written back there
+    void open(const std::string& path);
+    void flush(); // Stores are appended as they happen; this only pushes them to the OS
+
+    static std::string makeKey(const std::string& input, const std::string& model, const std::string& prompt);
+
+    bool lookup(const std::string& key, std::string& value);
+    void store(const std::string& key, const std::string& value);
+    void clear();
+
+    void setCapacity(size_t entries);
+    size_t size() const;
+    uint64_t hits() const { return hitCount; }
+    uint64_t misses() const { return missCount; }
+
+private:
+    using Entry = std::pair<std::string, std::string>; // key, value
+
+    mutable std::mutex mutex;
+    size_t capacity;
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> byKey;
+    std::string path;
+    std::ofstream log;
+    size_t logLines = 0;
+
+    std::atomic<uint64_t> hitCount{0};
+    std::atomic<uint64_t> missCount{0};
+
+    void evict();          // Requires mutex
+    void append(const nlohmann::json& line); // Requires mutex; a snapshot instead once the log is long
+    void writeSnapshot();  // Requires mutex; also empties the log
+};
+
+#endif // INFERENCECACHE_H
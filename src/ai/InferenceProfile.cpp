@@ -0,0 +1,284 @@
+#include "InferenceProfile.h"
+#include "ggml-backend.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static ggml_type kvType(const std::string& name)
+{
+    if (name == "q8_0") return GGML_TYPE_Q8_0;
+    if (name == "q4_0") return GGML_TYPE_Q4_0;
+    return GGML_TYPE_F16;
+}
+
+// Quantized V needs flash attention; without it llama.cpp refuses to create the context
+static ggml_type kvTypeV(const std::string& name, const std::string& flashAttention)
+{
+    return flashAttention == "off" ? GGML_TYPE_F16 : kvType(name);
+}
+
+static constexpr int kContextGranularity = 256;
+static constexpr int kMinContextSize = 512;
+
+void InferenceProfile::applyTo(llama_model_params& params) const
+{
+    params.n_gpu_layers = gpuLayers;
+    params.use_mmap = useMmap;
+    params.use_mlock = useMlock;
+}
+
+void InferenceProfile::applyTo(llama_context_params& params) const
+{
+    if (threads > 0) params.n_threads = threads;
+    if (batchThreads > 0) params.n_threads_batch = batchThreads;
+    if (contexts > 1) {
+        // Concurrent contexts split the cores instead of each grabbing all of them
+        int share = std::max(1, int(std::thread::hardware_concurrency()) / contexts);
+        if (threads <= 0) params.n_threads = share;
+        if (batchThreads <= 0) params.n_threads_batch = share;
+    }
+    if (batchSize > 0) params.n_batch = batchSize;
+    if (ubatchSize > 0) params.n_ubatch = std::min(ubatchSize, batchSize > 0 ? batchSize : ubatchSize);
+
+    if (flashAttention == "on") params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    else if (flashAttention == "off") params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_DISABLED;
+    else params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_AUTO;
+
+    params.type_k = kvType(kvCacheType);
+    params.type_v = kvTypeV(kvCacheType, flashAttention);
+}
+
+int InferenceProfile::resolveContextSize(const llama_model* model, int workload) const
+{
+    int n = contextSize;
+    if (n <= 0) {
+        n = (workload + kContextGranularity - 1) / kContextGranularity * kContextGranularity;
+    }
+    int trained = model ? llama_model_n_ctx_train(model) : 0;
+    if (trained > 0) n = std::min(n, trained);
+    return std::max(n, kMinContextSize);
+}
+
+InferenceProfile::MemoryEstimate InferenceProfile::estimateMemory(const llama_model* model, int n_ctx) const
+{
+    MemoryEstimate e;
+    e.contextSize = n_ctx;
+    if (!model) return e;
+
+    const int64_t n_layer = llama_model_n_layer(model);
+    const int64_t n_embd = llama_model_n_embd(model);
+    const int64_t n_head = std::max(1, llama_model_n_head(model));
+    const int64_t n_head_kv = std::max(1, llama_model_n_head_kv(model));
+    const int64_t n_embd_gqa = n_embd / n_head * n_head_kv; // K and V width per token and layer
+    const int64_t n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    const int64_t n_ubatch = std::min(ubatchSize > 0 ? ubatchSize : 512, n_ctx);
+
+    e.weights = llama_model_size(model);
+    if (gpuLayers > 0 && n_layer > 0) e.offloaded = std::min(1.0, double(gpuLayers) / n_layer);
+    e.kvCache = uint64_t(n_ctx) * n_layer *
+                (ggml_row_size(kvType(kvCacheType), n_embd_gqa) +
+                 ggml_row_size(kvTypeV(kvCacheType, flashAttention), n_embd_gqa));
+
+    // Activations of one ubatch, plus the KQ matrix that flash attention avoids, plus logits
+    e.compute = uint64_t(n_ubatch) * n_embd * sizeof(float) * 8;
+    if (flashAttention == "off") e.compute += uint64_t(n_ubatch) * n_ctx * n_head * sizeof(float);
+    e.compute += uint64_t(n_vocab) * n_ubatch * sizeof(float);
+    return e;
+}
+
+int InferenceProfile::contextsThatFit(const MemoryEstimate& estimate) const
+{
+    int wanted = std::max(1, contexts);
+    if (estimate.perContext() == 0) return wanted;
+
+    // Leave a tenth for the OS, the driver and the rest of the app
+    uint64_t fit = wanted;
+    auto limit = [&fit](uint64_t memory, uint64_t weights, uint64_t perContext) {
+        uint64_t usable = memory / 10 * 9;
+        fit = usable <= weights ? 1 : std::min<uint64_t>(fit, (usable - weights) / std::max<uint64_t>(perContext, 1));
+    };
+
+    // Offloaded layers keep their weights and KV cells on the device; compute buffers exist on both sides
+    uint64_t vram = estimate.offloaded > 0 ? deviceMemory() : 0;
+    double onHost = 1;
+    if (vram > 0) {
+        limit(vram, uint64_t(estimate.weights * estimate.offloaded),
+              uint64_t(estimate.kvCache * estimate.offloaded) + estimate.compute);
+        onHost = 1 - estimate.offloaded;
+    }
+    uint64_t ram = physicalMemory();
+    if (ram > 0 && fit > 1) {
+        limit(ram, uint64_t(estimate.weights * onHost), uint64_t(estimate.kvCache * onHost) + estimate.compute);
+    }
+    return (int) std::clamp<uint64_t>(fit, 1, wanted);
+}
+
+uint64_t InferenceProfile::physicalMemory()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? status.ullTotalPhys : 0;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGE_SIZE);
+    return pages > 0 && pageSize > 0 ? uint64_t(pages) * uint64_t(pageSize) : 0;
+#endif
+}
+
+uint64_t InferenceProfile::deviceMemory()
+{
+    // Total rather than free: when this is asked the model's own weights are usually loaded already
+    uint64_t sum = 0;
+    for (size_t i = 0; i < ggml_backend_dev_count(); ++i) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        if (ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_GPU) continue;
+        size_t free = 0, total = 0;
+        ggml_backend_dev_memory(dev, &free, &total);
+        sum += total;
+    }
+    return sum;
+}
+
+std::string InferenceProfile::MemoryEstimate::describe(int contexts) const
+{
+    auto mib = [](uint64_t bytes) { return std::to_string((bytes + (1 << 20) - 1) >> 20) + " MiB"; };
+    std::ostringstream out;
+    out << "~" << mib(total(contexts)) << ": weights " << mib(weights)
+        << " + " << contexts << " x (KV " << mib(kvCache) << " + compute " << mib(compute) << ")"
+        << " at n_ctx " << contextSize;
+    return out.str();
+}
+
+std::string InferenceProfile::describe() const
+{
+    auto orAuto = [](int v) { return v > 0 ? std::to_string(v) : std::string("auto"); };
+    std::ostringstream out;
+    out << "threads " << orAuto(threads) << "/" << orAuto(batchThreads)
+        << ", batch " << batchSize << "/" << ubatchSize
+        << ", ctx " << orAuto(contextSize) << " x" << contexts
+        << ", gpu layers " << gpuLayers
+        << ", flash-attn " << flashAttention
+        << ", kv " << kvCacheType;
+    return out.str();
+}
+
+std::string InferenceProfile::resolveApiKey() const
+{
+    if (!apiKey.empty()) return apiKey;
+    const char* env = std::getenv("SMARTFILE_API_KEY");
+    return env ? env : "";
+}
+
+nlohmann::json InferenceProfile::toJson() const
+{
+    return {
+        {"version", 1},
+        {"gpuLayers", gpuLayers},
+        {"contextSize", contextSize},
+        {"contexts", contexts},
+        {"threads", threads},
+        {"batchThreads", batchThreads},
+        {"batchSize", batchSize},
+        {"ubatchSize", ubatchSize},
+        {"flashAttention", flashAttention},
+        {"kvCacheType", kvCacheType},
+        {"useMmap", useMmap},
+        {"useMlock", useMlock},
+        {"warmUp", warmUp},
+        {"summarizeLongContent", summarizeLongContent},
+        {"draftLength", draftLength},
+        {"backend", backend},
+        {"endpoint", endpoint},
+        {"endpointModel", endpointModel},
+        {"apiKey", apiKey},
+        {"maxInFlight", maxInFlight},
+        {"folderFilesPerMinute", folderFilesPerMinute}
+    };
+}
+
+InferenceProfile InferenceProfile::fromJson(const nlohmann::json& j)
+{
+    InferenceProfile p;
+    p.gpuLayers = j.value("gpuLayers", p.gpuLayers);
+    p.contextSize = j.value("contextSize", p.contextSize);
+    p.contexts = j.value("contexts", p.contexts);
+    p.threads = j.value("threads", p.threads);
+    p.batchThreads = j.value("batchThreads", p.batchThreads);
+    p.batchSize = j.value("batchSize", p.batchSize);
+    p.ubatchSize = j.value("ubatchSize", p.ubatchSize);
+    p.flashAttention = j.value("flashAttention", p.flashAttention);
+    p.kvCacheType = j.value("kvCacheType", p.kvCacheType);
+    p.useMmap = j.value("useMmap", p.useMmap);
+    p.useMlock = j.value("useMlock", p.useMlock);
+    p.warmUp = j.value("warmUp", p.warmUp);
+    p.summarizeLongContent = j.value("summarizeLongContent", p.summarizeLongContent);
+    p.draftLength = j.value("draftLength", p.draftLength);
+    p.backend = j.value("backend", p.backend);
+    p.endpoint = j.value("endpoint", p.endpoint);
+    p.endpointModel = j.value("endpointModel", p.endpointModel);
+    p.apiKey = j.value("apiKey", p.apiKey);
+    p.maxInFlight = j.value("maxInFlight", p.maxInFlight);
+    p.folderFilesPerMinute = j.value("folderFilesPerMinute", p.folderFilesPerMinute);
+    return p;
+}
+
+bool InferenceProfile::load(const std::string& path)
+{
+    if (!fs::exists(path)) return false;
+    try {
+        std::ifstream f(path);
+        *this = fromJson(nlohmann::json::parse(f));
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading inference profile: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool InferenceProfile::save(const std::string& path) const
+{
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    std::string tmp = path + ".tmp";
+    std::string text = toJson().dump(4);
+    fs::remove(tmp, ec); // A leftover may have looser permissions
+#ifdef _WIN32
+    bool ok;
+    {
+        std::ofstream f(tmp, std::ios::trunc | std::ios::binary);
+        ok = bool(f << text);
+    }
+#else
+    // The API key is in there, so the file is owner-only from the moment it exists
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    bool ok = fd >= 0;
+    for (size_t done = 0; ok && done < text.size(); ) {
+        ssize_t n = ::write(fd, text.data() + done, text.size() - done);
+        ok = n > 0;
+        if (ok) done += size_t(n);
+    }
+    if (fd >= 0) ::close(fd);
+#endif
+    if (!ok) {
+        std::cerr << "Error saving inference profile to " << path << std::endl;
+        fs::remove(tmp, ec);
+        return false;
+    }
+    ec.clear();
+    fs::rename(tmp, path, ec);
+    return !ec;
+}
@@ -0,0 +1,73 @@
+#ifndef INFERENCEPROFILE_H
+#define INFERENCEPROFILE_H
+
+#include "llama.h"
+#include <string>
+#include <nlohmann/json.hpp>
+
+// Runtime settings for model loading and contexts, persisted as JSON
+// (<AppData>/inference.json). Zero means "let llama.cpp decide".
+struct InferenceProfile
+{
+    int gpuLayers = 100;        // Layers offloaded to the GPU; 0 for CPU-only servers
+    int contextSize = 0;        // Per context; 0 sizes it to the workload
+    int contexts = 1;           // Concurrent generations; each context has its own KV cache
+    int threads = 0;            // Token generation
+    int batchThreads = 0;       // Prompt processing
+    int batchSize = 2048;       // Logical batch: tokens per llama_decode call
+    int ubatchSize = 512;       // Physical batch: tokens per compute graph
+    std::string flashAttention = "auto"; // "auto", "on" or "off"
+    std::string kvCacheType = "f16";     // "f16", "q8_0" or "q4_0"
+    bool useMmap = true;
+    bool useMlock = false;
+    bool warmUp = true;         // Run one decode right after loading
+    bool summarizeLongContent = true; // Map-reduce content that exceeds the prompt budget instead of sampling it
+    int draftLength = 5;        // Tokens a draft model proposes per step; 0 turns speculative decoding off
+
+    // Where prompts go: "llama" (in process, everything above applies),
+    // "http" (an OpenAI-compatible server at `endpoint`) or "mock"
+    std::string backend = "llama";
+    std::string endpoint = "http://localhost:8080/v1";
+    std::string endpointModel;  // "model" sent to the endpoint
+    // Saved in plain text, readable by the owner only. Leave it empty to take
+    // SMARTFILE_API_KEY from the environment instead, which keeps it off disk.
+    std::string apiKey;
+    int maxInFlight = 4;        // Concurrent HTTP requests per batch
+
+    int folderFilesPerMinute = 0; // Analyze Folder pacing, e.g. to leave a shared server some room; 0 for no limit
+
+    void applyTo(llama_model_params& params) const;
+    void applyTo(llama_context_params& params) const; // Except n_ctx, see resolveContextSize()
+    std::string describe() const; // One line for the status bar
+    std::string resolveApiKey() const; // apiKey, or SMARTFILE_API_KEY when empty
+
+    // n_ctx to allocate: contextSize, or `workload` tokens rounded up, capped at what the model was trained for
+    int resolveContextSize(const llama_model* model, int workload) const;
+
+    // What loading with this profile will cost, computed from the model's
+    // hyperparameters before any context is allocated
+    struct MemoryEstimate {
+        uint64_t weights = 0; // Shared by all contexts
+        uint64_t kvCache = 0; // Per context
+        uint64_t compute = 0; // Per context, scratch buffers; rough
+        double offloaded = 0; // Share of the layers, and so of weights and KV, in GPU memory
+        int contextSize = 0;
+        uint64_t perContext() const { return kvCache + compute; }
+        uint64_t total(int contexts) const { return weights + perContext() * contexts; }
+        std::string describe(int contexts) const;
+    };
+    MemoryEstimate estimateMemory(const llama_model* model, int n_ctx) const;
+    // Contexts of `estimate` that fit next to the weights, at least 1: in GPU
+    // memory for the offloaded layers, in physical memory for the rest
+    int contextsThatFit(const MemoryEstimate& estimate) const;
+    static uint64_t physicalMemory(); // 0 if unknown
+    static uint64_t deviceMemory();   // Total of the GPU devices, 0 without one
+
+    nlohmann::json toJson() const;
+    static InferenceProfile fromJson(const nlohmann::json& j); // Missing keys keep their defaults
+
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+};
+
+#endif // INFERENCEPROFILE_H
@@ -0,0 +1,238 @@
+#include "InferenceTelemetry.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+void Histogram::add(double value)
+{
+    if (!std::isfinite(value)) return;
+    int bucket = 0;
+    if (value >= kLowest) {
+        bucket = 1 + int(std::floor(std::log10(value / kLowest) * kPerDecade));
+        bucket = std::min(bucket, kBuckets + 1);
+    }
+    buckets[bucket]++;
+    lo = n ? std::min(lo, value) : value;
+    hi = n ? std::max(hi, value) : value;
+    sum += value;
+    n++;
+}
+
+double Histogram::lowerBound(int bucket)
+{
+    return kLowest * std::pow(10.0, double(bucket - 1) / kPerDecade);
+}
+
+double Histogram::percentile(double p) const
+{
+    if (n == 0) return 0;
+    uint64_t rank = std::clamp<uint64_t>(uint64_t(std::ceil(p / 100.0 * n)), 1, n);
+    uint64_t seen = 0;
+    for (int b = 0; b < (int) buckets.size(); ++b) {
+        seen += buckets[b];
+        if (seen < rank) continue;
+        if (b == 0) return lo;
+        if (b == kBuckets + 1) return hi;
+        // Geometric middle of the bucket, within what was actually seen
+        return std::clamp(std::sqrt(lowerBound(b) * lowerBound(b + 1)), lo, hi);
+    }
+    return hi;
+}
+
+nlohmann::json Histogram::toJson() const
+{
+    nlohmann::json j;
+    j["count"] = n;
+    j["mean"] = mean();
+    j["min"] = min();
+    j["max"] = max();
+    j["p50"] = percentile(50);
+    j["p90"] = percentile(90);
+    j["p99"] = percentile(99);
+    // [lower bound, count]
+    nlohmann::json& list = j["buckets"] = nlohmann::json::array();
+    for (int b = 0; b < (int) buckets.size(); ++b) {
+        if (buckets[b]) list.push_back({b == 0 ? 0.0 : lowerBound(b), buckets[b]});
+    }
+    return j;
+}
+
+const char* InferenceTelemetry::metricName(Metric m)
+{
+    static const char* names[MetricCount] = {
+        "queue_ms", "parse_ms", "tokenize_ms", "prefill_ms", "decode_ms", "ttft_ms", "total_ms",
+        "prefill_tok_s", "decode_tok_s", "prompt_tokens", "generated_tokens"
+    };
+    return m >= 0 && m < MetricCount ? names[m] : "";
+}
+
+InferenceTelemetry::InferenceTelemetry(size_t keepSamples)
+    : keep(keepSamples)
+{
+}
+
+void InferenceTelemetry::record(InferenceSample sample)
+{
+    if (sample.time == 0) {
+        sample.time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    total++;
+    if (!sample.ok) failed++;
+
+    // Unknown values stay out; failed requests still tell how long they queued
+    auto add = [this](Metric m, double v) {
+        if (v >= 0) histograms[m].add(v);
+    };
+    add(QueueMs, sample.queueMs);
+    add(TokenizeMs, sample.tokenizeMs);
+    add(TotalMs, sample.totalMs);
+    if (sample.ok) {
+        add(PrefillMs, sample.prefillMs);
+        add(DecodeMs, sample.decodeMs);
+        add(TtftMs, sample.ttftMs);
+        add(PrefillRate, sample.prefillRate());
+        add(DecodeRate, sample.decodeRate());
+        add(PromptTokens, sample.promptTokens);
+        add(GeneratedTokens, sample.generatedTokens);
+    }
+
+    recent.push_back(std::move(sample));
+    while (recent.size() > keep) recent.pop_front();
+}
+
+void InferenceTelemetry::recordParse(double ms)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ms >= 0) histograms[ParseMs].add(ms);
+}
+
+void InferenceTelemetry::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    histograms = {};
+    recent.clear();
+    total = 0;
+    failed = 0;
+    tagRuns = {};
+}
+
+void InferenceTelemetry::recordTagRun(bool batched, size_t files, double ms)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    tagRuns[batched].files += files;
+    tagRuns[batched].ms += ms;
+}
+
+double InferenceTelemetry::filesPerMinute(bool batched) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const TagRuns& r = tagRuns[batched];
+    return r.ms > 0 ? r.files * 60000.0 / r.ms : 0;
+}
+
+Histogram InferenceTelemetry::histogram(Metric m) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return histograms[m];
+}
+
+std::vector<InferenceSample> InferenceTelemetry::samples() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::vector<InferenceSample>(recent.begin(), recent.end());
+}
+
+uint64_t InferenceTelemetry::requests() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return total;
+}
+
+uint64_t InferenceTelemetry::failures() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+nlohmann::json InferenceTelemetry::toJson() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    nlohmann::json j;
+    j["requests"] = total;
+    j["failures"] = failed;
+    for (int batched = 0; batched < 2; ++batched) {
+        const TagRuns& r = tagRuns[batched];
+        j[batched ? "batched_files_per_min" : "serial_files_per_min"] = r.ms > 0 ? r.files * 60000.0 / r.ms : 0;
+    }
+    nlohmann::json& h = j["histograms"] = nlohmann::json::object();
+    for (int m = 0; m < MetricCount; ++m) h[metricName(Metric(m))] = histograms[m].toJson();
+
+    nlohmann::json& list = j["samples"] = nlohmann::json::array();
+    for (const auto& s : recent) {
+        list.push_back({
+            {"time", s.time}, {"kind", s.kind}, {"ok", s.ok},
+            {"prompt_tokens", s.promptTokens}, {"reused_tokens", s.reusedTokens}, {"generated_tokens", s.generatedTokens},
+            {"queue_ms", s.queueMs}, {"tokenize_ms", s.tokenizeMs}, {"prefill_ms", s.prefillMs},
+            {"decode_ms", s.decodeMs}, {"ttft_ms", s.ttftMs}, {"total_ms", s.totalMs}
+        });
+    }
+    return j;
+}
+
+bool InferenceTelemetry::writeJson(const std::string& path, const nlohmann::json& extra) const
+{
+    nlohmann::json j = toJson();
+    for (auto it = extra.begin(); it != extra.end(); ++it) j[it.key()] = it.value();
+
+    std::ofstream f(path, std::ios::trunc);
+    if (!f) {
+        std::cerr << "Error writing telemetry to " << path << std::endl;
+        return false;
+    }
+    f << j.dump(2);
+    return bool(f);
+}
+
+bool InferenceTelemetry::writeCsv(const std::string& path) const
+{
+    std::ofstream f(path, std::ios::trunc);
+    if (!f) {
+        std::cerr << "Error writing telemetry to " << path << std::endl;
+        return false;
+    }
+    f << "time,kind,ok,prompt_tokens,reused_tokens,generated_tokens,queue_ms,tokenize_ms,"
+         "prefill_ms,decode_ms,ttft_ms,total_ms,prefill_tok_s,decode_tok_s\n";
+    for (const auto& s : samples()) {
+        f << s.time << ',' << s.kind << ',' << (s.ok ? 1 : 0) << ',' << s.promptTokens << ',' << s.reusedTokens << ','
+          << s.generatedTokens << ',' << s.queueMs << ',' << s.tokenizeMs << ',' << s.prefillMs << ',' << s.decodeMs
+          << ',' << s.ttftMs << ',' << s.totalMs << ',' << s.prefillRate() << ',' << s.decodeRate() << '\n';
+    }
+    return bool(f);
+}
+
+std::string InferenceTelemetry::summary() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+    out << std::fixed;
+    out.precision(1);
+    out << total << " requests";
+    if (failed) out << " (" << failed << " failed)";
+    if (total == 0) return out.str();
+    out << ", median queue " << histograms[QueueMs].percentile(50) << " ms"
+        << ", TTFT " << histograms[TtftMs].percentile(50) << " ms"
+        << ", prefill " << histograms[PrefillRate].percentile(50) << " tok/s"
+        << ", decode " << histograms[DecodeRate].percentile(50) << " tok/s";
+    // The batched loop against one file per call, per context held
+    for (int batched = 1; batched >= 0; --batched) {
+        const TagRuns& r = tagRuns[batched];
+        if (r.ms > 0) out << ", " << (batched ? "batched " : "serial ") << r.files * 60000.0 / r.ms << " files/min";
+    }
+    return out.str();
+}
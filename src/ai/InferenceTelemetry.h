@@ -0,0 +1,107 @@
+#ifndef INFERENCETELEMETRY_H
+#define INFERENCETELEMETRY_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <mutex>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+// What one generation cost, stage by stage. Times in milliseconds, -1 when unknown.
+struct InferenceSample
+{
+    std::string kind;        // "tags", "tags-batch", "summary", "image", "generate"
+    int64_t time = 0;        // Finished at, ms since the epoch
+    int promptTokens = 0;    // Evaluated by prefill
+    int reusedTokens = 0;    // Copied from the cached prompt prefix instead
+    int generatedTokens = 0;
+    double queueMs = -1;     // Waiting for a context, or in a batch for a free sequence
+    double tokenizeMs = -1;  // Building the prompt: packing, condensing, tokenizing, encoding images
+    double prefillMs = -1;
+    double decodeMs = -1;
+    double ttftMs = -1;      // Request start to the first generated token
+    double totalMs = -1;
+    bool ok = true;          // False for errors and cancellations
+
+    double prefillRate() const { return prefillMs > 0 ? promptTokens * 1000.0 / prefillMs : -1; }
+    double decodeRate() const { return decodeMs > 0 && generatedTokens > 0 ? generatedTokens * 1000.0 / decodeMs : -1; }
+};
+
+// Log-spaced buckets, 16 per decade (~15% wide) from 0.01 to 1e7, so the same
+// histogram fits milliseconds, tokens and tokens/s. Percentiles are read from
+// the buckets and are exact to about that width.
+class Histogram
+{
+public:
+    void add(double value);
+    uint64_t count() const { return n; }
+    double mean() const { return n ? sum / n : 0; }
+    double min() const { return n ? lo : 0; }
+    double max() const { return n ? hi : 0; }
+    double percentile(double p) const; // p in 0..100
+
+    nlohmann::json toJson() const; // Summary plus the non-empty buckets
+
+    static constexpr double kLowest = 0.01;
+    static constexpr int kPerDecade = 16;
+    static constexpr int kBuckets = 9 * kPerDecade;
+
+private:
+    std::array<uint64_t, kBuckets + 2> buckets{}; // Below kLowest, kBuckets, above the top
+    uint64_t n = 0;
+    double sum = 0;
+    double lo = 0;
+    double hi = 0;
+
+    static double lowerBound(int bucket); // Of buckets[bucket], bucket >= 1
+};
+
+// Aggregates InferenceSamples into one histogram per metric and keeps the most
+// recent samples for export. Thread-safe; recording is cheap enough for every request.
+class InferenceTelemetry
+{
+public:
+    enum Metric {
+        QueueMs, ParseMs, TokenizeMs, PrefillMs, DecodeMs, TtftMs, TotalMs,
+        PrefillRate, DecodeRate, PromptTokens, GeneratedTokens, MetricCount
+    };
+    static const char* metricName(Metric m); // e.g. "prefill_tok_s"
+
+    explicit InferenceTelemetry(size_t keepSamples = 5000);
+
+    void record(InferenceSample sample);
+    // Text extraction happens before the backend sees the file, so it is reported separately
+    void recordParse(double ms);
+    // Tag generation throughput: `files` tagged in `ms` of holding a context,
+    // one file per call (serial) or a whole batch per call
+    void recordTagRun(bool batched, size_t files, double ms);
+    double filesPerMinute(bool batched) const; // 0 until measured
+    void reset();
+
+    Histogram histogram(Metric m) const;
+    std::vector<InferenceSample> samples() const; // Oldest first
+    uint64_t requests() const;
+    uint64_t failures() const;
+
+    nlohmann::json toJson() const;
+    bool writeJson(const std::string& path, const nlohmann::json& extra = nlohmann::json::object()) const;
+    bool writeCsv(const std::string& path) const; // One row per kept sample
+    std::string summary() const; // One line: medians of the main metrics
+
+private:
+    mutable std::mutex mutex;
+    size_t keep;
+    std::array<Histogram, MetricCount> histograms;
+    std::deque<InferenceSample> recent;
+    uint64_t total = 0;
+    uint64_t failed = 0;
+    struct TagRuns {
+        uint64_t files = 0;
+        double ms = 0;
+    };
+    std::array<TagRuns, 2> tagRuns; // Serial, batched
+};
+
+#endif // INFERENCETELEMETRY_H
@@ -0,0 +1,148 @@
+#include "LlamaContextPool.h"
+#include <iostream>
+
+LlamaContextPool::Lease::Lease(Lease&& other) noexcept
+    : pool(other.pool), session(other.session)
+{
+    other.pool = nullptr;
+    other.session = nullptr;
+}
+
+LlamaContextPool::Lease& LlamaContextPool::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other) {
+        if (session) pool->release(session);
+        pool = other.pool;
+        session = other.session;
+        other.pool = nullptr;
+        other.session = nullptr;
+    }
+    return *this;
+}
+
+LlamaContextPool::Lease::~Lease()
+{
+    if (session) pool->release(session);
+}
+
+LlamaContextPool::~LlamaContextPool()
+{
+    destroy();
+}
+
+bool LlamaContextPool::create(llama_model* model, const llama_context_params& params, int count)
+{
+    destroy();
+
+    std::vector<std::unique_ptr<Session>> created;
+    for (int i = 0; i < count; ++i) {
+        auto session = std::make_unique<Session>();
+        session->ctx = llama_init_from_model(model, params);
+        if (!session->ctx) {
+            std::cerr << "Failed to create context " << i + 1 << " of " << count << std::endl;
+            for (auto& s : created) {
+                llama_batch_free(s->batch);
+                llama_free(s->ctx);
+            }
+            return false;
+        }
+        session->batch = llama_batch_init(llama_n_batch(session->ctx), 0, 1);
+        created.push_back(std::move(session));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    sessions = std::move(created);
+    for (auto& s : sessions) idle.push_back(s.get());
+    return true;
+}
+
+void LlamaContextPool::destroy()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (idle.size() != sessions.size()) {
+        std::cerr << "Context pool destroyed with " << sessions.size() - idle.size() << " contexts in use" << std::endl;
+    }
+    for (auto& s : sessions) {
+        if (s->batch.token) llama_batch_free(s->batch);
+        llama_free(s->ctx);
+    }
+    sessions.clear();
+    idle.clear();
+}
+
+void LlamaContextPool::adopt(LlamaContextPool& other)
+{
+    if (&other == this) return;
+    destroy();
+    {
+        std::scoped_lock lock(mutex, other.mutex);
+        sessions = std::move(other.sessions);
+        idle = std::move(other.idle);
+        other.sessions.clear();
+        other.idle.clear();
+    }
+    released.notify_all();
+}
+
+LlamaContextPool::Lease LlamaContextPool::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [this] { return sessions.empty() || !idle.empty(); });
+    if (idle.empty()) return Lease();
+    Session* s = idle.back();
+    idle.pop_back();
+    return Lease(this, s);
+}
+
+LlamaContextPool::Lease LlamaContextPool::acquire(const std::function<bool()>& stop)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!sessions.empty() && idle.empty()) {
+        if (stop && stop()) return Lease();
+        released.wait_for(lock, std::chrono::milliseconds(20));
+    }
+    if (idle.empty()) return Lease();
+    Session* s = idle.back();
+    idle.pop_back();
+    return Lease(this, s);
+}
+
+LlamaContextPool::Lease LlamaContextPool::tryAcquire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (idle.empty()) return Lease();
+    Session* s = idle.back();
+    idle.pop_back();
+    return Lease(this, s);
+}
+
+std::vector<LlamaContextPool::Lease> LlamaContextPool::acquireAll()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [this] { return idle.size() == sessions.size(); });
+    std::vector<Lease> leases;
+    for (Session* s : idle) leases.push_back(Lease(this, s));
+    idle.clear();
+    return leases;
+}
+
+int LlamaContextPool::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int) sessions.size();
+}
+
+int LlamaContextPool::available() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int) idle.size();
+}
+
+void LlamaContextPool::release(Session* session)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(session);
+    }
+    released.notify_all(); // acquireAll() may be waiting next to single acquires
+}
@@ -0,0 +1,79 @@
+#ifndef LLAMACONTEXTPOOL_H
+#define LLAMACONTEXTPOOL_H
+
+#include "llama.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Several llama_contexts over one llama_model: the weights are loaded once,
+// each context has its own KV cache. A worker checks a context out with
+// acquire() and gets it back into the pool when the Lease goes away.
+class LlamaContextPool
+{
+public:
+    // A context plus the per-context state that has to travel with it
+    struct Session {
+        llama_context* ctx = nullptr;
+        llama_batch batch = {};                // n_batch tokens, reused by every decode
+        std::vector<llama_token> prefixTokens; // Cached prompt prefix held in its KV cache
+    };
+
+    class Lease
+    {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease();
+
+        explicit operator bool() const { return session != nullptr; }
+        Session* operator->() const { return session; }
+        Session& operator*() const { return *session; }
+
+    private:
+        friend class LlamaContextPool;
+        Lease(LlamaContextPool* p, Session* s) : pool(p), session(s) {}
+        LlamaContextPool* pool = nullptr;
+        Session* session = nullptr;
+    };
+
+    LlamaContextPool() = default;
+    ~LlamaContextPool();
+    LlamaContextPool(const LlamaContextPool&) = delete;
+    LlamaContextPool& operator=(const LlamaContextPool&) = delete;
+
+    // Creates `count` contexts; all or nothing
+    bool create(llama_model* model, const llama_context_params& params, int count);
+    // Frees every context; no leases may be outstanding
+    void destroy();
+    // Frees this pool's contexts and takes over those of `other`, which ends up
+    // empty. Lets a new pool be built next to a working one. No leases on either.
+    void adopt(LlamaContextPool& other);
+
+    // Blocks until a context is free; an empty Lease if the pool is empty
+    Lease acquire();
+    // Same, but gives up with an empty Lease once `stop` returns true (polled)
+    Lease acquire(const std::function<bool()>& stop);
+    Lease tryAcquire();
+    // Every context at once, once all are free. Taken in one step, so two
+    // callers cannot each hold part of the pool and wait for the rest.
+    std::vector<Lease> acquireAll();
+
+    int size() const;
+    int available() const;
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable released;
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::vector<Session*> idle;
+
+    void release(Session* session);
+};
+
+#endif // LLAMACONTEXTPOOL_H
@@ -1,21 +1,124 @@
 #include "LlamaEngine.h"
+#include "PromptBuilder.h"
+#include "../core/FileIdentity.h"
 #include <iostream>
 #include <vector>
 #include <cstring>
 #include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <thread>
 
-// Helper to add token to batch
-static void batch_add(llama_batch & batch, llama_token id, llama_pos pos, const std::vector<llama_seq_id> & seq_ids, bool logits) {
+#ifdef SMARTFILE_MULTIMODAL
+#include "mtmd.h"
+#include "mtmd-helper.h"
+#endif
+
+// Helper to add token to batch (single sequence, no allocation)
+static void batch_add(llama_batch & batch, llama_token id, llama_pos pos, llama_seq_id seq_id, bool logits) {
     batch.token   [batch.n_tokens] = id;
     batch.pos     [batch.n_tokens] = pos;
-    batch.n_seq_id[batch.n_tokens] = seq_ids.size();
-    for (size_t i = 0; i < seq_ids.size(); ++i) {
-        batch.seq_id[batch.n_tokens][i] = seq_ids[i];
-    }
+    batch.n_seq_id[batch.n_tokens] = 1;
+    batch.seq_id  [batch.n_tokens][0] = seq_id;
     batch.logits  [batch.n_tokens] = logits;
     batch.n_tokens++;
 }
 
+// Shared by every tag prompt, so its KV cells can be computed once
+static const std::string kTagSystemPrompt = "<|im_start|>system\n" + InferenceBackend::tagInstructions() + "<|im_end|>\n";
+
+// The user turn of a tag prompt around the filename and the content. Cache
+// keys hash this text itself, so any edit here drops the cached tags.
+static const char* kTagUserBefore = "<|im_start|>user\nFilename: ";
+static const char* kTagUserContent = "\nContent Preview: ";
+static const char* kTagUserAfter = "\n<|im_end|>\n<|im_start|>assistant\n";
+static const char* kTagNoContent = "(No content)";
+
+// 3-5 tags, comma separated, nothing else. EOG is only allowed once the
+// list is complete and forced after the fifth tag, so decoding stops right there.
+static const char* kTagGrammar =
+    "root ::= tag (\",\" \" \"? tag){2,4}\n"
+    "tag  ::= [^,，、\\n ] [^,，、\\n]{0,23}\n"; // No full-width separators inside a tag either
+
+// One part of a long document; its tokens go between the two halves
+static const char* kSummaryPromptBefore =
+    "<|im_start|>system\n"
+    "You summarize one part of a longer document so that the whole document can be tagged later.\n"
+    "Write 2-4 sentences on its topics, names, dates and purpose, in the document's own language. No preamble.\n"
+    "<|im_end|>\n"
+    "<|im_start|>user\n";
+static const char* kSummaryPromptAfter =
+    "\n"
+    "<|im_end|>\n"
+    "<|im_start|>assistant\n";
+// Bump whenever the summary prompt changes; drops cached summaries
+static constexpr int kSummaryRevision = 2;
+
+// Decodes tokens[start..] in chunks of the batch's capacity; logits for the last token only if asked.
+// Fails early if `stop` says so between chunks.
+static bool decodeChunks(llama_context* ctx, llama_batch& batch, const std::vector<llama_token>& tokens,
+                         size_t start, llama_seq_id seq, bool logits, const std::function<bool()>& stop = {}) {
+    const size_t n_batch = llama_n_batch(ctx);
+    for (size_t i = start; i < tokens.size(); i += n_batch) {
+        if (stop && stop()) return false;
+        const size_t end = std::min(tokens.size(), i + n_batch);
+        batch.n_tokens = 0;
+        for (size_t j = i; j < end; ++j) {
+            batch_add(batch, tokens[j], j, seq, logits && j + 1 == tokens.size());
+        }
+        if (llama_decode(ctx, batch) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string tokenPiece(const llama_vocab* vocab, llama_token id) {
+    char buf[256];
+    int n = llama_token_to_piece(vocab, id, buf, sizeof(buf), 0, true);
+    return n >= 0 ? std::string(buf, n) : std::string();
+}
+
+// Pieces can end inside a multi-byte character; onToken only gets whole
+// characters and the rest waits in `pending` for the next piece
+static void streamPiece(const InferenceOptions& options, std::string& pending, const std::string& piece)
+{
+    if (!options.onToken) return;
+    pending += piece;
+    size_t end = pending.size();
+    for (size_t back = 1; back <= std::min<size_t>(4, pending.size()); ++back) {
+        unsigned char c = pending[pending.size() - back];
+        if ((c & 0xC0) == 0x80) continue; // Continuation byte
+        size_t len = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+        if (len > back) end = pending.size() - back;
+        break;
+    }
+    if (end == 0) return;
+    options.onToken(pending.substr(0, end));
+    pending.erase(0, end);
+}
+
+static double msBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static double msSince(std::chrono::steady_clock::time_point from) {
+    return msBetween(from, std::chrono::steady_clock::now());
+}
+
+LlamaEngine::Trace::Trace(const char* kind)
+    : start(std::chrono::steady_clock::now())
+{
+    sample.kind = kind;
+}
+
+void LlamaEngine::finishSample(InferenceSample& sample, const Trace& trace)
+{
+    sample.totalMs = msSince(trace.start);
+    if (telemetry) telemetry->record(sample);
+}
+
 LlamaEngine::LlamaEngine()
 {
     llama_backend_init();
@@ -23,138 +126,1622 @@ LlamaEngine::LlamaEngine()
 
 LlamaEngine::~LlamaEngine()
 {
-    if (ctx) llama_free(ctx);
+    unloadDraftModel();
+    unloadProjector();
+    freeEmbedContext();
+    if (embedModel) llama_model_free(embedModel);
+    contexts.destroy();
     if (model) llama_model_free(model);
     llama_backend_free();
 }
 
-bool LlamaEngine::loadModel(const std::string& modelPath)
+bool LlamaEngine::loadModel(const std::string& modelPath, const std::function<bool(float)>& progress)
 {
-    if (model) {
-        llama_model_free(model);
-        model = nullptr;
-    }
-    if (ctx) {
-        llama_free(ctx);
-        ctx = nullptr;
-    }
-
+    // The old model keeps working until the new one has its weights and
+    // contexts, so a failed or cancelled load leaves the engine as it was
     llama_model_params model_params = llama_model_default_params();
-    model_params.n_gpu_layers = 100; // Try to use GPU
-    model = llama_model_load_from_file(modelPath.c_str(), model_params);
+    profile.applyTo(model_params);
+    if (progress) {
+        model_params.progress_callback = [](float p, void* user) {
+            return (*static_cast<const std::function<bool(float)>*>(user))(p);
+        };
+        model_params.progress_callback_user_data = const_cast<std::function<bool(float)>*>(&progress);
+    }
+    llama_model* loaded = llama_model_load_from_file(modelPath.c_str(), model_params);
 
-    if (!model) {
+    if (!loaded) {
         std::cerr << "Failed to load model from " << modelPath << std::endl;
         return false;
     }
 
+    int prefixTokens = (int) PromptBuilder::tokenize(llama_model_get_vocab(loaded), kTagSystemPrompt).size();
+
     llama_context_params ctx_params = llama_context_default_params();
-    ctx_params.n_ctx = 8192; // Increase context for Llama-3
-    ctx = llama_init_from_model(model, ctx_params);
+    profile.applyTo(ctx_params);
+    ctx_params.n_ctx = profile.resolveContextSize(loaded, contextWorkload(prefixTokens));
+    ctx_params.n_seq_max = kParallelSequences + 1; // generateBatch sequences + cached prefix
+    ctx_params.kv_unified = true; // Sequences share all of n_ctx instead of n_ctx / n_seq_max each
+    ctx_params.no_perf = false;   // Prefill/decode timings for telemetry; one clock read per decode
 
-    if (!ctx) {
+    LoadReport report;
+    report.estimate = profile.estimateMemory(loaded, ctx_params.n_ctx);
+    report.contexts = profile.contextsThatFit(report.estimate);
+    int n_contexts = report.contexts;
+
+    // Each context has its own KV cache, the weights are shared. Built next to
+    // the old pool, which stays usable if this fails.
+    LlamaContextPool staged;
+    bool created = staged.create(loaded, ctx_params, n_contexts);
+    if (!created && ctx_params.type_v != GGML_TYPE_F16) {
+        // Flash attention turned out unavailable, which quantized V requires
+        report.f16Fallback = true;
+        ctx_params.type_v = GGML_TYPE_F16;
+        created = staged.create(loaded, ctx_params, n_contexts);
+    }
+    if (!created) {
         std::cerr << "Failed to create context" << std::endl;
+        llama_model_free(loaded);
         return false;
     }
 
+    std::string fingerprint = FileIdentity::fingerprintFile(modelPath);
+
+    // The new model is complete; only now does the old one go
+    unloadDraftModel(); // Must match the new model's vocabulary
+    {
+        // Reloaded for the new model below
+        std::lock_guard<std::mutex> lock(visionMutex);
+        freeProjector();
+    }
+    {
+        // The embed context may have been created from the old chat model; held
+        // until the swap so it cannot be recreated from the model being freed
+        std::lock_guard<std::mutex> lock(embedMutex);
+        if (!embedModel) freeEmbedContext();
+        contexts.adopt(staged);
+        if (model) llama_model_free(model);
+        model = loaded;
+        nPrefix = prefixTokens;
+        this->modelPath = modelPath;
+        modelFingerprint = fingerprint;
+        loadReport = report;
+    }
+    {
+        auto lease = contexts.acquire();
+        nCtx = llama_n_ctx(lease->ctx);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(visionMutex);
+        if (!projectorPath.empty() && !initProjector()) projectorPath.clear(); // Probably made for another model
+    }
     return true;
 }
 
-std::string LlamaEngine::generateResponse(const std::string& prompt)
+bool LlamaEngine::warmUp()
 {
-    if (!ctx || !model) return "Error: Model not loaded";
+    if (!model) return false;
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    llama_token bos = llama_vocab_bos(vocab);
+    llama_token eos = llama_vocab_eos(vocab);
 
-    // Clear KV cache
-    llama_memory_t mem = llama_get_memory(ctx);
-    llama_memory_seq_rm(mem, -1, -1, -1);
+    bool ok = true;
+    for (auto& lease : contexts.acquireAll()) {
+        llama_batch& batch = lease->batch;
+        batch.n_tokens = 0;
+        if (bos != LLAMA_TOKEN_NULL) batch_add(batch, bos, batch.n_tokens, 0, false);
+        if (eos != LLAMA_TOKEN_NULL) batch_add(batch, eos, batch.n_tokens, 0, true);
+        if (batch.n_tokens == 0) batch_add(batch, 0, 0, 0, true);
 
-    const llama_vocab* vocab = llama_model_get_vocab(model);
+        ok = llama_decode(lease->ctx, batch) == 0 && ok;
+        llama_synchronize(lease->ctx);
+        llama_memory_seq_rm(llama_get_memory(lease->ctx), 0, -1, -1);
+        llama_perf_context_reset(lease->ctx);
+    }
+    return ok;
+}
 
-    // 1. Tokenize - Enable Special Tokens Parsing (true as last arg)
-    const int n_prompt = -llama_tokenize(vocab, prompt.c_str(), prompt.length(), NULL, 0, true, true);
-    std::vector<llama_token> prompt_tokens(n_prompt);
-    if (llama_tokenize(vocab, prompt.c_str(), prompt.length(), prompt_tokens.data(), n_prompt, true, true) < 0) {
-        return "Error: Tokenization failed";
+InferenceProfile::MemoryEstimate LlamaEngine::estimateMemory(const InferenceProfile& p) const
+{
+    if (!model) return InferenceProfile::MemoryEstimate();
+    return p.estimateMemory(model, p.resolveContextSize(model, contextWorkload(nPrefix)));
+}
+
+int LlamaEngine::contextWorkload(int prefixTokens) const
+{
+    // Every batch sequence holds a tag prompt past the shared prefix plus its answer
+    return kParallelSequences * (prefillBudget - prefixTokens + kPredictTokens) + prefixTokens;
+}
+
+int LlamaEngine::promptBudget() const
+{
+    // When the context came out smaller than contextWorkload() (set by hand, or
+    // capped at what the model was trained for), prompts shrink so that
+    // kParallelSequences of them still run side by side. Tiny contexts take one at a time.
+    int perSlot = (nCtx - nPrefix) / kParallelSequences + nPrefix - kPredictTokens;
+    if (perSlot < kMinSlotBudget) perSlot = nCtx - kPredictTokens;
+    return std::min(prefillBudget, perSlot);
+}
+
+LlamaEngine::DecodeStats LlamaEngine::getDecodeStats() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
+
+void LlamaEngine::resetDecodeStats()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats = DecodeStats();
+}
+
+void LlamaEngine::addStats(const DecodeStats& run)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats.tokens += run.tokens;
+    stats.seconds += run.seconds;
+    stats.drafted += run.drafted;
+    stats.accepted += run.accepted;
+}
+
+// Auto-tune workload: one tag-sized prompt, then a short answer
+static constexpr int kTunePromptTokens = 512;
+static constexpr int kTuneGenTokens = 32;
+static constexpr int kTuneRuns = 3;           // Measured runs per setting, after one warm-up
+static constexpr double kTuneMaxSpread = 0.15; // (max - min) / median above this is not stable
+
+// Median tokens/s of the runs, or 0 if they spread too much to be trusted
+static double stableRate(std::vector<double> rates)
+{
+    if (rates.empty()) return 0;
+    std::sort(rates.begin(), rates.end());
+    double median = rates[rates.size() / 2];
+    if (median <= 0 || (rates.back() - rates.front()) / median > kTuneMaxSpread) return 0;
+    return median;
+}
+
+InferenceProfile LlamaEngine::autoTune(const std::function<void(const std::string&)>& progress)
+{
+    InferenceProfile tuned = profile;
+    if (!model) return tuned;
+    auto report = [&progress](const std::string& line) {
+        if (progress) progress(line);
+    };
+
+    const int hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int quarter = 1; quarter <= 4; ++quarter) {
+        int n = std::max(1, hw * quarter / 4);
+        if (std::find(threadCounts.begin(), threadCounts.end(), n) == threadCounts.end()) threadCounts.push_back(n);
     }
+    const std::vector<int> ubatchSizes = {64, 128, 256, 512};
+
+    // Fixed pseudo-random tokens; only their count matters for speed
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    std::vector<llama_token> prompt(kTunePromptTokens);
+    for (int i = 0; i < kTunePromptTokens; ++i) prompt[i] = (i * 7919 + 1000) % n_vocab;
+
+    double bestPrompt = 0, bestGen = 0;
+    for (size_t u = 0; u < ubatchSizes.size(); ++u) {
+        llama_context_params params = llama_context_default_params();
+        profile.applyTo(params);
+        params.n_ctx = kTunePromptTokens + kTuneGenTokens;
+        params.n_batch = kTunePromptTokens;
+        params.n_ubatch = ubatchSizes[u];
+        params.n_seq_max = 1;
+        llama_context* tctx = llama_init_from_model(model, params);
+        if (!tctx) {
+            report("ubatch " + std::to_string(ubatchSizes[u]) + ": context failed");
+            continue;
+        }
+        llama_batch tbatch = llama_batch_init(kTunePromptTokens, 0, 1);
+        // Generation speed does not depend on the ubatch, measure it once
+        const bool measureGen = (u == 0);
 
-    // 2. Initial Batch
-    llama_batch batch = llama_batch_init(8192, 0, 1); // Match n_ctx
-    for(int i=0; i<n_prompt; i++) {
-        batch_add(batch, prompt_tokens[i], i, {0}, false);
+        for (size_t t = 0; t < threadCounts.size(); ++t) {
+            const int threads = threadCounts[t];
+            llama_set_n_threads(tctx, threads, threads);
+            std::vector<double> promptRates, genRates;
+            bool failed = false;
+            // Every thread count gets its own warm-up: a new thread pool starts cold
+            for (int run = -1; run < kTuneRuns && !failed; ++run) {
+                llama_memory_clear(llama_get_memory(tctx), true);
+                auto t0 = std::chrono::steady_clock::now();
+                failed = !decodeChunks(tctx, tbatch, prompt, 0, 0, true);
+                auto t1 = std::chrono::steady_clock::now();
+                for (int i = 0; measureGen && !failed && i < kTuneGenTokens; ++i) {
+                    tbatch.n_tokens = 0;
+                    batch_add(tbatch, prompt[i], kTunePromptTokens + i, 0, true);
+                    failed = llama_decode(tctx, tbatch) != 0;
+                }
+                auto t2 = std::chrono::steady_clock::now();
+                if (run < 0) continue; // Warm-up: page in weights, spin up threads
+
+                promptRates.push_back(kTunePromptTokens / std::chrono::duration<double>(t1 - t0).count());
+                if (measureGen) genRates.push_back(kTuneGenTokens / std::chrono::duration<double>(t2 - t1).count());
+            }
+            if (failed) {
+                report("threads " + std::to_string(threads) + ": decode failed");
+                continue;
+            }
+
+            double pp = stableRate(promptRates);
+            std::ostringstream line;
+            line << "threads " << threads << ", ubatch " << ubatchSizes[u] << ": prompt "
+                 << (pp > 0 ? std::to_string(int(pp)) + " tok/s" : std::string("unstable"));
+            if (pp > bestPrompt) {
+                bestPrompt = pp;
+                tuned.batchThreads = threads;
+                tuned.ubatchSize = ubatchSizes[u];
+                tuned.batchSize = std::max(profile.batchSize, ubatchSizes[u]);
+            }
+            if (measureGen) {
+                double tg = stableRate(genRates);
+                line << ", generation " << (tg > 0 ? std::to_string(int(tg)) + " tok/s" : std::string("unstable"));
+                if (tg > bestGen) {
+                    bestGen = tg;
+                    tuned.threads = threads;
+                }
+            }
+            report(line.str());
+        }
+        llama_batch_free(tbatch);
+        llama_free(tctx);
     }
-    batch.logits[batch.n_tokens - 1] = true;
 
-    // 3. Decode
-    if (llama_decode(ctx, batch) != 0) {
-         llama_batch_free(batch);
-        return "Error: llama_decode failed";
+    report("chosen: " + tuned.describe());
+    return tuned;
+}
+
+std::string LlamaEngine::generateResponse(const std::string& prompt, const RequestOptions& options)
+{
+    if (!model) return "Error: Model not loaded";
+
+    // 1. Tokenize - Enable Special Tokens Parsing
+    std::vector<llama_token> prompt_tokens = PromptBuilder::tokenize(llama_model_get_vocab(model), prompt);
+    if (prompt_tokens.empty()) {
+        return "Error: Tokenization failed";
     }
-    
-    int n_curr = batch.n_tokens; 
-    llama_batch_free(batch); 
+    return generateResponse(prompt_tokens, "", options);
+}
 
-    // 4. Sample loop
-    std::stringstream response_ss;
-    int n_predict = 256; // Allow a bit more output
-    
+llama_sampler* LlamaEngine::makeSampler(const std::string& grammar) const
+{
     auto sparams = llama_sampler_chain_default_params();
     struct llama_sampler * smpl = llama_sampler_chain_init(sparams);
+    if (!grammar.empty()) {
+        llama_sampler* constrained = llama_sampler_init_grammar(llama_model_get_vocab(model), grammar.c_str(), "root");
+        if (constrained) {
+            llama_sampler_chain_add(smpl, constrained);
+        } else {
+            std::cerr << "Failed to parse grammar, sampling unconstrained" << std::endl;
+        }
+    }
     llama_sampler_chain_add(smpl, llama_sampler_init_greedy()); // Greedy is fine for tagging
+    return smpl;
+}
+
+std::string LlamaEngine::generateResponse(const std::vector<llama_token>& prompt_tokens, const std::string& grammar,
+                                          const RequestOptions& options)
+{
+    if (!model) return "Error: Model not loaded";
+    Trace trace("generate");
+    LlamaContextPool::Lease lease = contexts.acquire([&options] { return options.stopped(); });
+    if (!lease) return options.stopped() ? options.stopReason() : "Error: Model not loaded";
+    trace.sample.queueMs = msSince(trace.start);
+    return generateOn(*lease, prompt_tokens, grammar, options, trace);
+}
+
+std::string LlamaEngine::generateOn(Session& s, const std::vector<llama_token>& prompt_tokens, const std::string& grammar,
+                                    const RequestOptions& options, const Trace& trace)
+{
+    if (prompt_tokens.empty()) return "Error: Empty prompt";
+    llama_context* ctx = s.ctx;
+    llama_batch& batch = s.batch;
+
+    // Clear KV cache, except for the cached prefix
+    clearSequences(s);
+    llama_memory_t mem = llama_get_memory(ctx);
+
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+
+    // Reuse the cached prefix, only the rest of the prompt needs a prefill
+    const int n_reuse = reusablePrefix(s, prompt_tokens);
+
+    // Leave room for the answer. The prefix occupies its cells either way; a
+    // prompt that does not start with it needs cells for all of its tokens.
+    const int n_prompt = prompt_tokens.size();
+    const int n_free = llama_n_ctx(ctx) - (int) s.prefixTokens.size();
+    if (n_prompt - n_reuse >= n_free) {
+        return "Error: Prompt exceeds context size";
+    }
+    const int n_predict = std::min(kPredictTokens, n_free - (n_prompt - n_reuse));
+    if (n_reuse > 0) {
+        llama_memory_seq_cp(mem, kPrefixSeq, 0, -1, -1);
+    }
+
+    InferenceSample sample = trace.sample;
+    sample.promptTokens = n_prompt - n_reuse;
+    sample.reusedTokens = n_reuse;
+    llama_perf_context_reset(ctx);
+    auto t_prefill = std::chrono::steady_clock::now();
+
+    // 2. Prefill in n_batch chunks, logits for the last prompt token only
+    if (!prefill(s, prompt_tokens, n_reuse, 0, true, options)) {
+        sample.ok = false;
+        finishSample(sample, trace);
+        return options.stopped() ? options.stopReason() : "Error: llama_decode failed";
+    }
+
+    // 3. Sample loop
+    struct llama_sampler * smpl = makeSampler(grammar);
+    DecodeStats run;
+
+    std::unique_lock<std::mutex> draftLock(draftMutex, std::try_to_lock);
+    if (draftLock.owns_lock() && draftCtx && draftLength > 0) {
+        // Verification batches count as prompt evaluation in the perf counters, so wall clock here
+        auto t_decode = std::chrono::steady_clock::now();
+        sample.prefillMs = msBetween(t_prefill, t_decode);
+        sample.ttftMs = msSince(trace.start); // The first token is sampled right away
+        std::string response = speculate(s, prompt_tokens, n_predict, smpl, run, options);
+        llama_sampler_free(smpl);
+        addStats(run);
+        sample.decodeMs = msSince(t_decode);
+        sample.generatedTokens = run.tokens;
+        sample.ok = response.rfind("Error:", 0) != 0;
+        finishSample(sample, trace);
+        return response;
+    }
+    if (draftLock.owns_lock()) draftLock.unlock();
 
+    auto t_start = std::chrono::steady_clock::now();
+    std::stringstream response_ss;
+    std::string streamed; // Bytes of a split character, not shown yet
+    int n_curr = n_prompt;
     llama_token new_token_id = 0;
 
+    bool stopped = false;
     for (int i = 0; i < n_predict; ++i) {
+        if (options.stopped()) {
+            stopped = true;
+            break;
+        }
         new_token_id = llama_sampler_sample(smpl, ctx, -1);
+        if (i == 0) sample.ttftMs = msSince(trace.start);
 
         if (llama_vocab_is_eog(vocab, new_token_id)) {
             break;
         }
 
-        char buf[256];
-        int n = llama_token_to_piece(vocab, new_token_id, buf, sizeof(buf), 0, true);
-        if (n >= 0) {
-            std::string piece(buf, n);
-            response_ss << piece;
-        }
+        std::string piece = tokenPiece(vocab, new_token_id);
+        response_ss << piece;
+        streamPiece(options, streamed, piece);
+        run.tokens++;
 
-        llama_batch batch_one = llama_batch_init(1, 0, 1);
-        batch_add(batch_one, new_token_id, n_curr, {0}, true);
+        batch.n_tokens = 0;
+        batch_add(batch, new_token_id, n_curr, 0, true);
         n_curr++;
 
-        if (llama_decode(ctx, batch_one) != 0) {
-            llama_batch_free(batch_one);
+        if (llama_decode(ctx, batch) != 0) {
             break;
         }
-        llama_batch_free(batch_one);
     }
-    
+
     llama_sampler_free(smpl);
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    addStats(run);
+
+    // Compute time as llama.cpp measured it: multi-token decodes are prefill, single-token ones decode
+    llama_perf_context_data perf = llama_perf_context(ctx);
+    bool measured = perf.n_p_eval > 0 && perf.t_p_eval_ms > 0;
+    sample.prefillMs = measured ? perf.t_p_eval_ms : msBetween(t_prefill, t_start);
+    sample.decodeMs = measured ? perf.t_eval_ms : run.seconds * 1000;
+    sample.generatedTokens = run.tokens;
+    sample.ok = !stopped;
+    finishSample(sample, trace);
+
+    return stopped ? options.stopReason() : response_ss.str();
+}
+
+std::string LlamaEngine::speculate(Session& s, const std::vector<llama_token>& prompt_tokens, int n_predict,
+                                   llama_sampler* smpl, DecodeStats& run, const RequestOptions& options)
+{
+    llama_context* ctx = s.ctx;
+    llama_batch& batch = s.batch;
+    auto t_start = std::chrono::steady_clock::now();
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    llama_memory_t mem = llama_get_memory(ctx);
+    llama_memory_t draftMem = llama_get_memory(draftCtx);
+
+    const int n_ctx = std::min(llama_n_ctx(ctx), llama_n_ctx(draftCtx));
+    const int max_draft = std::min<int>(draftLength, llama_n_batch(ctx) - 1);
+
+    auto dparams = llama_sampler_chain_default_params();
+    struct llama_sampler * draftSmpl = llama_sampler_chain_init(dparams);
+    llama_sampler_chain_add(draftSmpl, llama_sampler_init_greedy());
+
+    std::string response;
+    std::string streamed; // Bytes of a split character, not shown yet
+    std::vector<llama_token> tokens(prompt_tokens); // Everything committed so far
+    int n_generated = 0;
+    // Leading tokens already in the draft's KV cache: whatever this prompt shares
+    // with the last one, e.g. the system prompt. The last prompt token is always
+    // decoded again, the draft needs its logits.
+    int draftPast = 0;
+    while (draftPast + 1 < (int) prompt_tokens.size() && draftPast < (int) draftTokens.size() &&
+           draftTokens[draftPast] == prompt_tokens[draftPast]) {
+        draftPast++;
+    }
+    llama_memory_seq_rm(draftMem, 0, draftPast, -1);
+
+    // First token comes from the prefill logits
+    llama_token last = llama_sampler_sample(smpl, ctx, -1);
+    int n_past = tokens.size(); // Position of `last`, which no model has seen yet
+    bool done = llama_vocab_is_eog(vocab, last) || n_predict <= 0;
+    if (!done) {
+        std::string piece = tokenPiece(vocab, last);
+        response += piece;
+        streamPiece(options, streamed, piece);
+        tokens.push_back(last);
+        n_generated++;
+    }
+
+    bool stopped = false;
+    while (!done && n_generated < n_predict && n_past + 1 < n_ctx) {
+        if (options.stopped()) {
+            stopped = true;
+            break;
+        }
+        // 1. Draft model proposes up to n_draft tokens, one cheap decode each
+        const int n_draft = std::max(0, std::min({max_draft, n_predict - n_generated - 1, n_ctx - n_past - 2}));
+        std::vector<llama_token> draft;
+        if (n_draft > 0 && decodeChunks(draftCtx, draftBatch, tokens, draftPast, 0, true)) {
+            draftPast = tokens.size();
+            llama_sampler_reset(draftSmpl);
+            for (int i = 0; i < n_draft; ++i) {
+                llama_token d = llama_sampler_sample(draftSmpl, draftCtx, -1);
+                draft.push_back(d);
+                if (llama_vocab_is_eog(vocab, d) || i + 1 == n_draft) break;
+
+                draftBatch.n_tokens = 0;
+                batch_add(draftBatch, d, n_past + 1 + i, 0, true);
+                if (llama_decode(draftCtx, draftBatch) != 0) break;
+                draftPast++;
+            }
+        }
+
+        // 2. Main model scores `last` and every draft token in one batch
+        batch.n_tokens = 0;
+        batch_add(batch, last, n_past, 0, true);
+        for (size_t i = 0; i < draft.size(); ++i) {
+            batch_add(batch, draft[i], n_past + 1 + i, 0, true);
+        }
+        if (llama_decode(ctx, batch) != 0) break;
+
+        // 3. Keep drafts while they equal what the main model picks itself; the
+        //    first mismatch (or the token after the last draft) comes for free
+        size_t accepted = 0;
+        for (size_t i = 0; i <= draft.size(); ++i) {
+            llama_token id = llama_sampler_sample(smpl, ctx, i);
+            if (llama_vocab_is_eog(vocab, id)) {
+                done = true;
+                break;
+            }
+            std::string piece = tokenPiece(vocab, id);
+            response += piece;
+            streamPiece(options, streamed, piece);
+            tokens.push_back(id);
+            n_generated++;
+            if (i < draft.size() && id == draft[i]) {
+                accepted++;
+                continue;
+            }
+            break;
+        }
+        run.drafted += draft.size();
+        run.accepted += accepted;
+
+        // 4. Drop KV cells of rejected drafts in both models
+        n_past += accepted + 1;
+        llama_memory_seq_rm(mem, 0, n_past, -1);
+        draftPast = std::min(draftPast, n_past);
+        llama_memory_seq_rm(draftMem, 0, draftPast, -1);
+        last = tokens.back();
+    }
+
+    llama_sampler_free(draftSmpl);
+    // A failed decode may have left cells past draftPast
+    llama_memory_seq_rm(draftMem, 0, draftPast, -1);
+    draftTokens.assign(tokens.begin(), tokens.begin() + std::min<size_t>(draftPast, tokens.size()));
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    run.tokens += n_generated;
+    run.seconds += seconds;
+    return stopped ? options.stopReason() : response;
+}
 
-    return response_ss.str();
+bool LlamaEngine::loadDraftModel(const std::string& modelPath)
+{
+    std::lock_guard<std::mutex> lock(draftMutex);
+    freeDraftModel();
+    if (!model) {
+        std::cerr << "Load the main model before the draft model" << std::endl;
+        return false;
+    }
+
+    llama_model_params model_params = llama_model_default_params();
+    profile.applyTo(model_params);
+    draftModel = llama_model_load_from_file(modelPath.c_str(), model_params);
+    if (!draftModel) {
+        std::cerr << "Failed to load draft model from " << modelPath << std::endl;
+        return false;
+    }
+
+    // Drafts are compared token by token, so both models must share a vocabulary
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    const llama_vocab* draftVocab = llama_model_get_vocab(draftModel);
+    if (std::abs(llama_vocab_n_tokens(vocab) - llama_vocab_n_tokens(draftVocab)) > 128 ||
+        llama_vocab_bos(vocab) != llama_vocab_bos(draftVocab) ||
+        llama_vocab_eos(vocab) != llama_vocab_eos(draftVocab)) {
+        std::cerr << "Draft model vocabulary does not match the main model" << std::endl;
+        freeDraftModel();
+        return false;
+    }
+
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = nCtx;
+    if (profile.threads > 0) ctx_params.n_threads = profile.threads;
+    if (profile.batchThreads > 0) ctx_params.n_threads_batch = profile.batchThreads;
+    draftCtx = llama_init_from_model(draftModel, ctx_params);
+    if (!draftCtx) {
+        std::cerr << "Failed to create draft context" << std::endl;
+        freeDraftModel();
+        return false;
+    }
+    draftBatch = llama_batch_init(llama_n_batch(draftCtx), 0, 1);
+    return true;
+}
+
+void LlamaEngine::unloadDraftModel()
+{
+    std::lock_guard<std::mutex> lock(draftMutex);
+    freeDraftModel();
 }
 
-std::string LlamaEngine::suggestTags(const std::string& filename, const std::string& content)
+void LlamaEngine::freeDraftModel()
+{
+    draftTokens.clear();
+    if (draftBatch.token) {
+        llama_batch_free(draftBatch);
+        draftBatch = {};
+    }
+    if (draftCtx) {
+        llama_free(draftCtx);
+        draftCtx = nullptr;
+    }
+    if (draftModel) {
+        llama_model_free(draftModel);
+        draftModel = nullptr;
+    }
+}
+
+bool LlamaEngine::prefill(Session& s, const std::vector<llama_token>& tokens, size_t start, llama_seq_id seq, bool logits,
+                          const RequestOptions& options)
+{
+    return decodeChunks(s.ctx, s.batch, tokens, start, seq, logits, [&options] { return options.stopped(); });
+}
+
+std::vector<std::string> LlamaEngine::generateBatch(const std::vector<std::string>& prompts)
+{
+    if (!model) return std::vector<std::string>(prompts.size(), "Error: Model not loaded");
+
+    std::vector<std::vector<llama_token>> tokens;
+    tokens.reserve(prompts.size());
+    for (const auto& prompt : prompts) {
+        tokens.push_back(PromptBuilder::tokenize(llama_model_get_vocab(model), prompt));
+    }
+    return generateBatch(tokens);
+}
+
+std::vector<std::string> LlamaEngine::generateBatch(const std::vector<std::vector<llama_token>>& prompts,
+                                                    const std::string& grammar)
+{
+    Trace trace("batch");
+    LlamaContextPool::Lease lease;
+    if (model) lease = contexts.acquire();
+    if (!lease) return std::vector<std::string>(prompts.size(), "Error: Model not loaded");
+    return generateBatchOn(*lease, prompts, grammar, {}, trace);
+}
+
+std::vector<std::string> LlamaEngine::generateBatchOn(Session& session, const std::vector<std::vector<llama_token>>& prompts,
+                                                      const std::string& grammar, const RequestOptions& options,
+                                                      const Trace& trace)
+{
+    std::vector<std::string> results(prompts.size());
+    llama_context* ctx = session.ctx;
+    llama_batch& batch = session.batch;
+
+    auto t_start = std::chrono::steady_clock::now();
+    llama_perf_context_reset(ctx);
+
+    clearSequences(session);
+    llama_memory_t mem = llama_get_memory(ctx);
+
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    const int n_ctx = llama_n_ctx(ctx);
+    const int n_batch = llama_n_batch(ctx);
+    const int n_parallel = std::min<int>(kParallelSequences, llama_n_seq_max(ctx));
+    const int n_predict = kPredictTokens;
+    // Cells of the cached prefix, occupied whether a slot shares them or not:
+    // a prompt that reuses the prefix needs cells for the rest only, any other for all of it
+    const int n_shared = session.prefixTokens.size();
+    const int n_budget = n_ctx - n_shared;
+
+    struct Slot {
+        int index = -1;                  // Prompt being served, -1 when idle
+        std::vector<llama_token> tokens; // Prompt tokens
+        size_t n_prefilled = 0;
+        llama_pos pos = 0;
+        llama_token next = 0;            // Last sampled token, fed back next step
+        int n_generated = 0;
+        int reserved = 0;                // KV cells reserved: prompt + n_predict
+        int i_batch = -1;                // Row of this slot's logits in the current batch
+        std::string text;
+        InferenceSample sample;
+        std::chrono::steady_clock::time_point admitted, first; // Prefill from `admitted`, decode from `first`
+    };
+    std::vector<Slot> slots(n_parallel);
+
+    // Grammar state is per sequence, so every slot gets its own sampler
+    std::vector<llama_sampler*> samplers(n_parallel);
+    for (auto& smpl : samplers) smpl = makeSampler(grammar);
+
+    size_t next_prompt = 0;
+    size_t n_done = 0;
+    int kv_reserved = 0;
+    std::vector<llama_token> queued; // Tokenized prompt waiting for KV space
+    bool have_queued = false;
+
+    auto finish = [&](int s, std::string result) {
+        Slot& slot = slots[s];
+        slot.sample.ok = result.rfind("Error:", 0) != 0;
+        if (slot.n_generated > 0) slot.sample.decodeMs = msSince(slot.first);
+        slot.sample.generatedTokens = slot.n_generated;
+        finishSample(slot.sample, trace);
+        results[slot.index] = std::move(result);
+        llama_memory_seq_rm(mem, s, -1, -1);
+        kv_reserved -= slot.reserved;
+        slot = Slot();
+        n_done++;
+    };
+
+    while (n_done < prompts.size()) {
+        if (options.stopped()) {
+            for (int s = 0; s < n_parallel; ++s) {
+                if (slots[s].index >= 0) finish(s, options.stopReason());
+            }
+            for (; next_prompt < prompts.size(); ++next_prompt) results[next_prompt] = options.stopReason();
+            break;
+        }
+
+        // 1. Admit waiting prompts into idle slots while their worst case fits in the KV cache
+        for (int s = 0; s < n_parallel; ++s) {
+            while (slots[s].index < 0 && next_prompt < prompts.size()) {
+                if (!have_queued) {
+                    queued = prompts[next_prompt];
+                    have_queued = true;
+                }
+                int n_reuse = reusablePrefix(session, queued);
+                int need = (int) queued.size() - n_reuse + n_predict;
+                if (queued.empty() || need > n_budget) {
+                    results[next_prompt++] = queued.empty() ? "Error: Tokenization failed"
+                                                            : "Error: Prompt exceeds context size";
+                    have_queued = false;
+                    n_done++;
+                    continue;
+                }
+                if (kv_reserved + need > n_budget) break; // Wait for a running sequence to finish
+
+                Slot& slot = slots[s];
+                slot.index = (int) next_prompt++;
+                llama_sampler_reset(samplers[s]);
+                if (n_reuse > 0) {
+                    llama_memory_seq_cp(mem, kPrefixSeq, s, -1, -1);
+                    slot.n_prefilled = n_reuse;
+                    slot.pos = n_reuse;
+                }
+                // Waiting for the context, then for a free sequence
+                slot.sample = trace.sample;
+                slot.sample.queueMs = std::max(0.0, trace.sample.queueMs) + msSince(t_start);
+                slot.sample.promptTokens = (int) queued.size() - n_reuse;
+                slot.sample.reusedTokens = n_reuse;
+                slot.admitted = std::chrono::steady_clock::now();
+                slot.tokens = std::move(queued);
+                slot.reserved = need;
+                kv_reserved += need;
+                have_queued = false;
+            }
+        }
+
+        // 2. One decode step: every generating slot feeds its last token, then
+        //    prefilling slots fill the rest of the batch with prompt chunks
+        batch.n_tokens = 0;
+        for (int s = 0; s < n_parallel; ++s) {
+            Slot& slot = slots[s];
+            slot.i_batch = -1;
+            if (slot.index < 0 || slot.n_prefilled < slot.tokens.size()) continue;
+            slot.i_batch = batch.n_tokens;
+            batch_add(batch, slot.next, slot.pos++, s, true);
+        }
+        for (int s = 0; s < n_parallel && batch.n_tokens < n_batch; ++s) {
+            Slot& slot = slots[s];
+            if (slot.index < 0 || slot.n_prefilled >= slot.tokens.size()) continue;
+            while (slot.n_prefilled < slot.tokens.size() && batch.n_tokens < n_batch) {
+                bool last = slot.n_prefilled + 1 == slot.tokens.size();
+                if (last) slot.i_batch = batch.n_tokens;
+                batch_add(batch, slot.tokens[slot.n_prefilled++], slot.pos++, s, last);
+            }
+        }
+        if (batch.n_tokens == 0) break;
+
+        if (llama_decode(ctx, batch) != 0) {
+            for (int s = 0; s < n_parallel; ++s) {
+                if (slots[s].index >= 0) finish(s, "Error: llama_decode failed");
+            }
+            continue;
+        }
+
+        // 3. Sample for every slot whose logits were computed in this step
+        for (int s = 0; s < n_parallel; ++s) {
+            Slot& slot = slots[s];
+            if (slot.index < 0 || slot.i_batch < 0) continue;
+
+            llama_token id = llama_sampler_sample(samplers[s], ctx, slot.i_batch);
+            if (slot.n_generated == 0) {
+                slot.first = std::chrono::steady_clock::now();
+                slot.sample.prefillMs = msBetween(slot.admitted, slot.first);
+                slot.sample.ttftMs = msSince(trace.start);
+            }
+            if (llama_vocab_is_eog(vocab, id)) {
+                finish(s, std::move(slot.text));
+                continue;
+            }
+            slot.text += tokenPiece(vocab, id);
+            slot.next = id;
+            if (++slot.n_generated >= n_predict) {
+                finish(s, std::move(slot.text));
+            }
+        }
+    }
+
+    for (auto smpl : samplers) llama_sampler_free(smpl);
+    return results;
+}
+
+std::string LlamaEngine::tagCacheKey(const std::string& filename, const std::string& content) const
+{
+    // Identical content gets identical tags whatever the file is called; only
+    // files without content are told apart by name
+    std::string input = content.empty() ? "name:" + filename : content;
+
+    // Everything that shapes the answer besides the input
+    std::string prompt = kTagSystemPrompt + kTagGrammar + kTagUserBefore + kTagUserContent + kTagUserAfter +
+                         kTagNoContent +
+                         "\nbudget " + std::to_string(promptBudget()) +
+                         (profile.summarizeLongContent ? "\nsummary revision " + std::to_string(kSummaryRevision) : "");
+
+    return InferenceCache::makeKey(FileIdentity::fingerprintData(input), modelFingerprint,
+                                   FileIdentity::fingerprintData(prompt));
+}
+
+std::string LlamaEngine::suggestTags(const std::string& filename, const std::string& content,
+                                     const RequestOptions& options)
+{
+    if (!model) return "Error: Model not loaded";
+
+    std::string key;
+    if (cache && !modelFingerprint.empty()) {
+        key = tagCacheKey(filename, content);
+        std::string tags;
+        if (cache->lookup(key, tags)) {
+            if (options.onToken) options.onToken(tags);
+            return tags;
+        }
+    }
+
+    Trace trace("tags");
+    LlamaContextPool::Lease lease = contexts.acquire([&options] { return options.stopped(); });
+    if (!lease) return options.stopped() ? options.stopReason() : "Error: Model not loaded";
+    trace.sample.queueMs = msSince(trace.start);
+
+    auto t_prompt = std::chrono::steady_clock::now();
+    std::string body = profile.summarizeLongContent ? condense(*lease, filename, content, options) : content;
+    if (body.rfind("Error:", 0) == 0) return body;
+    std::vector<llama_token> prompt = buildTagPrompt(filename, body);
+    if (prompt.empty()) return "Error: Prompt template exceeds the prefill budget";
+    trace.sample.tokenizeMs = msSince(t_prompt);
+
+    cachePrefix(*lease, kTagSystemPrompt);
+    std::string tags = generateOn(*lease, prompt, kTagGrammar, options, trace);
+    bool ok = !tags.empty() && tags.rfind("Error:", 0) != 0;
+    if (telemetry) telemetry->recordTagRun(false, ok ? 1 : 0, msSince(trace.start) - trace.sample.queueMs);
+    if (!key.empty() && !tags.empty() && tags.rfind("Error:", 0) != 0) cache->store(key, tags);
+    return tags;
+}
+
+std::vector<std::string> LlamaEngine::suggestTagsBatch(const std::vector<std::pair<std::string, std::string>>& files,
+                                                       const RequestOptions& options)
+{
+    if (!model) return std::vector<std::string>(files.size(), "Error: Model not loaded");
+
+    std::vector<TagRequest> requests;
+    requests.reserve(files.size());
+    for (const auto& [filename, content] : files) requests.push_back(prepareTags(filename, content));
+    return suggestPreparedTags(requests, options);
+}
+
+TagRequest LlamaEngine::prepareTags(const std::string& filename, const std::string& content)
+{
+    TagRequest request = InferenceBackend::prepareTags(filename, content);
+    if (!model) return request;
+
+    if (cache && !modelFingerprint.empty()) {
+        request.cacheKey = tagCacheKey(filename, content);
+        if (cache->lookup(request.cacheKey, request.cached)) return request;
+    }
+    if (!profile.summarizeLongContent || !needsCondense(filename, content)) {
+        request.tokens = buildTagPrompt(filename, content);
+    }
+    return request;
+}
+
+std::vector<std::string> LlamaEngine::suggestPreparedTags(const std::vector<TagRequest>& requests,
+                                                          const RequestOptions& options)
+{
+    if (!model) return std::vector<std::string>(requests.size(), "Error: Model not loaded");
+
+    // Only cache misses are generated
+    std::vector<std::string> results(requests.size());
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        if (requests[i].cached.empty()) todo.push_back(i);
+        else results[i] = requests[i].cached;
+    }
+    if (todo.empty()) return results;
+
+    Trace trace("tags-batch");
+    LlamaContextPool::Lease lease = contexts.acquire([&options] { return options.stopped(); });
+    if (!lease) {
+        return std::vector<std::string>(requests.size(), options.stopped() ? options.stopReason() : "Error: Model not loaded");
+    }
+    trace.sample.queueMs = msSince(trace.start);
+
+    // Long files are condensed one by one, then everything is tagged in one batch
+    auto t_prompt = std::chrono::steady_clock::now();
+    std::vector<std::vector<llama_token>> prompts;
+    std::vector<std::string> failed(todo.size());
+    for (size_t j = 0; j < todo.size(); ++j) {
+        const TagRequest& r = requests[todo[j]];
+        if (!r.tokens.empty()) {
+            prompts.push_back(r.tokens);
+            continue;
+        }
+        std::string body = profile.summarizeLongContent ? condense(*lease, r.filename, r.content, options) : r.content;
+        if (body.rfind("Error:", 0) == 0) failed[j] = body;
+        prompts.push_back(failed[j].empty() ? buildTagPrompt(r.filename, body) : std::vector<llama_token>());
+    }
+    trace.sample.tokenizeMs = msSince(t_prompt) / todo.size(); // Per file
+    cachePrefix(*lease, kTagSystemPrompt);
+    std::vector<std::string> generated = generateBatchOn(*lease, prompts, kTagGrammar, options, trace);
+    size_t tagged = 0;
+    for (size_t j = 0; j < todo.size(); ++j) {
+        size_t i = todo[j];
+        results[i] = failed[j].empty() ? generated[j] : failed[j];
+        if (results[i].empty() || results[i].rfind("Error:", 0) == 0) continue;
+        tagged++;
+        if (!requests[i].cacheKey.empty()) cache->store(requests[i].cacheKey, results[i]);
+    }
+    if (telemetry) telemetry->recordTagRun(true, tagged, msSince(trace.start) - trace.sample.queueMs);
+    return results;
+}
+
+bool LlamaEngine::cachePrefix(Session& s, const std::string& text)
+{
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    std::vector<llama_token> tokens = PromptBuilder::tokenize(vocab, text);
+    if (tokens == s.prefixTokens) return true;
+
+    llama_memory_t mem = llama_get_memory(s.ctx);
+    llama_memory_seq_rm(mem, kPrefixSeq, -1, -1);
+    s.prefixTokens.clear();
+    if (tokens.empty()) return false;
+
+    if (!prefill(s, tokens, 0, kPrefixSeq, false)) {
+        std::cerr << "Failed to evaluate prompt prefix" << std::endl;
+        llama_memory_seq_rm(mem, kPrefixSeq, -1, -1);
+        return false;
+    }
+    s.prefixTokens = std::move(tokens);
+    return true;
+}
+
+size_t LlamaEngine::reusablePrefix(const Session& s, const std::vector<llama_token>& tokens) const
+{
+    // At least one token has to be left to decode, for the logits
+    const auto& prefix = s.prefixTokens;
+    if (prefix.empty() || tokens.size() <= prefix.size()) return 0;
+    return std::equal(prefix.begin(), prefix.end(), tokens.begin()) ? prefix.size() : 0;
+}
+
+void LlamaEngine::clearSequences(Session& s)
+{
+    llama_memory_t mem = llama_get_memory(s.ctx);
+    for (llama_seq_id s = 0; s < kPrefixSeq; ++s) {
+        llama_memory_seq_rm(mem, s, -1, -1);
+    }
+}
+
+std::vector<llama_token> LlamaEngine::buildTagPrompt(const std::string& filename, const std::string& content) const
 {
     // Qwen / ChatML Format
     // Format: <|im_start|>system\n...\n<|im_end|>\n<|im_start|>user\n...\n<|im_end|>\n<|im_start|>assistant\n
-    
-    // Increase limit to 16000 chars (approx fits in 8k context)
-    std::string safeContent = content.empty() ? "(No content)" : content.substr(0, 16000);
-    
-    std::string prompt = 
-        "<|im_start|>system\n"
-        "You are a helpful file organization assistant. Analyze the given file metadata and content to suggest strict tags.\n"
-        "Rules:\n"
-        "1. Output ONLY a comma-separated list of tags.\n"
-        "2. Suggest 3-5 tags.\n"
-        "3. Use Traditional Chinese (繁體中文) for general concepts.\n"
-        "4. Keep tags concise (under 5 words).\n"
-        "<|im_end|>\n"
-        "<|im_start|>user\n"
-        "Filename: " + filename + "\n"
-        "Content Preview: " + safeContent + "\n"
-        "<|im_end|>\n"
-        "<|im_start|>assistant\n";
-
-    return generateResponse(prompt);
+
+    // Content gets whatever the budget leaves after the template and the answer
+    PromptBuilder::Policy policy;
+    policy.maxTokens = promptBudget();
+
+    PromptBuilder builder(llama_model_get_vocab(model));
+    return builder.build(kTagSystemPrompt + kTagUserBefore + filename + kTagUserContent,
+                         content.empty() ? kTagNoContent : content, kTagUserAfter, policy);
+}
+
+// Content-defined chunks of at most maxTokens: a chunk ends where a hash of
+// its last tokens hits, once it is at least half the size. An edit only moves
+// the cuts around it, so the other chunks and their cached summaries stay the
+// same; fixed offsets would shift every chunk after an insertion.
+static std::vector<std::pair<size_t, size_t>> contentChunks(const std::vector<llama_token>& tokens, size_t maxTokens)
+{
+    const size_t window = 16;
+    const size_t minTokens = std::max<size_t>(1, maxTokens / 2);
+    const uint64_t spread = std::max<size_t>(1, maxTokens / 4); // Expected length past minTokens
+    std::vector<std::pair<size_t, size_t>> chunks;
+    size_t start = 0;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        size_t length = i + 1 - start;
+        bool cut = length >= maxTokens || i + 1 == tokens.size();
+        if (!cut && length >= minTokens && i + 1 >= window) {
+            uint64_t h = 1469598103934665603ull; // FNV-1a over the window's token ids
+            for (size_t j = i + 1 - window; j <= i; ++j) {
+                h ^= uint32_t(tokens[j]);
+                h *= 1099511628211ull;
+            }
+            cut = (h >> 17) % spread == 0;
+        }
+        if (cut) {
+            chunks.push_back({start, i + 1});
+            start = i + 1;
+        }
+    }
+    return chunks;
+}
+
+bool LlamaEngine::needsCondense(const std::string& filename, const std::string& content) const
+{
+    const int budget = promptBudget() - (int) buildTagPrompt(filename, "").size();
+    if (content.size() <= (size_t) std::max(budget, 0)) return false; // Never more tokens than bytes
+    if (content.size() > (size_t) std::max(budget, 0) * 8) return true; // Far too long to bother counting
+    return (int) PromptBuilder::tokenize(llama_model_get_vocab(model), content, false, false).size() > budget;
+}
+
+std::string LlamaEngine::condense(Session& s, const std::string& filename, const std::string& content,
+                                  const RequestOptions& options)
+{
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+
+    // What the tag prompt leaves for content
+    const int budget = promptBudget() - (int) buildTagPrompt(filename, "").size();
+
+    // Chunks small enough that every parallel sequence fits in the KV cache at once
+    const int n_template = PromptBuilder::tokenize(vocab, kSummaryPromptBefore).size() +
+                           PromptBuilder::tokenize(vocab, kSummaryPromptAfter, false).size();
+    const int n_parallel = std::min<int>(kParallelSequences, llama_n_seq_max(s.ctx));
+    const int n_free = nCtx - (int) s.prefixTokens.size();
+    int chunkTokens = n_free / n_parallel - kPredictTokens - n_template;
+    if (chunkTokens < 256) chunkTokens = n_free - kPredictTokens - n_template; // One at a time then
+    chunkTokens = std::min(chunkTokens, prefillBudget);
+    if (budget <= 0 || chunkTokens <= 0) return content;
+
+    // No more than the first level reads; ~4 bytes per token, with room to spare
+    std::string text = PromptBuilder::presample(content, size_t(kMaxChunks) * chunkTokens * 8, PromptBuilder::Policy());
+    std::vector<llama_token> tokens = PromptBuilder::tokenize(vocab, text, false, false);
+    if ((int) tokens.size() <= budget) return content;
+
+    int level = 0;
+    while ((int) tokens.size() > budget && level < kMaxCondenseLevels) {
+        if (options.stopped()) return options.stopReason();
+
+        // Beyond kMaxChunks, chunks are picked evenly across the content
+        std::vector<std::pair<size_t, size_t>> cuts = contentChunks(tokens, chunkTokens);
+        size_t n_chunks = cuts.size();
+        std::vector<std::vector<llama_token>> chunks;
+        for (size_t i = 0; i < std::min<size_t>(n_chunks, kMaxChunks); ++i) {
+            const auto& [from, to] = cuts[n_chunks <= kMaxChunks ? i : i * n_chunks / kMaxChunks];
+            chunks.emplace_back(tokens.begin() + from, tokens.begin() + to);
+        }
+
+        std::vector<std::string> summaries = summarizeChunks(s, chunks, options);
+        text.clear();
+        for (size_t i = 0; i < summaries.size(); ++i) {
+            if (summaries[i].rfind("Error:", 0) == 0) return summaries[i];
+            text += "[" + std::to_string(i + 1) + "/" + std::to_string(summaries.size()) + "] " + summaries[i] + "\n";
+        }
+
+        size_t before = tokens.size();
+        tokens = PromptBuilder::tokenize(vocab, text, false, false);
+        level++;
+        if (tokens.size() >= before) break; // Not getting any shorter; PromptBuilder samples the rest
+    }
+
+    return "(Summaries of the parts of a long document)\n" + text;
+}
+
+std::vector<std::string> LlamaEngine::summarizeChunks(Session& s, const std::vector<std::vector<llama_token>>& chunks,
+                                                      const RequestOptions& options)
+{
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    const std::vector<llama_token> before = PromptBuilder::tokenize(vocab, kSummaryPromptBefore);
+    const std::vector<llama_token> after = PromptBuilder::tokenize(vocab, kSummaryPromptAfter, false);
+    const std::string promptId = FileIdentity::fingerprintData(std::string(kSummaryPromptBefore) + kSummaryPromptAfter +
+                                                               "\nrevision " + std::to_string(kSummaryRevision));
+
+    // Cached by the chunk's tokens, so re-tagging an edited document only summarises the parts that changed
+    std::vector<std::string> summaries(chunks.size());
+    std::vector<std::string> keys(chunks.size());
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (cache && !modelFingerprint.empty()) {
+            std::string bytes(reinterpret_cast<const char*>(chunks[i].data()), chunks[i].size() * sizeof(llama_token));
+            keys[i] = InferenceCache::makeKey(FileIdentity::fingerprintData(bytes), modelFingerprint, promptId);
+            if (cache->lookup(keys[i], summaries[i])) continue;
+        }
+        todo.push_back(i);
+    }
+
+    // Several batches rather than one, so that cancelling doesn't wait for all of them
+    const size_t group = 2 * kParallelSequences;
+    for (size_t first = 0; first < todo.size(); first += group) {
+        if (options.stopped()) {
+            for (size_t j = first; j < todo.size(); ++j) summaries[todo[j]] = options.stopReason();
+            break;
+        }
+        size_t last = std::min(todo.size(), first + group);
+        std::vector<std::vector<llama_token>> prompts;
+        for (size_t j = first; j < last; ++j) {
+            std::vector<llama_token> prompt(before);
+            prompt.insert(prompt.end(), chunks[todo[j]].begin(), chunks[todo[j]].end());
+            prompt.insert(prompt.end(), after.begin(), after.end());
+            prompts.push_back(std::move(prompt));
+        }
+        Trace trace("summary");
+        trace.sample.queueMs = 0; // On the caller's context
+        std::vector<std::string> generated = generateBatchOn(s, prompts, "", options, trace);
+        for (size_t j = first; j < last; ++j) {
+            size_t i = todo[j];
+            summaries[i] = generated[j - first];
+            if (!keys[i].empty() && !summaries[i].empty() && summaries[i].rfind("Error:", 0) != 0) {
+                cache->store(keys[i], summaries[i]);
+            }
+        }
+    }
+    return summaries;
+}
+
+bool LlamaEngine::loadProjector(const std::string& mmprojPath)
+{
+    std::lock_guard<std::mutex> lock(visionMutex);
+    freeProjector();
+    projectorPath = mmprojPath;
+    if (!initProjector()) {
+        projectorPath.clear();
+        return false;
+    }
+    return true;
+}
+
+void LlamaEngine::unloadProjector()
+{
+    std::lock_guard<std::mutex> lock(visionMutex);
+    freeProjector();
+    projectorPath.clear();
+}
+
+bool LlamaEngine::initProjector()
+{
+#ifdef SMARTFILE_MULTIMODAL
+    if (!model || projectorPath.empty()) return false;
+
+    mtmd_context_params params = mtmd_context_params_default();
+    params.use_gpu = profile.gpuLayers > 0; // CPU-only machines encode on the CPU
+    params.print_timings = false;
+    params.n_threads = profile.batchThreads > 0 ? profile.batchThreads
+                                                : (int) std::max(1u, std::thread::hardware_concurrency());
+    vision = mtmd_init_from_file(projectorPath.c_str(), model, params);
+    if (!vision || !mtmd_support_vision(vision)) {
+        std::cerr << "Failed to load vision projector from " << projectorPath << std::endl;
+        if (vision) mtmd_free(vision);
+        vision = nullptr;
+        return false;
+    }
+    projectorFingerprint = FileIdentity::fingerprintFile(projectorPath);
+    return true;
+#else
+    std::cerr << "Built without SMARTFILE_MULTIMODAL, cannot load " << projectorPath << std::endl;
+    return false;
+#endif
+}
+
+void LlamaEngine::freeProjector()
+{
+#ifdef SMARTFILE_MULTIMODAL
+    if (vision) mtmd_free(vision);
+#endif
+    vision = nullptr;
+    projectorFingerprint.clear();
+}
+
+std::string LlamaEngine::imageTagCacheKey(const ImageData& image) const
+{
+    std::string prompt = kTagSystemPrompt + kTagGrammar + kTagUserBefore + kTagUserAfter +
+                         "\nimage " + std::to_string(kMaxImageSide);
+    return InferenceCache::makeKey(FileIdentity::fingerprintData("image:" + image.key),
+                                   modelFingerprint + "+" + projectorFingerprint, FileIdentity::fingerprintData(prompt));
+}
+
+LlamaEngine::ImagePrompt LlamaEngine::prepareImagePrompt(const std::string& filename, const ImageData& image)
+{
+    ImagePrompt prompt;
+#ifdef SMARTFILE_MULTIMODAL
+    if (!vision) {
+        prompt.error = "Error: No vision projector loaded";
+        return prompt;
+    }
+    if (image.empty()) {
+        prompt.error = "Error: Empty image";
+        return prompt;
+    }
+
+    // Encoder cost grows with the pixel count; tags don't need more than this
+    const ImageData* pixels = &image;
+    ImageData scaled;
+    if (std::max(image.width, image.height) > kMaxImageSide) {
+        scaled = image;
+        ImageLoader::downscale(scaled, kMaxImageSide);
+        pixels = &scaled;
+    }
+
+    std::string text = kTagSystemPrompt + kTagUserBefore + filename + "\n" + mtmd_default_marker() + kTagUserAfter;
+    mtmd_input_text input = {text.c_str(), true, true};
+    mtmd_bitmap* bitmap = mtmd_bitmap_init(pixels->width, pixels->height, pixels->rgb.data());
+    const mtmd_bitmap* bitmaps[] = {bitmap};
+    prompt.chunks = mtmd_input_chunks_init();
+    int32_t rc = mtmd_tokenize(vision, prompt.chunks, &input, bitmaps, 1);
+    mtmd_bitmap_free(bitmap);
+    if (rc != 0) {
+        prompt.error = "Error: Image tokenization failed";
+        return prompt;
+    }
+
+    // Image chunks: embeddings from the disk cache, or from the encoder
+    const size_t n_chunks = mtmd_input_chunks_size(prompt.chunks);
+    const size_t n_embd = llama_model_n_embd_inp(model);
+    prompt.embeddings.resize(n_chunks);
+    for (size_t i = 0; i < n_chunks; ++i) {
+        const mtmd_input_chunk* chunk = mtmd_input_chunks_get(prompt.chunks, i);
+        if (mtmd_input_chunk_get_type(chunk) != MTMD_INPUT_CHUNK_TYPE_IMAGE) continue;
+
+        size_t count = mtmd_input_chunk_get_n_tokens(chunk) * n_embd;
+        std::string key;
+        if (!image.key.empty()) {
+            key = image.key + "/" + projectorFingerprint + "/" + std::to_string(kMaxImageSide) + "/" + std::to_string(i);
+            if (imageCache.load(key, count, prompt.embeddings[i])) continue;
+        }
+        if (mtmd_encode_chunk(vision, chunk) != 0) {
+            prompt.error = "Error: Image encoding failed";
+            return prompt;
+        }
+        const float* embd = mtmd_get_output_embd(vision);
+        prompt.embeddings[i].assign(embd, embd + count);
+        if (!key.empty()) imageCache.store(key, embd, count);
+    }
+    prompt.n_pos = mtmd_helper_get_n_pos(prompt.chunks);
+    prompt.n_tokens = (int) mtmd_helper_get_n_tokens(prompt.chunks);
+#else
+    (void) filename;
+    (void) image;
+    prompt.error = "Error: Built without multimodal support";
+#endif
+    return prompt;
+}
+
+void LlamaEngine::freeImagePrompt(ImagePrompt& prompt)
+{
+#ifdef SMARTFILE_MULTIMODAL
+    if (prompt.chunks) mtmd_input_chunks_free(prompt.chunks);
+#endif
+    prompt.chunks = nullptr;
+    prompt.embeddings.clear();
+}
+
+std::vector<std::string> LlamaEngine::generateImagesOn(Session& s, std::vector<ImagePrompt>& prompts,
+                                                       const RequestOptions& options, const Trace& trace)
+{
+    std::vector<std::string> results(prompts.size());
+#ifdef SMARTFILE_MULTIMODAL
+    auto t_start = std::chrono::steady_clock::now();
+    llama_context* ctx = s.ctx;
+    llama_batch& batch = s.batch;
+    llama_memory_t mem = llama_get_memory(ctx);
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    const int n_batch = llama_n_batch(ctx);
+    const int n_parallel = std::min<int>(kParallelSequences, llama_n_seq_max(ctx));
+    // The cached prefix stays in the KV cache but is not shared with image prompts
+    const int n_budget = nCtx - (int) s.prefixTokens.size();
+
+    struct Slot {
+        size_t index = 0;  // Into prompts
+        llama_pos pos = 0;
+        llama_token next = 0;
+        int n_generated = 0;
+        int i_batch = -1;
+        bool done = false;
+        std::string text;
+        std::string streamed; // Bytes of a split character, not shown yet
+        llama_sampler* smpl = nullptr;
+        InferenceSample sample;
+        std::chrono::steady_clock::time_point first; // Decode from here
+    };
+
+    auto finish = [&](Slot& slot, std::string result) {
+        slot.sample.ok = result.rfind("Error:", 0) != 0;
+        if (slot.n_generated > 0) slot.sample.decodeMs = msSince(slot.first);
+        slot.sample.generatedTokens = slot.n_generated;
+        finishSample(slot.sample, trace);
+        results[slot.index] = std::move(result);
+        slot.done = true;
+    };
+
+    // Appends a sampled token; false once the answer is complete
+    auto accept = [&](Slot& slot, llama_token id) {
+        if (llama_vocab_is_eog(vocab, id) || slot.n_generated >= kPredictTokens) return false;
+        std::string piece = tokenPiece(vocab, id);
+        slot.text += piece;
+        streamPiece(options, slot.streamed, piece);
+        slot.next = id;
+        slot.n_generated++;
+        return true;
+    };
+
+    size_t next = 0;
+    while (next < prompts.size()) {
+        clearSequences(s);
+
+        // As many images as fit the KV cache together, one sequence each
+        std::vector<Slot> slots;
+        int reserved = 0;
+        while (next < prompts.size() && (int) slots.size() < n_parallel) {
+            const ImagePrompt& p = prompts[next];
+            int need = p.n_tokens + kPredictTokens;
+            if (!p.error.empty() || need > n_budget) {
+                results[next] = p.error.empty() ? "Error: Image prompt exceeds context size" : p.error;
+                next++;
+                continue;
+            }
+            if (reserved + need > n_budget) break;
+            reserved += need;
+            Slot slot;
+            slot.index = next++;
+            slots.push_back(std::move(slot));
+        }
+
+        // Prefill, then the first token of each from its own logits
+        {
+            std::lock_guard<std::mutex> lock(visionMutex);
+            for (size_t k = 0; k < slots.size(); ++k) {
+                Slot& slot = slots[k];
+                const ImagePrompt& p = prompts[slot.index];
+                // Images are prefilled one after another, so the later ones wait for the earlier ones
+                auto t_prefill = std::chrono::steady_clock::now();
+                slot.sample = trace.sample;
+                slot.sample.queueMs = std::max(0.0, trace.sample.queueMs) + msBetween(t_start, t_prefill);
+                slot.sample.promptTokens = p.n_pos;
+                bool ok = vision != nullptr && !options.stopped();
+                llama_pos n_past = 0;
+                size_t n_chunks = mtmd_input_chunks_size(p.chunks);
+                for (size_t i = 0; i < n_chunks && ok; ++i) {
+                    const mtmd_input_chunk* chunk = mtmd_input_chunks_get(p.chunks, i);
+                    llama_pos new_n_past = n_past;
+                    if (p.embeddings[i].empty()) {
+                        ok = mtmd_helper_eval_chunk_single(vision, ctx, chunk, n_past, (llama_seq_id) k, n_batch,
+                                                           i + 1 == n_chunks, &new_n_past) == 0;
+                    } else {
+                        ok = mtmd_helper_decode_image_chunk(vision, ctx, chunk, const_cast<float*>(p.embeddings[i].data()),
+                                                            n_past, (llama_seq_id) k, n_batch, &new_n_past) == 0;
+                    }
+                    n_past = new_n_past;
+                }
+                if (!ok) {
+                    finish(slot, options.stopped() ? options.stopReason() : "Error: llama_decode failed");
+                    llama_memory_seq_rm(mem, (llama_seq_id) k, -1, -1);
+                    continue;
+                }
+                slot.pos = n_past;
+                slot.smpl = makeSampler(kTagGrammar);
+                llama_token id = llama_sampler_sample(slot.smpl, ctx, -1);
+                slot.first = std::chrono::steady_clock::now();
+                slot.sample.prefillMs = msBetween(t_prefill, slot.first);
+                slot.sample.ttftMs = msSince(trace.start);
+                if (!accept(slot, id)) finish(slot, std::move(slot.text));
+            }
+        }
+
+        // Then every unfinished sequence advances by one token per decode
+        while (true) {
+            batch.n_tokens = 0;
+            for (size_t k = 0; k < slots.size(); ++k) {
+                Slot& slot = slots[k];
+                slot.i_batch = -1;
+                if (slot.done) continue;
+                slot.i_batch = batch.n_tokens;
+                batch_add(batch, slot.next, slot.pos++, (llama_seq_id) k, true);
+            }
+            if (batch.n_tokens == 0) break;
+
+            bool failed = options.stopped() || llama_decode(ctx, batch) != 0;
+            for (Slot& slot : slots) {
+                if (slot.done) continue;
+                if (failed) {
+                    finish(slot, options.stopped() ? options.stopReason() : "Error: llama_decode failed");
+                } else if (!accept(slot, llama_sampler_sample(slot.smpl, ctx, slot.i_batch))) {
+                    finish(slot, std::move(slot.text));
+                }
+            }
+        }
+        for (Slot& slot : slots) {
+            if (slot.smpl) llama_sampler_free(slot.smpl);
+        }
+    }
+    clearSequences(s);
+#else
+    (void) s;
+    (void) options;
+    (void) trace;
+    for (size_t i = 0; i < prompts.size(); ++i) results[i] = prompts[i].error;
+#endif
+    return results;
+}
+
+bool LlamaEngine::canSeeImages() const
+{
+    std::lock_guard<std::mutex> lock(visionMutex);
+    return vision != nullptr;
+}
+
+std::string LlamaEngine::suggestImageTags(const std::string& filename, const ImageData& image,
+                                          const RequestOptions& options)
+{
+    if (!model) return "Error: Model not loaded";
+    if (!canSeeImages()) return "Error: No vision projector loaded";
+
+    std::string key;
+    if (cache && !image.key.empty() && !modelFingerprint.empty()) {
+        key = imageTagCacheKey(image);
+        std::string tags;
+        if (cache->lookup(key, tags)) {
+            if (options.onToken) options.onToken(tags);
+            return tags;
+        }
+    }
+
+    // Encoding the image is this request's prompt building
+    Trace trace("image");
+    std::vector<ImagePrompt> prompts(1);
+    {
+        std::lock_guard<std::mutex> lock(visionMutex);
+        if (options.stopped()) return options.stopReason();
+        auto t_prompt = std::chrono::steady_clock::now();
+        prompts[0] = prepareImagePrompt(filename, image);
+        trace.sample.tokenizeMs = msSince(t_prompt);
+    }
+
+    std::string tags;
+    auto t_wait = std::chrono::steady_clock::now();
+    LlamaContextPool::Lease lease = contexts.acquire([&options] { return options.stopped(); });
+    if (lease) {
+        trace.sample.queueMs = msSince(t_wait);
+        tags = generateImagesOn(*lease, prompts, options, trace)[0];
+    } else {
+        tags = options.stopped() ? options.stopReason() : "Error: Model not loaded";
+    }
+    freeImagePrompt(prompts[0]);
+    if (!key.empty() && !tags.empty() && tags.rfind("Error:", 0) != 0) cache->store(key, tags);
+    return tags;
+}
+
+std::vector<std::string> LlamaEngine::suggestImageTagsBatch(const std::vector<std::pair<std::string, ImageData>>& images,
+                                                            const RequestOptions& options)
+{
+    if (!model || !canSeeImages()) {
+        return std::vector<std::string>(images.size(), model ? "Error: No vision projector loaded" : "Error: Model not loaded");
+    }
+
+    std::vector<std::string> results(images.size());
+    std::vector<std::string> keys(images.size());
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (cache && !images[i].second.key.empty() && !modelFingerprint.empty()) {
+            keys[i] = imageTagCacheKey(images[i].second);
+            if (cache->lookup(keys[i], results[i])) continue;
+        }
+        todo.push_back(i);
+    }
+    if (todo.empty()) return results;
+
+    // Encoding dominates on CPU and uses every thread, so images go through it one by one
+    auto t_start = std::chrono::steady_clock::now();
+    Trace trace("image");
+    std::vector<ImagePrompt> prompts;
+    {
+        std::lock_guard<std::mutex> lock(visionMutex);
+        for (size_t i : todo) {
+            if (options.stopped()) break;
+            prompts.push_back(prepareImagePrompt(images[i].first, images[i].second));
+        }
+    }
+    trace.sample.tokenizeMs = msSince(t_start) / todo.size(); // Per image
+
+    std::vector<std::string> generated;
+    if (prompts.size() == todo.size()) {
+        auto t_wait = std::chrono::steady_clock::now();
+        LlamaContextPool::Lease lease = contexts.acquire([&options] { return options.stopped(); });
+        trace.sample.queueMs = msSince(t_wait);
+        if (lease) generated = generateImagesOn(*lease, prompts, options, trace);
+    }
+    if (generated.empty()) generated.assign(todo.size(), options.stopped() ? options.stopReason() : "Error: Model not loaded");
+    for (auto& p : prompts) freeImagePrompt(p);
+
+    for (size_t j = 0; j < todo.size(); ++j) {
+        size_t i = todo[j];
+        results[i] = generated[j];
+        if (!keys[i].empty() && !results[i].empty() && results[i].rfind("Error:", 0) != 0) {
+            cache->store(keys[i], results[i]);
+        }
+    }
+    return results;
+}
+
+bool LlamaEngine::loadEmbeddingModel(const std::string& modelPath)
+{
+    std::lock_guard<std::mutex> lock(embedMutex);
+    freeEmbedContext();
+    if (embedModel) {
+        llama_model_free(embedModel);
+        embedModel = nullptr;
+    }
+
+    llama_model_params model_params = llama_model_default_params();
+    profile.applyTo(model_params);
+    embedModel = llama_model_load_from_file(modelPath.c_str(), model_params);
+    if (!embedModel) {
+        std::cerr << "Failed to load embedding model from " << modelPath << std::endl;
+        return false;
+    }
+    embedFingerprint = FileIdentity::fingerprintFile(modelPath);
+    return true;
+}
+
+int LlamaEngine::embeddingSize() const
+{
+    const llama_model* m = embedModel ? embedModel : model;
+    return m ? llama_model_n_embd(m) : 0;
+}
+
+std::string LlamaEngine::embeddingId() const
+{
+    return "llama:" + (embedModel ? embedFingerprint : modelFingerprint);
+}
+
+bool LlamaEngine::ensureEmbedContext()
+{
+    if (embedCtx) return true;
+    llama_model* m = embedModel ? embedModel : model;
+    if (!m) return false;
+
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = kEmbedTokens * kParallelSequences;
+    params.n_batch = params.n_ctx;
+    params.n_ubatch = params.n_ctx; // A pooled sequence must not be split across ubatches
+    params.n_seq_max = kParallelSequences;
+    params.embeddings = true;
+    if (profile.threads > 0) params.n_threads = profile.threads;
+    if (profile.batchThreads > 0) params.n_threads_batch = profile.batchThreads;
+    // Embedding models carry their own pooling; chat models get mean pooling
+    params.pooling_type = embedModel ? LLAMA_POOLING_TYPE_UNSPECIFIED : LLAMA_POOLING_TYPE_MEAN;
+
+    embedCtx = llama_init_from_model(m, params);
+    if (!embedCtx) {
+        std::cerr << "Failed to create embedding context" << std::endl;
+        return false;
+    }
+    if (llama_pooling_type(embedCtx) == LLAMA_POOLING_TYPE_NONE) {
+        std::cerr << "Embedding model has no pooling, cannot embed whole texts" << std::endl;
+        freeEmbedContext();
+        return false;
+    }
+    embedTokens = llama_batch_init(params.n_ctx, 0, 1);
+    return true;
+}
+
+void LlamaEngine::freeEmbedContext()
+{
+    if (embedTokens.token) {
+        llama_batch_free(embedTokens);
+        embedTokens = {};
+    }
+    if (embedCtx) {
+        llama_free(embedCtx);
+        embedCtx = nullptr;
+    }
+}
+
+std::vector<float> LlamaEngine::embed(const std::string& text)
+{
+    return embedBatch({text}).front();
+}
+
+std::vector<std::vector<float>> LlamaEngine::embedBatch(const std::vector<std::string>& texts)
+{
+    std::lock_guard<std::mutex> lock(embedMutex);
+    std::vector<std::vector<float>> out(texts.size());
+    if (!ensureEmbedContext()) return out;
+
+    const llama_model* m = embedModel ? embedModel : model;
+    const int n_embd = llama_model_n_embd(m);
+    PromptBuilder builder(llama_model_get_vocab(m));
+    PromptBuilder::Policy policy;
+    policy.maxTokens = std::min<int>(kEmbedTokens, llama_n_ctx(embedCtx) / kParallelSequences);
+
+    // Up to kParallelSequences texts per decode, one sequence each
+    for (size_t first = 0; first < texts.size(); first += kParallelSequences) {
+        const size_t last = std::min(texts.size(), first + kParallelSequences);
+
+        llama_memory_clear(llama_get_memory(embedCtx), true);
+        embedTokens.n_tokens = 0;
+        for (size_t i = first; i < last; ++i) {
+            std::vector<llama_token> tokens = builder.build("", texts[i], "", policy);
+            for (size_t p = 0; p < tokens.size(); ++p) {
+                batch_add(embedTokens, tokens[p], p, i - first, true);
+            }
+        }
+        if (embedTokens.n_tokens == 0) continue;
+
+        if (llama_decode(embedCtx, embedTokens) != 0) {
+            std::cerr << "Failed to compute embeddings" << std::endl;
+            continue;
+        }
+
+        for (size_t i = first; i < last; ++i) {
+            const float* e = llama_get_embeddings_seq(embedCtx, i - first);
+            if (!e) continue;
+
+            std::vector<float> v(e, e + n_embd);
+            double norm = 0;
+            for (float x : v) norm += double(x) * x;
+            norm = std::sqrt(norm);
+            if (norm > 0) {
+                for (float& x : v) x = float(x / norm);
+            }
+            out[i] = std::move(v);
+        }
+    }
+    return out;
 }
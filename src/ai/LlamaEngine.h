@@ -2,23 +2,258 @@
 #define LLAMAENGINE_H
 
 #include "llama.h"
+#include "InferenceProfile.h"
+#include "InferenceCache.h"
+#include "LlamaContextPool.h"
+#include "InferenceBackend.h"
+#include "ImageEmbeddingCache.h"
+#include "InferenceTelemetry.h"
 #include <string>
 #include <vector>
+#include <mutex>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <chrono>
 
-class LlamaEngine
+struct mtmd_context;
+struct mtmd_input_chunks;
+
+// Generation calls are thread-safe: each one checks a context out of a pool
+// (InferenceProfile::contexts), so that many workers run concurrently over
+// one copy of the weights and the rest wait for a free context.
+class LlamaEngine : public InferenceBackend
 {
 public:
+    using RequestOptions = InferenceOptions;
+
     LlamaEngine();
-    ~LlamaEngine();
+    ~LlamaEngine() override;
 
-    bool loadModel(const std::string& modelPath);
+    std::string name() const override { return "llama.cpp"; }
+    bool isReady() const override { return isModelLoaded(); }
+
+    // `progress` gets 0..1 while tensors load; returning false cancels the load.
+    // May run on a worker thread as long as nothing else uses the engine meanwhile.
+    bool loadModel(const std::string& modelPath, const std::function<bool(float)>& progress = {});
+    // One tiny decode so the first real request doesn't pay for page faults and graph setup
+    bool warmUp();
     bool isModelLoaded() const { return model != nullptr; }
-    std::string generateResponse(const std::string& prompt);
-    std::string suggestTags(const std::string& filename, const std::string& content);
+    int contextCount() const { return contexts.size(); }
+    const std::string& getModelPath() const { return modelPath; }
+
+    // Applied by the next loadModel(), except draftLength, which the next generation uses
+    void setProfile(const InferenceProfile& p) { profile = p; draftLength = p.draftLength; }
+    const InferenceProfile& getProfile() const { return profile; }
+    // How the last successful loadModel() went
+    struct LoadReport {
+        InferenceProfile::MemoryEstimate estimate;
+        int contexts = 0;         // Created; fewer than the profile asks for when memory is short
+        bool f16Fallback = false; // Quantized V cache dropped: flash attention turned out unavailable
+    };
+    const LoadReport& getLoadReport() const { return loadReport; }
+    // Footprint of `p` with the loaded model, before anything is allocated; empty without a model
+    InferenceProfile::MemoryEstimate estimateMemory(const InferenceProfile& p) const;
+    int contextSize() const { return nCtx; }
+
+    // Benchmarks thread counts and ubatch sizes with the loaded model on this
+    // machine and returns the profile with the fastest stable settings. Takes
+    // a few minutes on CPU; `progress` gets one line per measurement. Does not
+    // touch the generation context, but should not run alongside generation.
+    InferenceProfile autoTune(const std::function<void(const std::string&)>& progress = {});
+    std::string generateResponse(const std::string& prompt, const RequestOptions& options = {}) override;
+    // Optional GBNF grammar (root rule "root") constrains the answer
+    std::string generateResponse(const std::vector<llama_token>& prompt, const std::string& grammar = "",
+                                 const RequestOptions& options = {});
+    // Content beyond the prefill budget is summarised chunk by chunk first when
+    // the profile's summarizeLongContent is on, otherwise sampled from its head,
+    // middle and tail
+    std::string suggestTags(const std::string& filename, const std::string& content,
+                            const RequestOptions& options = {}) override;
+
+    // Runs many prompts as parallel sequences sharing one llama_batch. Finished
+    // sequences free their slot for the next prompt (continuous batching).
+    // Results are in input order; failures are returned as "Error: ..." strings.
+    std::vector<std::string> generateBatch(const std::vector<std::string>& prompts);
+    std::vector<std::string> generateBatch(const std::vector<std::vector<llama_token>>& prompts,
+                                           const std::string& grammar = "");
+    std::vector<std::string> suggestTagsBatch(const std::vector<std::pair<std::string, std::string>>& files,
+                                              const RequestOptions& options = {}) override;
+    // Looks the answer up and tokenizes the prompt; content that needs
+    // summarising first is left for suggestPreparedTags(), which needs a context for it
+    TagRequest prepareTags(const std::string& filename, const std::string& content) override;
+    std::vector<std::string> suggestPreparedTags(const std::vector<TagRequest>& requests,
+                                                 const RequestOptions& options = {}) override;
+
+    // Tag suggestions are looked up in / stored to `cache` (not owned) when set.
+    // The key covers the content, the model file and the tag prompt, see tagCacheKey().
+    void setCache(InferenceCache* c) { cache = c; }
+    std::string tagCacheKey(const std::string& filename, const std::string& content) const;
+
+    // Every generation is recorded into `telemetry` (not owned) when set: queue
+    // wait, prompt building, prefill and decode time, time to first token.
+    // Single requests take prefill/decode from llama.cpp's perf counters, batches
+    // time each sequence, so their rates are per sequence rather than aggregate.
+    void setTelemetry(InferenceTelemetry* t) { telemetry = t; }
+
+    static constexpr int kParallelSequences = 4;
+    static constexpr int kPredictTokens = 256; // Max new tokens per answer
+
+    // Max prompt tokens for tag suggestions; file content is packed to fit,
+    // which keeps prefill time per file predictable
+    void setPrefillBudget(int tokens) { prefillBudget = tokens; }
+    int getPrefillBudget() const { return prefillBudget; }
+
+    // Embeddings for semantic search, from a dedicated embedding model if one
+    // is loaded, otherwise mean-pooled from the chat model. Unit length;
+    // empty vectors on failure. Safe to call from a worker thread.
+    bool loadEmbeddingModel(const std::string& modelPath);
+    bool canEmbed() const override { return embedModel != nullptr || model != nullptr; }
+    int embeddingSize() const override;
+    std::string embeddingId() const override; // The embedding model file, or the chat model's
+    std::vector<float> embed(const std::string& text) override;
+    std::vector<std::vector<float>> embedBatch(const std::vector<std::string>& texts) override;
+
+    static constexpr int kEmbedTokens = 512; // Per text, packed like tag prompts
+
+    // Speculative decoding: a small draft model with the same vocabulary proposes
+    // up to InferenceProfile::draftLength tokens, the main model verifies them in
+    // one batch. Output is identical to plain greedy decoding. Used by generateResponse().
+    bool loadDraftModel(const std::string& modelPath);
+    void unloadDraftModel();
+    bool hasDraftModel() const { return draftCtx != nullptr; }
+
+    // Image tagging through a multimodal projector (mmproj GGUF) matching the
+    // loaded model. Only available when built with SMARTFILE_MULTIMODAL. Images
+    // are downscaled to kMaxImageSide before encoding; encoded images are
+    // cached on disk by ImageData::key. The projector follows model reloads.
+    bool loadProjector(const std::string& mmprojPath);
+    void unloadProjector();
+    bool canSeeImages() const override;
+    std::string suggestImageTags(const std::string& filename, const ImageData& image,
+                                 const RequestOptions& options = {}) override;
+    // Encodes the cache misses one after another, then tags the images in
+    // parallel sequences of one context. Results in input order.
+    std::vector<std::string> suggestImageTagsBatch(const std::vector<std::pair<std::string, ImageData>>& images,
+                                                   const RequestOptions& options = {}) override;
+    void setImageCacheDir(const std::string& dir) { imageCache.open(dir); }
+
+    static constexpr int kMaxImageSide = 768;
+
+    struct DecodeStats {
+        uint64_t tokens = 0;   // Generated by generateResponse()
+        double seconds = 0;    // Spent generating them, prefill excluded
+        uint64_t drafted = 0;  // Draft tokens proposed
+        uint64_t accepted = 0; // ... and kept by the main model
+        double tokensPerSecond() const { return seconds > 0 ? tokens / seconds : 0; }
+        double acceptanceRate() const { return drafted ? double(accepted) / drafted : 0; }
+    };
+    DecodeStats getDecodeStats() const;
+    void resetDecodeStats();
 
 private:
+    using Session = LlamaContextPool::Session;
+
+    // A request as far as the caller got: its kind, when it arrived, and
+    // queueMs / tokenizeMs once known. The generate*On() calls complete the sample.
+    struct Trace {
+        explicit Trace(const char* kind);
+        std::chrono::steady_clock::time_point start;
+        InferenceSample sample;
+    };
+    void finishSample(InferenceSample& sample, const Trace& trace);
+
+    // The work behind the public calls, on a context the caller has leased
+    std::string generateOn(Session& s, const std::vector<llama_token>& prompt, const std::string& grammar,
+                           const RequestOptions& options, const Trace& trace);
+    std::vector<std::string> generateBatchOn(Session& session, const std::vector<std::vector<llama_token>>& prompts,
+                                             const std::string& grammar, const RequestOptions& options,
+                                             const Trace& trace);
+    // Evaluates `text` into the reserved sequence of `s`. Prompts that start with
+    // the same tokens copy its KV cells instead of prefilling them again.
+    bool cachePrefix(Session& s, const std::string& text);
+
+    int contextWorkload(int prefixTokens) const; // Auto n_ctx: kParallelSequences tag prompts next to the shared prefix
+    int promptBudget() const;    // Tag prompt tokens: the prefill budget, less when n_ctx can't batch it
+    std::vector<llama_token> buildTagPrompt(const std::string& filename, const std::string& content) const;
+    bool needsCondense(const std::string& filename, const std::string& content) const; // Content beyond the tag prompt's budget
+    // Map-reduce for long content: chunks are summarised in parallel sequences,
+    // each summary cached by its chunk's tokens, and the joined summaries take
+    // the content's place; repeated while they still don't fit. "Error: ..." on failure.
+    std::string condense(Session& s, const std::string& filename, const std::string& content,
+                         const RequestOptions& options);
+    std::vector<std::string> summarizeChunks(Session& s, const std::vector<std::vector<llama_token>>& chunks,
+                                             const RequestOptions& options);
+    llama_sampler* makeSampler(const std::string& grammar) const;
+    size_t reusablePrefix(const Session& s, const std::vector<llama_token>& tokens) const;
+    // Decodes tokens[start..] into `seq` in n_batch sized chunks using the session's batch
+    bool prefill(Session& s, const std::vector<llama_token>& tokens, size_t start, llama_seq_id seq, bool logits,
+                 const RequestOptions& options = {});
+    // Greedy continuation of a prefilled prompt, drafting with draftCtx; requires draftMutex
+    std::string speculate(Session& s, const std::vector<llama_token>& prompt_tokens, int n_predict,
+                          llama_sampler* smpl, DecodeStats& run, const RequestOptions& options);
+    void clearSequences(Session& s);
+
+    // An image tag prompt, tokenized, with the embeddings of its image chunks
+    struct ImagePrompt {
+        mtmd_input_chunks* chunks = nullptr;
+        std::vector<std::vector<float>> embeddings; // Per chunk; empty for text chunks
+        llama_pos n_pos = 0;
+        int n_tokens = 0; // KV cells; more than n_pos with M-RoPE images
+        std::string error;
+    };
+    ImagePrompt prepareImagePrompt(const std::string& filename, const ImageData& image);
+    static void freeImagePrompt(ImagePrompt& prompt);
+    std::vector<std::string> generateImagesOn(Session& s, std::vector<ImagePrompt>& prompts,
+                                              const RequestOptions& options, const Trace& trace);
+    std::string imageTagCacheKey(const ImageData& image) const;
+    bool initProjector(); // Requires visionMutex
+    void freeProjector(); // Requires visionMutex
+    void freeDraftModel(); // Requires draftMutex
+    void addStats(const DecodeStats& run);
+    bool ensureEmbedContext(); // Requires embedMutex
+    void freeEmbedContext();   // Requires embedMutex
+
+    static constexpr llama_seq_id kPrefixSeq = kParallelSequences; // After the generation sequences
+    static constexpr int kMaxChunks = 64;        // Per condense level; longer content is sampled evenly
+    static constexpr int kMaxCondenseLevels = 3;
+    static constexpr int kMinSlotBudget = 1024; // Smaller per-sequence prompts aren't worth batching
+
     struct llama_model* model = nullptr;
-    struct llama_context* ctx = nullptr;
+    LlamaContextPool contexts;
+    int nCtx = 0; // Per context
+    std::string modelPath;
+    std::string modelFingerprint; // Of the model file, for cache keys
+    InferenceCache* cache = nullptr;
+    InferenceTelemetry* telemetry = nullptr;
+    InferenceProfile profile;
+    int prefillBudget = 4096;
+    int nPrefix = 0; // Tokens of the tag system prompt, shared by all sequences through kPrefixSeq
+    LoadReport loadReport;
+
+    // One draft context; a generation that finds it busy decodes without it
+    std::mutex draftMutex;
+    struct llama_model* draftModel = nullptr;
+    struct llama_context* draftCtx = nullptr;
+    llama_batch draftBatch = {};
+    std::vector<llama_token> draftTokens; // In draftCtx's KV cache, so the next prompt reuses their common prefix
+    std::atomic<int> draftLength{5}; // From the profile; read by generations in flight
+
+    mutable std::mutex statsMutex;
+    DecodeStats stats;
+
+    // One vision encoder; encoding is serialized, decoding runs on leased contexts
+    mutable std::mutex visionMutex;
+    mtmd_context* vision = nullptr;
+    std::string projectorPath;
+    std::string projectorFingerprint;
+    ImageEmbeddingCache imageCache;
+
+    std::mutex embedMutex; // Guards everything below
+    struct llama_model* embedModel = nullptr;
+    std::string embedFingerprint;
+    struct llama_context* embedCtx = nullptr;
+    llama_batch embedTokens = {};
 };
 
 #endif // LLAMAENGINE_H
@@ -0,0 +1,137 @@
+#include "MockBackend.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <map>
+#include <thread>
+
+// Runs of ASCII letters/digits or non-ASCII bytes (whole UTF-8 characters),
+// lowercased; shorter than 3 bytes or all digits is noise
+static std::vector<std::string> words(const std::string& text)
+{
+    std::vector<std::string> out;
+    std::string word;
+    auto flush = [&] {
+        bool digits = std::all_of(word.begin(), word.end(), [](unsigned char c) { return std::isdigit(c); });
+        if (word.size() >= 3 && word.size() <= 48 && !digits) out.push_back(word);
+        word.clear();
+    };
+    for (unsigned char c : text) {
+        if (c >= 0x80 || std::isalnum(c)) word += (char) std::tolower(c);
+        else flush();
+    }
+    flush();
+    return out;
+}
+
+static uint64_t fnv1a(const std::string& s)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+bool MockBackend::deliver(const std::string& answer, const InferenceOptions& options)
+{
+    requestCount++;
+    std::vector<std::string> pieces;
+    size_t start = 0;
+    while (start < answer.size()) {
+        size_t end = answer.find(' ', start);
+        end = end == std::string::npos ? answer.size() : end + 1;
+        pieces.push_back(answer.substr(start, end - start));
+        start = end;
+    }
+
+    auto perPiece = std::chrono::milliseconds(latencyMs / std::max<size_t>(pieces.size(), 1));
+    for (const auto& piece : pieces) {
+        // Sleep in slices so cancellation is as prompt as with a real model
+        auto until = std::chrono::steady_clock::now() + perPiece;
+        while (std::chrono::steady_clock::now() < until) {
+            if (options.stopped()) return false;
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                until - std::chrono::steady_clock::now(), std::chrono::milliseconds(10)));
+        }
+        if (options.stopped()) return false;
+        if (options.onToken) options.onToken(piece);
+    }
+    return true;
+}
+
+std::string MockBackend::generateResponse(const std::string& prompt, const InferenceOptions& options)
+{
+    std::vector<std::string> w = words(prompt);
+    std::string answer = "Mock answer (" + std::to_string(prompt.size()) + " bytes)";
+    for (size_t i = 0; i < w.size() && i < 8; ++i) answer += " " + w[i];
+    return deliver(answer, options) ? answer : options.stopReason();
+}
+
+std::string MockBackend::suggestTags(const std::string& filename, const std::string& content,
+                                     const InferenceOptions& options)
+{
+    // Name words count double, they are usually the best summary
+    std::map<std::string, int> counts;
+    for (const auto& w : words(filename)) counts[w] += 2;
+    for (const auto& w : words(content)) counts[w]++;
+
+    std::vector<std::pair<std::string, int>> ranked(counts.begin(), counts.end());
+    std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    std::vector<std::string> tags;
+    size_t dot = filename.rfind('.');
+    if (dot != std::string::npos && dot + 1 < filename.size()) {
+        std::string ext = filename.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char) std::tolower(c); });
+        tags.push_back(ext);
+    }
+    for (const auto& [word, count] : ranked) {
+        if (tags.size() >= 4) break;
+        if (std::find(tags.begin(), tags.end(), word) == tags.end()) tags.push_back(word);
+    }
+    while (tags.size() < 3) tags.push_back(tags.empty() ? "未分類" : "其他" + std::to_string(tags.size()));
+
+    std::string answer;
+    for (const auto& t : tags) answer += (answer.empty() ? "" : ", ") + t;
+    return deliver(answer, options) ? answer : options.stopReason();
+}
+
+std::vector<std::string> MockBackend::suggestTagsBatch(const std::vector<std::pair<std::string, std::string>>& files,
+                                                       const InferenceOptions& options)
+{
+    std::vector<std::string> results;
+    for (const auto& [filename, content] : files) {
+        InferenceOptions each;
+        each.cancel = options.cancel;
+        each.deadline = options.deadline;
+        results.push_back(suggestTags(filename, content, each));
+    }
+    return results;
+}
+
+std::vector<float> MockBackend::embed(const std::string& text)
+{
+    // Feature hashing: each word adds +-1 to one of kDimension buckets
+    std::vector<float> v(kDimension, 0.0f);
+    for (const auto& w : words(text)) {
+        uint64_t h = fnv1a(w);
+        v[h % kDimension] += (h >> 63) ? 1.0f : -1.0f;
+    }
+    double norm = 0;
+    for (float x : v) norm += double(x) * x;
+    if (norm == 0) {
+        v[0] = 1.0f;
+        return v;
+    }
+    for (float& x : v) x = float(x / std::sqrt(norm));
+    return v;
+}
+
+std::vector<std::vector<float>> MockBackend::embedBatch(const std::vector<std::string>& texts)
+{
+    std::vector<std::vector<float>> vectors;
+    for (const auto& t : texts) vectors.push_back(embed(t));
+    return vectors;
+}
@@ -0,0 +1,43 @@
+#ifndef MOCKBACKEND_H
+#define MOCKBACKEND_H
+
+#include "InferenceBackend.h"
+#include <atomic>
+#include <chrono>
+
+// Needs no model: tags are the most frequent words of the name and content,
+// embeddings are hashed bags of words. Same input, same answer, on every
+// machine, so pipelines can be exercised and benchmarked without inference.
+// An optional latency per request makes it behave like a slow model.
+class MockBackend : public InferenceBackend
+{
+public:
+    void setLatency(std::chrono::milliseconds perRequest) { latencyMs = perRequest.count(); }
+
+    std::string name() const override { return "Mock"; }
+    bool isReady() const override { return true; }
+
+    std::string generateResponse(const std::string& prompt, const InferenceOptions& options = {}) override;
+    std::string suggestTags(const std::string& filename, const std::string& content,
+                            const InferenceOptions& options = {}) override;
+    std::vector<std::string> suggestTagsBatch(const std::vector<std::pair<std::string, std::string>>& files,
+                                              const InferenceOptions& options = {}) override;
+
+    bool canEmbed() const override { return true; }
+    int embeddingSize() const override { return kDimension; }
+    std::vector<float> embed(const std::string& text) override;
+    std::vector<std::vector<float>> embedBatch(const std::vector<std::string>& texts) override;
+
+    static constexpr int kDimension = 64;
+
+    uint64_t requests() const { return requestCount; }
+
+private:
+    std::atomic<long long> latencyMs{0};
+    std::atomic<uint64_t> requestCount{0};
+
+    // Emits `answer` word by word over the configured latency; false if stopped on the way
+    bool deliver(const std::string& answer, const InferenceOptions& options);
+};
+
+#endif // MOCKBACKEND_H
@@ -0,0 +1,109 @@
+#include "PromptBuilder.h"
+#include <algorithm>
+
+// Marks where content was left out
+static const char* kGap = "\n…\n";
+// No real token is longer than this, so presampling never starves the budget
+static constexpr size_t kMaxBytesPerToken = 16;
+
+PromptBuilder::PromptBuilder(const llama_vocab* v)
+    : vocab(v)
+{
+}
+
+std::vector<llama_token> PromptBuilder::tokenize(const llama_vocab* vocab, const std::string& text,
+                                                 bool addSpecial, bool parseSpecial)
+{
+    const int n_tokens = -llama_tokenize(vocab, text.c_str(), text.length(), NULL, 0, addSpecial, parseSpecial);
+    std::vector<llama_token> tokens(std::max(n_tokens, 0));
+    if (llama_tokenize(vocab, text.c_str(), text.length(), tokens.data(), tokens.size(), addSpecial, parseSpecial) < 0) {
+        tokens.clear();
+    }
+    return tokens;
+}
+
+// Moves a byte offset back to the start of a UTF-8 character
+static size_t utf8Floor(const std::string& s, size_t i)
+{
+    while (i > 0 && i < s.size() && (static_cast<unsigned char>(s[i]) & 0xC0) == 0x80) --i;
+    return i;
+}
+
+// Head, middle and tail of `content` in at most maxBytes, cut at character boundaries
+static std::vector<std::string> sample(const std::string& content, size_t maxBytes,
+                                       const PromptBuilder::Policy& policy)
+{
+    size_t head = utf8Floor(content, maxBytes * policy.headShare);
+    size_t tail = maxBytes * policy.tailShare;
+    size_t middle = maxBytes - head - tail;
+    size_t tailStart = utf8Floor(content, content.size() - tail);
+    size_t midStart = utf8Floor(content, (content.size() - middle) / 2);
+    size_t midEnd = utf8Floor(content, midStart + middle);
+    return {content.substr(0, head), content.substr(midStart, midEnd - midStart), content.substr(tailStart)};
+}
+
+std::string PromptBuilder::presample(const std::string& content, size_t maxBytes, const Policy& policy)
+{
+    if (content.size() <= maxBytes) return content;
+    std::vector<std::string> parts = sample(content, maxBytes, policy);
+    return parts[0] + kGap + parts[1] + kGap + parts[2];
+}
+
+std::vector<llama_token> PromptBuilder::build(const std::string& before, const std::string& content,
+                                              const std::string& after, const Policy& policy) const
+{
+    std::vector<llama_token> prompt = tokenize(vocab, before);
+    std::vector<llama_token> suffix = tokenize(vocab, after, false);
+    int available = policy.maxTokens - (int) prompt.size() - (int) suffix.size();
+    if (available < 0) return {};
+
+    // Huge content is cut into head, middle and tail by bytes first; each
+    // part is then trimmed in tokens, so the middle stays the middle of the
+    // original and not of the already sampled text
+    std::vector<std::string> parts{content};
+    size_t maxBytes = available * kMaxBytesPerToken;
+    if (content.size() > maxBytes) parts = sample(content, maxBytes, policy);
+    std::vector<std::vector<llama_token>> pieces;
+    for (const auto& part : parts) pieces.push_back(tokenize(vocab, part, false, false));
+    std::vector<llama_token> gap = tokenize(vocab, kGap, false, false);
+
+    size_t total = 0;
+    for (const auto& piece : pieces) total += piece.size();
+    if (pieces.size() > 1) total += 2 * gap.size();
+
+    if ((int) total <= available) {
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            if (i > 0) prompt.insert(prompt.end(), gap.begin(), gap.end());
+            prompt.insert(prompt.end(), pieces[i].begin(), pieces[i].end());
+        }
+    } else {
+        int budget = available - 2 * (int) gap.size();
+        if (budget <= 0) {
+            const auto& first = pieces[0];
+            prompt.insert(prompt.end(), first.begin(), first.begin() + std::min<size_t>(available, first.size()));
+        } else {
+            // One piece: head, middle and tail all come from it
+            const auto& headOf = pieces.front();
+            const auto& midOf = pieces.size() > 1 ? pieces[1] : pieces.front();
+            const auto& tailOf = pieces.back();
+            size_t head = std::min<size_t>(budget * policy.headShare, headOf.size());
+            size_t tail = std::min<size_t>(budget * policy.tailShare, tailOf.size());
+            size_t middle = std::min<size_t>(budget - head - tail, midOf.size());
+            // Centered, but never overlapping head or tail of the same piece
+            size_t n = midOf.size();
+            size_t midStart = (n - middle) / 2;
+            if (pieces.size() == 1) midStart = std::clamp(midStart, head, n - tail - middle);
+
+            prompt.insert(prompt.end(), headOf.begin(), headOf.begin() + head);
+            prompt.insert(prompt.end(), gap.begin(), gap.end());
+            if (middle > 0) {
+                prompt.insert(prompt.end(), midOf.begin() + midStart, midOf.begin() + midStart + middle);
+                prompt.insert(prompt.end(), gap.begin(), gap.end());
+            }
+            prompt.insert(prompt.end(), tailOf.end() - tail, tailOf.end());
+        }
+    }
+
+    prompt.insert(prompt.end(), suffix.begin(), suffix.end());
+    return prompt;
+}
@@ -0,0 +1,39 @@
+#ifndef PROMPTBUILDER_H
+#define PROMPTBUILDER_H
+
+#include "llama.h"
+#include <string>
+#include <vector>
+
+// Builds prompts to an exact token budget.
+// The template around the content is tokenized first and the content gets
+// whatever is left, sampled from its head, middle and tail when it is too long.
+class PromptBuilder
+{
+public:
+    struct Policy {
+        int maxTokens = 4096;   // Whole prompt, template included
+        float headShare = 0.6f; // Of the content budget; the middle gets
+        float tailShare = 0.2f; // what head and tail leave over
+    };
+
+    explicit PromptBuilder(const llama_vocab* vocab);
+
+    // before + content + after. Content is tokenized without special token
+    // parsing, so file text can never inject chat markers.
+    // Empty if the template alone does not fit in policy.maxTokens.
+    std::vector<llama_token> build(const std::string& before, const std::string& content,
+                                   const std::string& after, const Policy& policy) const;
+
+    // Empty on failure
+    static std::vector<llama_token> tokenize(const llama_vocab* vocab, const std::string& text,
+                                             bool addSpecial = true, bool parseSpecial = true);
+    // Cheap byte-level cut of huge content before tokenizing it; also the
+    // only cut for backends without a tokenizer at hand
+    static std::string presample(const std::string& content, size_t maxBytes, const Policy& policy);
+
+private:
+    const llama_vocab* vocab;
+};
+
+#endif // PROMPTBUILDER_H
@@ -0,0 +1,125 @@
+#include "TagPropagator.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <sstream>
+#include <iomanip>
+
+TagPropagator::TagPropagator(InferenceBackend& b, VectorIndex& i)
+    : backend(&b), index(i)
+{
+}
+
+std::string TagPropagator::embeddingText(const std::string& filename, const std::string& content)
+{
+    return filename + "\n" + content;
+}
+
+bool TagPropagator::vote(const std::string& key, const std::vector<float>& embedding, const TagLookup& tagsOf,
+                         Result& result) const
+{
+    if (embedding.empty() || !index.isOpen()) return false;
+
+    // Untagged neighbours do not vote, so the search widens until k tagged ones
+    // are found, the hits drop below minSimilarity or the index runs out
+    std::map<std::string, float> scores;
+    float total = 0;
+    size_t voters = 0;
+    std::set<std::string> seen; // Neighbours looked at so far, tagged or not
+    for (size_t want = options.k + 1;; want *= 2) {
+        auto hits = index.search(embedding, want, std::max<size_t>(64, want));
+        bool tooFar = false;
+        for (const auto& [neighbour, similarity] : hits) {
+            if (voters >= options.k) break;
+            if (similarity < options.minSimilarity) {
+                tooFar = true; // Best first: the rest are farther still
+                break;
+            }
+            if (neighbour == key || !seen.insert(neighbour).second) continue; // Its own old vector, or done already
+            std::vector<std::string> tags = tagsOf(neighbour);
+            if (tags.empty()) continue;
+
+            for (const auto& tag : tags) scores[tag] += similarity;
+            total += similarity;
+            ++voters;
+        }
+        if (voters >= options.k || tooFar || hits.size() < want) break;
+    }
+    if (voters < options.minNeighbours) return false;
+
+    std::vector<std::pair<std::string, float>> ranked;
+    for (const auto& [tag, score] : scores) {
+        float support = score / total;
+        if (support >= options.minSupport) ranked.push_back({tag, support});
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    if (ranked.size() > options.maxTags) ranked.resize(options.maxTags);
+    if (ranked.empty()) return false;
+
+    // Confidence: how strongly the neighbours agree on the tags we would give
+    float sum = 0;
+    std::string text;
+    for (const auto& [tag, support] : ranked) {
+        sum += support;
+        if (!text.empty()) text += ", ";
+        text += tag;
+    }
+    result.confidence = sum / ranked.size();
+    if (result.confidence < options.minConfidence) return false;
+
+    result.text = text;
+    result.propagated = true;
+    return true;
+}
+
+TagPropagator::Result TagPropagator::suggest(const std::string& key, const std::string& filename,
+                                             const std::string& content, const TagLookup& tagsOf,
+                                             const InferenceOptions& options)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start] {
+        return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    };
+
+    InferenceBackend* engine = backend;
+    Result result;
+    result.embedding = engine->embed(embeddingText(filename, content));
+    if (vote(key, result.embedding, tagsOf, result)) {
+        propagatedCount++;
+        propagateMicros += elapsed();
+        return result;
+    }
+
+    result.text = engine->suggestTags(filename, content, options);
+    generatedCount++;
+    generateMicros += elapsed();
+    return result;
+}
+
+double TagPropagator::fractionAvoided() const
+{
+    uint64_t total = propagatedCount + generatedCount;
+    return total ? double(propagatedCount) / total : 0.0;
+}
+
+double TagPropagator::speedup() const
+{
+    // Time per file now vs. if every file had taken the generation path
+    uint64_t files = propagatedCount + generatedCount;
+    if (files == 0 || generatedCount == 0) return 1.0;
+    double perGenerated = double(generateMicros) / generatedCount;
+    double actual = double(propagateMicros + generateMicros);
+    return actual > 0 ? perGenerated * files / actual : 1.0;
+}
+
+std::string TagPropagator::report() const
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(0)
+        << "LLM calls avoided: " << fractionAvoided() * 100 << "% ("
+        << propagatedCount << "/" << (propagatedCount + generatedCount) << "), "
+        << std::setprecision(1) << speedup() << "x throughput";
+    return out.str();
+}
@@ -0,0 +1,73 @@
+#ifndef TAGPROPAGATOR_H
+#define TAGPROPAGATOR_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include "InferenceBackend.h"
+#include "../core/VectorIndex.h"
+
+// Tags a file by weighted vote of its nearest already-tagged neighbours in the
+// VectorIndex, and only falls back to LLM generation (suggestTags) when the
+// neighbours are too few, too far away or disagree. Embeddings and generation
+// come from the same backend, so switching it starts a new vector space.
+class TagPropagator
+{
+public:
+    using TagLookup = std::function<std::vector<std::string>(const std::string& key)>;
+
+    struct Options {
+        size_t k = 10;               // Neighbours consulted
+        float minSimilarity = 0.75f; // Farther neighbours do not vote
+        size_t minNeighbours = 3;    // Voting neighbours needed at all
+        float minSupport = 0.5f;     // Share of the vote a tag needs
+        float minConfidence = 0.6f;  // Below this, generate instead
+        size_t maxTags = 5;
+    };
+
+    struct Result {
+        std::string text;             // Comma-separated tags, or "Error: ..."
+        std::vector<float> embedding; // For the caller to index; empty if embedding failed
+        float confidence = 0;
+        bool propagated = false;
+    };
+
+    TagPropagator(InferenceBackend& backend, VectorIndex& index);
+
+    // Used by suggest() calls that start afterwards
+    void setBackend(InferenceBackend& b) { backend = &b; }
+
+    void setOptions(const Options& opts) { options = opts; }
+    const Options& getOptions() const { return options; }
+
+    // `options` apply to the generation fallback
+    Result suggest(const std::string& key, const std::string& filename, const std::string& content,
+                   const TagLookup& tagsOf, const InferenceOptions& options = {});
+
+    // The neighbour vote of suggest() on an embedding the caller already has, e.g.
+    // from a batch. Sets result.text when the neighbours agree; not counted in the stats.
+    bool vote(const std::string& key, const std::vector<float>& embedding, const TagLookup& tagsOf,
+              Result& result) const;
+
+    // Share of files that skipped generation, and the speedup over generating every file
+    double fractionAvoided() const;
+    double speedup() const;
+    std::string report() const;
+
+    // What gets embedded for a file; the name often says as much as the content
+    static std::string embeddingText(const std::string& filename, const std::string& content);
+
+private:
+    std::atomic<InferenceBackend*> backend;
+    VectorIndex& index;
+    Options options;
+
+    std::atomic<uint64_t> propagatedCount{0};
+    std::atomic<uint64_t> generatedCount{0};
+    std::atomic<uint64_t> propagateMicros{0}; // Total time of files that were propagated
+    std::atomic<uint64_t> generateMicros{0};  // Total time of files that fell back
+
+};
+
+#endif // TAGPROPAGATOR_H
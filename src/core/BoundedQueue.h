@@ -0,0 +1,94 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Blocking FIFO with a fixed capacity between two pipeline stages. push()
+// waits while the queue is full, which is what keeps a fast stage from
+// running arbitrarily far ahead of a slow one. After close(), pushes fail and
+// pops drain what is left, then fail.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : cap(capacity ? capacity : 1) {}
+
+    // False if the queue was closed; `blocked` gets the seconds spent waiting for room
+    bool push(T item, double* blocked = nullptr)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto t0 = std::chrono::steady_clock::now();
+        notFull.wait(lock, [this] { return closed || items.size() < cap; });
+        if (blocked) *blocked += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // False once the queue is closed and empty; `idle` gets the seconds spent waiting
+    bool pop(T& item, double* idle = nullptr)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto t0 = std::chrono::steady_clock::now();
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (idle) *idle += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Takes what is there right away, up to `max`, without waiting
+    size_t popMore(std::deque<T>& out, size_t max)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t n = 0;
+        while (n < max && !items.empty()) {
+            out.push_back(std::move(items.front()));
+            items.pop_front();
+            n++;
+        }
+        if (n) notFull.notify_all();
+        return n;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    // Drops everything queued, e.g. on cancel; closes too
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.clear();
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    }
+    size_t capacity() const { return cap; }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> items;
+    size_t cap;
+    bool closed = false;
+};
+
+#endif // BOUNDEDQUEUE_H
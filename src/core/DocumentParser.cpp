@@ -4,7 +4,11 @@
 #include <QFileInfo>
 #include <QXmlStreamReader>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <set>
 
 namespace fs = std::filesystem;
 
@@ -30,6 +34,28 @@ std::string DocumentParser::extractText(const std::string& filePath)
     return "";
 }
 
+std::string DocumentParser::extractContent(const std::string& filePath)
+{
+    std::string ext = fs::path(filePath).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    static const std::set<std::string> textExts = {
+        ".txt", ".md", ".log", ".tex", ".rtf",
+        ".cpp", ".h", ".c", ".hpp", ".cs", ".java", ".py", ".js", ".ts",
+        ".html", ".css", ".json", ".xml", ".yaml", ".yml", ".ini", ".conf", ".env",
+        ".bat", ".sh", ".ps1", ".go", ".rs", ".lua", ".sql", ".php"
+    };
+
+    if (textExts.count(ext)) {
+        std::ifstream f(filePath, std::ios::binary);
+        if (!f.is_open()) return "";
+        std::stringstream buffer;
+        buffer << f.rdbuf(); // Read full content
+        return buffer.str();
+    }
+    return extractText(filePath);
+}
+
 
 
 // Helper to unzip specific file from archive to string
@@ -8,6 +8,9 @@ class DocumentParser
 {
 public:
     static std::string extractText(const std::string& filePath);
+    // Text the AI sees: plain text/code files as-is, documents via extractText(),
+    // empty for everything else
+    static std::string extractContent(const std::string& filePath);
 
 private:
     static std::string parsDocx(const std::string& filePath);
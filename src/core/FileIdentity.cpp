@@ -0,0 +1,130 @@
+#include "FileIdentity.h"
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static constexpr std::streamoff kSampleBytes = 64 * 1024;
+
+// FNV-1a, 64-bit
+static void fnv1a(uint64_t& h, const char* data, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ULL;
+    }
+}
+
+static std::string toHex(uint64_t h) {
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(h));
+    return hex;
+}
+
+FileIdentity FileIdentity::stat(const std::string& path)
+{
+    FileIdentity id;
+    std::error_code ec;
+    fs::path p(path);
+
+    id.size = fs::file_size(p, ec);
+    if (ec) id.size = 0;
+    auto mtime = fs::last_write_time(p, ec);
+    if (!ec) id.mtime = mtime.time_since_epoch().count();
+
+#ifdef _WIN32
+    HANDLE h = CreateFileW(p.wstring().c_str(), 0,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (h != INVALID_HANDLE_VALUE) {
+        BY_HANDLE_FILE_INFORMATION info;
+        if (GetFileInformationByHandle(h, &info)) {
+            id.device = info.dwVolumeSerialNumber;
+            id.inode = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+        }
+        CloseHandle(h);
+    }
+#else
+    struct ::stat st;
+    if (::stat(path.c_str(), &st) == 0) {
+        id.device = static_cast<uint64_t>(st.st_dev);
+        id.inode = static_cast<uint64_t>(st.st_ino);
+    }
+#endif
+    return id;
+}
+
+FileIdentity FileIdentity::of(const std::string& path)
+{
+    FileIdentity id = stat(path);
+    id.fingerprint = fingerprintFile(path);
+    return id;
+}
+
+std::string FileIdentity::fingerprintFile(const std::string& path)
+{
+    std::ifstream f(fs::path(path), std::ios::binary);
+    if (!f.is_open()) return "";
+
+    f.seekg(0, std::ios::end);
+    std::streamoff size = f.tellg();
+    if (size < 0) return "";
+    f.seekg(0, std::ios::beg);
+
+    uint64_t h = 14695981039346656037ULL;
+    uint64_t size64 = static_cast<uint64_t>(size);
+    fnv1a(h, reinterpret_cast<const char*>(&size64), sizeof(size64));
+
+    std::vector<char> buf(kSampleBytes);
+    f.read(buf.data(), std::min(size, kSampleBytes));
+    fnv1a(h, buf.data(), static_cast<size_t>(f.gcount()));
+
+    if (size > kSampleBytes) {
+        std::streamoff tailStart = std::max(kSampleBytes, size - kSampleBytes);
+        f.seekg(tailStart, std::ios::beg);
+        f.read(buf.data(), size - tailStart);
+        fnv1a(h, buf.data(), static_cast<size_t>(f.gcount()));
+    }
+    if (f.bad()) return "";
+
+    return toHex(h);
+}
+
+std::string FileIdentity::fingerprintData(const std::string& data)
+{
+    uint64_t h = 14695981039346656037ULL;
+    uint64_t size64 = data.size();
+    fnv1a(h, reinterpret_cast<const char*>(&size64), sizeof(size64));
+    fnv1a(h, data.data(), data.size());
+    return toHex(h);
+}
+
+nlohmann::json FileIdentity::toJson() const
+{
+    nlohmann::json j;
+    j["dev"] = device;
+    j["ino"] = inode;
+    j["size"] = size;
+    j["mtime"] = mtime;
+    if (!fingerprint.empty()) j["hash"] = fingerprint;
+    return j;
+}
+
+FileIdentity FileIdentity::fromJson(const nlohmann::json& j)
+{
+    FileIdentity id;
+    id.device = j.value("dev", uint64_t(0));
+    id.inode = j.value("ino", uint64_t(0));
+    id.size = j.value("size", uint64_t(0));
+    id.mtime = j.value("mtime", int64_t(0));
+    id.fingerprint = j.value("hash", std::string());
+    return id;
+}
@@ -0,0 +1,37 @@
+#ifndef FILEIDENTITY_H
+#define FILEIDENTITY_H
+
+#include <string>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+// Stable identity of a file on disk, used to recognise a file after it has
+// been renamed or moved. device/inode survive moves within one volume; the
+// content fingerprint covers copies and moves across volumes.
+struct FileIdentity
+{
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::string fingerprint; // Empty until computed
+
+    bool hasInode() const { return device != 0 || inode != 0; }
+    bool sameInode(const FileIdentity& other) const {
+        return hasInode() && device == other.device && inode == other.inode;
+    }
+
+    // Cheap: one stat, no content read
+    static FileIdentity stat(const std::string& path);
+    // stat() plus the content fingerprint
+    static FileIdentity of(const std::string& path);
+    // Hash of the size plus the first and last 64 KiB; empty on read errors
+    static std::string fingerprintFile(const std::string& path);
+    // Hash of all of `data`, same format as fingerprintFile()
+    static std::string fingerprintData(const std::string& data);
+
+    nlohmann::json toJson() const;
+    static FileIdentity fromJson(const nlohmann::json& j);
+};
+
+#endif // FILEIDENTITY_H
@@ -0,0 +1,75 @@
+#include "ImageLoader.h"
+#include <QImage>
+#include <QImageReader>
+#include <QString>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <set>
+
+bool ImageLoader::isImage(const std::string& path)
+{
+    static const std::set<std::string> exts = {".jpg", ".jpeg", ".png", ".bmp", ".gif", ".webp", ".tif", ".tiff"};
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return exts.count(ext) > 0;
+}
+
+bool ImageLoader::load(const std::string& path, int maxSide, ImageData& out)
+{
+    QImageReader reader(QString::fromStdString(path));
+    reader.setAutoTransform(true);
+    QSize size = reader.size();
+    if (size.isValid() && std::max(size.width(), size.height()) > maxSide) {
+        reader.setScaledSize(size.scaled(maxSide, maxSide, Qt::KeepAspectRatio));
+    }
+    QImage image = reader.read();
+    if (image.isNull()) return false;
+    image = image.convertToFormat(QImage::Format_RGB888);
+
+    out.width = image.width();
+    out.height = image.height();
+    out.rgb.resize(size_t(out.width) * out.height * 3);
+    for (int y = 0; y < out.height; ++y) {
+        std::memcpy(out.rgb.data() + size_t(y) * out.width * 3, image.constScanLine(y), size_t(out.width) * 3);
+    }
+    // Readers that can't scale while decoding
+    downscale(out, maxSide);
+    return true;
+}
+
+void ImageLoader::downscale(ImageData& image, int maxSide)
+{
+    if (image.empty() || std::max(image.width, image.height) <= maxSide) return;
+
+    double scale = double(maxSide) / std::max(image.width, image.height);
+    int w = std::max(1, int(image.width * scale));
+    int h = std::max(1, int(image.height * scale));
+    std::vector<unsigned char> rgb(size_t(w) * h * 3);
+
+    // Each target pixel averages the source pixels it covers
+    for (int y = 0; y < h; ++y) {
+        int y0 = int(int64_t(y) * image.height / h);
+        int y1 = std::max(y0 + 1, int(int64_t(y + 1) * image.height / h));
+        for (int x = 0; x < w; ++x) {
+            int x0 = int(int64_t(x) * image.width / w);
+            int x1 = std::max(x0 + 1, int(int64_t(x + 1) * image.width / w));
+            uint32_t sum[3] = {0, 0, 0};
+            for (int sy = y0; sy < y1; ++sy) {
+                const unsigned char* row = image.rgb.data() + (size_t(sy) * image.width + x0) * 3;
+                for (int sx = x0; sx < x1; ++sx, row += 3) {
+                    sum[0] += row[0];
+                    sum[1] += row[1];
+                    sum[2] += row[2];
+                }
+            }
+            uint32_t n = uint32_t(y1 - y0) * (x1 - x0);
+            unsigned char* dst = rgb.data() + (size_t(y) * w + x) * 3;
+            for (int c = 0; c < 3; ++c) dst[c] = (unsigned char) ((sum[c] + n / 2) / n);
+        }
+    }
+    image.width = w;
+    image.height = h;
+    image.rgb = std::move(rgb);
+}
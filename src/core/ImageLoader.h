@@ -0,0 +1,32 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <string>
+#include <vector>
+
+// Decoded pixels, 8-bit RGB, rows top to bottom without padding
+struct ImageData
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgb;
+    std::string key; // Identifies the content for caches (e.g. a file fingerprint); empty: not cached
+
+    bool empty() const { return width <= 0 || height <= 0 || rgb.empty(); }
+};
+
+class ImageLoader
+{
+public:
+    static bool isImage(const std::string& path); // By extension
+
+    // Decodes `path` at no more than maxSide pixels on the longer side. JPEGs
+    // are decoded at reduced scale directly, which is much cheaper than
+    // decoding at full size and scaling afterwards. EXIF rotation is applied.
+    static bool load(const std::string& path, int maxSide, ImageData& out);
+
+    // Box-filter downscale so that the longer side is at most maxSide
+    static void downscale(ImageData& image, int maxSide);
+};
+
+#endif // IMAGELOADER_H
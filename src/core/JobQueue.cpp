@@ -0,0 +1,461 @@
+#include "JobQueue.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+static const char* kSnapshot = "jobs.jsonl";
+static const char* kJournal = "jobs.journal";
+
+const char* JobQueue::stateName(State state)
+{
+    static const char* names[] = {"pending", "running", "done", "failed", "gone"};
+    return state >= Pending && state <= Gone ? names[state] : "";
+}
+
+static JobQueue::State stateFromName(const std::string& name)
+{
+    for (int s = JobQueue::Pending; s <= JobQueue::Gone; ++s) {
+        if (name == JobQueue::stateName(JobQueue::State(s))) return JobQueue::State(s);
+    }
+    return JobQueue::Pending;
+}
+
+// Calls `fn` for every line of a snapshot or journal. A torn last line from a
+// crash mid-append is skipped; so is anything else that does not parse.
+static size_t readLines(const std::string& file, const std::function<void(const nlohmann::json&)>& fn)
+{
+    std::ifstream f(file, std::ios::binary);
+    size_t n = 0;
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.empty()) continue;
+        n++;
+        nlohmann::json j = nlohmann::json::parse(line, nullptr, false);
+        if (j.is_object() && j.contains("p")) fn(j);
+    }
+    return n;
+}
+
+int64_t JobQueue::nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+JobQueue::~JobQueue()
+{
+    close();
+}
+
+bool JobQueue::open(const std::string& root)
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    rootDir = root;
+    auto apply = [this](const nlohmann::json& j) {
+        std::string path = j.value("p", "");
+        auto it = byPath.find(path);
+        if (it == byPath.end()) {
+            it = byPath.emplace(path, uint32_t(entries.size())).first;
+            entries.emplace_back();
+            entries.back().path = path;
+        }
+        Entry& e = entries[it->second];
+        e.state = stateFromName(j.value("s", ""));
+        e.attempts = j.value("a", 0);
+        e.notBefore = j.value("t", int64_t(0));
+        e.error = j.value("e", "");
+    };
+    try {
+        readLines(dir() + "/" + kSnapshot, apply);
+        journalLines = readLines(dir() + "/" + kJournal, apply);
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading jobs of " << root << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].state == Running) entries[i].state = Pending; // Cut off by a crash
+        if (entries[i].state == Pending) enqueue(i);
+    }
+    return true;
+}
+
+void JobQueue::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rootDir.empty()) return;
+    if (!unsynced.empty()) writeJournal(unsynced);
+    rootDir.clear();
+    entries.clear();
+    byPath.clear();
+    ready.clear();
+    delayed.clear();
+    for (auto& b : boosted) b.clear();
+    unsynced.clear();
+    journalLines = 0;
+    running = 0;
+    nextDispatch = 0;
+    changed.notify_all();
+}
+
+bool JobQueue::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !rootDir.empty();
+}
+
+std::string JobQueue::root() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return rootDir;
+}
+
+std::string JobQueue::dir() const
+{
+    return (fs::path(rootDir) / ".smartfile").string();
+}
+
+std::string JobQueue::relative(const std::string& path) const
+{
+    return fs::path(path).lexically_normal().lexically_relative(fs::path(rootDir).lexically_normal()).generic_string();
+}
+
+std::string JobQueue::absolute(const std::string& rel) const
+{
+    return (fs::path(rootDir) / fs::path(rel)).make_preferred().string();
+}
+
+void JobQueue::enqueue(uint32_t index)
+{
+    const Entry& e = entries[index];
+    if (e.notBefore > nowMs()) {
+        delayed.insert({e.notBefore, index});
+    } else {
+        ready.insert({-int(e.priority), index});
+    }
+}
+
+void JobQueue::dequeue(uint32_t index)
+{
+    const Entry& e = entries[index];
+    ready.erase({-int(e.priority), index});
+    delayed.erase({e.notBefore, index});
+}
+
+std::string JobQueue::line(const Entry& e)
+{
+    // In-flight is not worth a line: a restart puts those files back to pending anyway
+    nlohmann::json j = {{"p", e.path}, {"s", stateName(e.state == Running ? Pending : e.state)}, {"a", e.attempts}};
+    if (e.notBefore) j["t"] = e.notBefore;
+    if (!e.error.empty()) j["e"] = e.error;
+    return j.dump();
+}
+
+void JobQueue::record(const Entry& e)
+{
+    unsynced.push_back(line(e));
+}
+
+size_t JobQueue::add(const std::vector<std::string>& paths)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rootDir.empty()) return 0;
+    size_t added = 0;
+    std::vector<std::string> lines;
+    for (const auto& path : paths) {
+        std::string rel = relative(path);
+        if (rel.empty() || byPath.count(rel)) continue;
+        uint32_t index = uint32_t(entries.size());
+        byPath.emplace(rel, index);
+        entries.emplace_back();
+        entries.back().path = rel;
+        enqueue(index);
+        lines.push_back(line(entries.back()));
+        added++;
+    }
+    // Nothing to make durable first, so new files go to the journal right away
+    if (added) {
+        writeJournal(lines);
+        changed.notify_all();
+    }
+    return added;
+}
+
+bool JobQueue::next(std::string& path)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        if (stopped || rootDir.empty()) return false;
+
+        int64_t now = nowMs();
+        while (!delayed.empty() && delayed.begin()->first <= now) {
+            uint32_t index = delayed.begin()->second;
+            delayed.erase(delayed.begin());
+            ready.insert({-int(entries[index].priority), index});
+        }
+        // Files in flight may still fail and come back, so they keep the job open
+        if (ready.empty() && delayed.empty() && running == 0) return false;
+
+        int64_t wakeAt = delayed.empty() ? 0 : delayed.begin()->first;
+        if (!paused && !ready.empty()) {
+            if (rateLimit > 0 && now < nextDispatch) {
+                wakeAt = nextDispatch;
+            } else {
+                uint32_t index = ready.begin()->second;
+                ready.erase(ready.begin());
+                Entry& e = entries[index];
+                std::string full = absolute(e.path);
+                std::error_code ec;
+                if (!fs::exists(full, ec)) {
+                    e.state = Gone;
+                    record(e);
+                    continue;
+                }
+                e.state = Running;
+                running++;
+                if (rateLimit > 0) nextDispatch = now + int64_t(60000.0 / rateLimit);
+                path = full;
+                return true;
+            }
+        }
+
+        if (paused || wakeAt == 0) {
+            changed.wait(lock);
+        } else {
+            changed.wait_until(lock, std::chrono::system_clock::time_point(std::chrono::milliseconds(wakeAt)));
+        }
+    }
+}
+
+void JobQueue::complete(const std::string& path, const std::string& result)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = byPath.find(relative(path));
+    if (it == byPath.end()) return;
+    uint32_t index = it->second;
+    Entry& e = entries[index];
+    if (e.state == Running) {
+        running--;
+    } else if (e.state == Pending) {
+        dequeue(index); // Requeued by stop() while it was in flight
+    } else {
+        return;
+    }
+
+    if (result == "Error: Cancelled") {
+        // Not the file's fault; the journal already has it as pending
+        e.state = Pending;
+        enqueue(index);
+    } else if (!result.empty() && result.rfind("Error:", 0) != 0) {
+        e.state = Done;
+        e.error.clear();
+        e.notBefore = 0;
+        record(e);
+    } else {
+        e.attempts++;
+        e.error = result.empty() ? "Error: Empty result" : result;
+        if (e.attempts >= kMaxAttempts) {
+            e.state = Failed;
+            e.notBefore = 0;
+        } else {
+            e.state = Pending;
+            e.notBefore = nowMs() + std::min(kMaxRetryDelayMs, kRetryDelayMs << (e.attempts - 1));
+            enqueue(index);
+        }
+        record(e);
+    }
+    changed.notify_all();
+}
+
+void JobQueue::start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = false;
+    changed.notify_all();
+}
+
+void JobQueue::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    for (uint32_t i = 0; i < entries.size() && running > 0; ++i) {
+        if (entries[i].state != Running) continue;
+        entries[i].state = Pending;
+        enqueue(i);
+        running--;
+    }
+    running = 0;
+    changed.notify_all();
+}
+
+void JobQueue::setPaused(bool p)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    paused = p;
+    changed.notify_all();
+}
+
+bool JobQueue::isPaused() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return paused;
+}
+
+void JobQueue::setRateLimit(double filesPerMinute)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    rateLimit = std::max(0.0, filesPerMinute);
+    nextDispatch = 0;
+    changed.notify_all();
+}
+
+void JobQueue::prioritize(const std::vector<std::string>& paths, Priority priority)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (priority < Background || priority >= PriorityCount) return;
+
+    // The priority lives in the ready key, so pending files are taken out and put back
+    auto setPriority = [this](uint32_t index, Priority p) {
+        Entry& e = entries[index];
+        if (e.state == Pending) dequeue(index);
+        e.priority = p;
+        if (e.state == Pending) enqueue(index);
+    };
+    for (uint32_t index : boosted[priority]) {
+        if (entries[index].priority == priority) setPriority(index, Background);
+    }
+    boosted[priority].clear();
+    if (priority == Background) return;
+
+    for (const auto& path : paths) {
+        auto it = byPath.find(relative(path));
+        if (it == byPath.end()) continue;
+        // A selected file that is also visible stays selected
+        if (entries[it->second].priority < priority) setPriority(it->second, priority);
+        boosted[priority].push_back(it->second);
+    }
+    changed.notify_all();
+}
+
+void JobQueue::retryFailed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t i = 0; i < entries.size(); ++i) {
+        Entry& e = entries[i];
+        if (e.state != Failed) continue;
+        e.state = Pending;
+        e.attempts = 0;
+        e.notBefore = 0;
+        enqueue(i);
+        record(e);
+    }
+    changed.notify_all();
+}
+
+JobQueue::State JobQueue::state(const std::string& path) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = byPath.find(relative(path));
+    return it == byPath.end() ? Pending : entries[it->second].state;
+}
+
+JobQueue::Counts JobQueue::counts() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Counts c;
+    for (const auto& e : entries) {
+        switch (e.state) {
+        case Pending: c.pending++; break;
+        case Running: c.running++; break;
+        case Done: c.done++; break;
+        case Failed: c.failed++; break;
+        case Gone: c.gone++; break;
+        }
+    }
+    c.waiting = delayed.size();
+    return c;
+}
+
+void JobQueue::sync(const std::function<void()>& barrier)
+{
+    std::vector<std::string> lines;
+    std::string from;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lines.swap(unsynced);
+        from = rootDir;
+    }
+    if (lines.empty()) return;
+    if (barrier) barrier();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rootDir != from) return; // Closed meanwhile; close() had nothing of these to write
+    writeJournal(lines);
+    if (journalLines > std::max<size_t>(4096, entries.size())) compact();
+}
+
+void JobQueue::writeJournal(const std::vector<std::string>& lines)
+{
+    try {
+        fs::create_directories(dir());
+        std::ofstream f(dir() + "/" + kJournal, std::ios::binary | std::ios::app);
+        for (const auto& line : lines) f << line << '\n';
+        f.flush();
+        if (!f) {
+            std::cerr << "Error writing job journal in " << dir() << std::endl;
+            return;
+        }
+        journalLines += lines.size();
+    } catch (const std::exception& e) {
+        std::cerr << "Error writing job journal: " << e.what() << std::endl;
+    }
+}
+
+// Folds the journal into the snapshot. Works from the files rather than from
+// memory: entries may hold results whose tags are not durable yet.
+void JobQueue::compact()
+{
+    std::vector<nlohmann::json> latest;
+    std::unordered_map<std::string, size_t> where;
+    auto fold = [&](const nlohmann::json& j) {
+        std::string path = j.value("p", "");
+        auto it = where.find(path);
+        if (it == where.end()) {
+            where.emplace(path, latest.size());
+            latest.push_back(j);
+        } else {
+            latest[it->second] = j;
+        }
+    };
+
+    try {
+        std::string snapshot = dir() + "/" + kSnapshot;
+        readLines(snapshot, fold);
+        readLines(dir() + "/" + kJournal, fold);
+
+        // Same temp file + rename as the other metadata; replaying the old
+        // journal over the new snapshot after a crash in between is harmless
+        std::string tmp = snapshot + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            for (const auto& j : latest) f << j.dump() << '\n';
+            f.flush();
+            if (!f) {
+                std::cerr << "Error compacting job journal: write failed for " << tmp << std::endl;
+                return;
+            }
+        }
+        fs::rename(tmp, snapshot);
+        std::ofstream(dir() + "/" + kJournal, std::ios::binary | std::ios::trunc);
+        journalLines = 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error compacting job journal: " << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+// Durable per-file work list for bulk analysis, kept in <root>/.smartfile/.
+// jobs.jsonl is a snapshot with one line per file; jobs.journal gets one line
+// per state change on top of it and is folded back into the snapshot once it
+// grows, so a 100k-file job costs a short append per file instead of a full
+// rewrite. Loading replays both, which is how a job resumes after a restart
+// or crash: finished files stay finished, files that were in flight go back
+// to pending.
+//
+// next() hands out files highest priority first (the selected file, then the
+// visible ones, then the rest in scan order), holds back failed files until
+// their retry time and paces everything to the rate limit.
+class JobQueue
+{
+public:
+    enum State { Pending, Running, Done, Failed, Gone };
+    enum Priority { Background, Visible, Selected, PriorityCount };
+    static const char* stateName(State state);
+
+    struct Counts {
+        size_t pending = 0;  // Including the ones waiting to be retried
+        size_t waiting = 0;  // Failed before, retried later
+        size_t running = 0;
+        size_t done = 0;
+        size_t failed = 0;   // Out of attempts
+        size_t gone = 0;     // Deleted before their turn
+        size_t remaining() const { return pending + running; }
+        size_t total() const { return pending + running + done + failed + gone; }
+    };
+
+    static constexpr int kMaxAttempts = 4;
+    static constexpr int64_t kRetryDelayMs = 30 * 1000;        // Doubles with every failed attempt
+    static constexpr int64_t kMaxRetryDelayMs = 60 * 60 * 1000;
+
+    JobQueue() = default;
+    ~JobQueue();
+    JobQueue(const JobQueue&) = delete;
+    JobQueue& operator=(const JobQueue&) = delete;
+
+    // Loads the job of `root`, if there is one; the files are created on the first change
+    bool open(const std::string& root);
+    void close(); // Writes what is left to the journal, without a barrier
+    bool isOpen() const;
+    std::string root() const;
+
+    // Queues files (full paths) that are new to the job; known ones keep their state. Returns how many were new.
+    size_t add(const std::vector<std::string>& paths);
+
+    // Next file to work on (full path); blocks while paused, rate limited or
+    // waiting for retries and files in flight. False once nothing is left or after stop().
+    bool next(std::string& path);
+    // Result of a file handed out by next(): tags, or "Error: ..." to retry later.
+    // Cancelled files go back to pending without using up an attempt.
+    void complete(const std::string& path, const std::string& result);
+
+    void start(); // Lets next() hand out files again after stop()
+    void stop();  // Wakes next() with false; files in flight go back to pending
+    void setPaused(bool paused);
+    bool isPaused() const;
+    void setRateLimit(double filesPerMinute); // 0 for no limit
+    // Raises `paths` to `priority`; files that had it before drop back to Background
+    void prioritize(const std::vector<std::string>& paths, Priority priority);
+    void retryFailed(); // Failed files get a fresh set of attempts
+
+    State state(const std::string& path) const; // Pending for files the job does not know
+    Counts counts() const;
+
+    // Appends the changes since the last sync to the journal. `barrier` runs
+    // first and must make the results themselves durable (e.g. flush the
+    // tags), so the journal never claims a file is done before its tags are on disk.
+    void sync(const std::function<void()>& barrier = {});
+
+private:
+    struct Entry {
+        std::string path;       // Relative to the root, '/' separated
+        State state = Pending;
+        Priority priority = Background;
+        int attempts = 0;
+        int64_t notBefore = 0;  // Retry time, ms since the epoch
+        std::string error;      // Last one
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::string rootDir;
+    std::vector<Entry> entries;                        // In the order they were added
+    std::unordered_map<std::string, uint32_t> byPath;
+    std::set<std::pair<int, uint32_t>> ready;          // (-priority, index) of pending files due now
+    std::set<std::pair<int64_t, uint32_t>> delayed;    // (notBefore, index) of pending files due later
+    std::vector<uint32_t> boosted[PriorityCount];      // Files raised by prioritize(), per level
+    std::vector<std::string> unsynced;                 // Journal lines not written yet
+    size_t journalLines = 0;
+    size_t running = 0;
+    bool paused = false;
+    bool stopped = false;
+    double rateLimit = 0;
+    int64_t nextDispatch = 0;
+
+    std::string relative(const std::string& path) const;
+    std::string absolute(const std::string& rel) const;
+    std::string dir() const;
+    void enqueue(uint32_t index);  // Into ready or delayed, by notBefore
+    void dequeue(uint32_t index);
+    static std::string line(const Entry& e); // As stored in the snapshot and the journal
+    void record(const Entry& e);   // Queues a journal line for the next sync()
+    void writeJournal(const std::vector<std::string>& lines);
+    void compact();
+    static int64_t nowMs();
+};
+
+#endif // JOBQUEUE_H
@@ -0,0 +1,119 @@
+#include "MetadataWriter.h"
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace fs = std::filesystem;
+
+MetadataWriter::MetadataWriter(std::chrono::milliseconds idle, std::chrono::milliseconds maxWait)
+    : idleDelay(idle), maxDelay(maxWait)
+{
+    worker = std::thread(&MetadataWriter::run, this);
+}
+
+MetadataWriter::~MetadataWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void MetadataWriter::schedule(const std::string& path, Document data)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (pending.empty()) firstDirty = now;
+        lastDirty = now;
+        pending[path] = std::move(data); // Older versions of this file are simply dropped
+        scheduledGeneration++;
+    }
+    wake.notify_all();
+}
+
+void MetadataWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t target = scheduledGeneration;
+    if (writtenGeneration >= target) return;
+
+    flushRequested = std::max(flushRequested, target);
+    wake.notify_all();
+    written.wait(lock, [&] { return writtenGeneration >= target; });
+}
+
+void MetadataWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&] { return stopping || !pending.empty(); });
+
+        // Coalesce: wait until edits pause, unless someone needs the data now
+        while (!pending.empty() && !stopping && flushRequested <= writtenGeneration) {
+            auto deadline = std::min(lastDirty + idleDelay, firstDirty + maxDelay);
+            if (std::chrono::steady_clock::now() >= deadline) break;
+            wake.wait_until(lock, deadline);
+        }
+
+        if (pending.empty()) {
+            if (stopping) return;
+            continue;
+        }
+
+        std::map<std::string, Document> batch;
+        batch.swap(pending);
+        uint64_t generation = scheduledGeneration;
+
+        lock.unlock();
+        for (const auto& [path, data] : batch) {
+            writeFile(path, *data);
+        }
+        lock.lock();
+
+        writtenGeneration = generation;
+        written.notify_all();
+    }
+}
+
+void MetadataWriter::writeFile(const std::string& path, const nlohmann::json& data)
+{
+    fs::path target(path);
+    fs::path dir = target.parent_path();
+
+    try {
+        if (!dir.empty() && !fs::exists(dir)) {
+            fs::create_directories(dir);
+#ifdef _WIN32
+            // Keep .smartfile folders out of Explorer like other dot-folders
+            if (dir.filename().string().rfind('.', 0) == 0) {
+                SetFileAttributesW(dir.wstring().c_str(), FILE_ATTRIBUTE_HIDDEN);
+            }
+#endif
+        }
+
+        // Write a sibling temp file and rename it over the target so a crash
+        // mid-write never leaves a truncated metadata file behind
+        fs::path tmp = target;
+        tmp += ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            f << data.dump(4);
+            f.flush();
+            if (!f) {
+                std::cerr << "Error saving metadata: write failed for " << tmp.string() << std::endl;
+                return;
+            }
+        }
+        fs::rename(tmp, target);
+    } catch (const std::exception& e) {
+        std::cerr << "Error saving metadata: " << e.what() << std::endl;
+    }
+}
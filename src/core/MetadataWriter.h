@@ -0,0 +1,52 @@
+#ifndef METADATAWRITER_H
+#define METADATAWRITER_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <nlohmann/json.hpp>
+
+// Write-behind persistence for JSON metadata files.
+// schedule() only records the latest document for a path; a background thread
+// coalesces bursts of edits and writes them once the caller has been idle for
+// idleDelay (or at most maxDelay after the first edit), via temp file + rename.
+class MetadataWriter
+{
+public:
+    using Document = std::shared_ptr<const nlohmann::json>;
+
+    MetadataWriter(std::chrono::milliseconds idleDelay = std::chrono::milliseconds(500),
+                   std::chrono::milliseconds maxDelay = std::chrono::milliseconds(5000));
+    ~MetadataWriter(); // Flushes everything still pending
+
+    void schedule(const std::string& path, Document data);
+
+    // Durability barrier: returns once everything scheduled before the call is on disk
+    void flush();
+
+private:
+    std::chrono::milliseconds idleDelay;
+    std::chrono::milliseconds maxDelay;
+
+    std::mutex mutex;
+    std::condition_variable wake;     // Signals the writer thread
+    std::condition_variable written;  // Signals flush() waiters
+    std::map<std::string, Document> pending;
+    uint64_t scheduledGeneration = 0;
+    uint64_t writtenGeneration = 0;
+    uint64_t flushRequested = 0;
+    std::chrono::steady_clock::time_point firstDirty;
+    std::chrono::steady_clock::time_point lastDirty;
+    bool stopping = false;
+
+    std::thread worker;
+
+    void run();
+    static void writeFile(const std::string& path, const nlohmann::json& data);
+};
+
+#endif // METADATAWRITER_H
@@ -3,139 +3,431 @@
 #include <filesystem>
 #include <iostream>
 #include <set>
-
-#ifdef _WIN32
-#include <windows.h>
-#endif
+#include <map>
 
 namespace fs = std::filesystem;
 
+// v1: { "<filename>": [tags] }
+// v2: { "version": 2, "files": { "<relative/path>": { "tags": [...], "id": {FileIdentity} } } }
+static constexpr int kMetadataVersion = 2;
+
+static nlohmann::json emptyMetadata() {
+    return { {"version", kMetadataVersion}, {"files", nlohmann::json::object()} };
+}
+
+// v1 only knew the bare filename, so entries stay keyed by it and are marked
+// legacy; reconcile() moves them to the real relative path once it sees the file.
+static nlohmann::json migrate(const nlohmann::json& doc) {
+    if (doc.is_object() && doc.value("version", 0) >= kMetadataVersion && doc.contains("files")) {
+        return doc;
+    }
+
+    nlohmann::json out = emptyMetadata();
+    if (!doc.is_object()) return out;
+    for (auto& element : doc.items()) {
+        if (element.value().is_array()) {
+            out["files"][element.key()] = { {"tags", element.value()}, {"legacy", true} };
+        }
+    }
+    return out;
+}
+
+static const nlohmann::json& filesOf(const nlohmann::json& doc) {
+    return doc.at("files");
+}
+
+static const nlohmann::json& tagsOf(const nlohmann::json& entry) {
+    static const nlohmann::json none = nlohmann::json::array();
+    auto it = entry.find("tags");
+    return it != entry.end() ? *it : none;
+}
+
+static std::vector<std::string> tagList(const nlohmann::json& files, const std::string& key) {
+    std::vector<std::string> tags;
+    auto it = files.find(key);
+    if (it == files.end()) return tags;
+    for (const auto& t : tagsOf(*it)) tags.push_back(t.get<std::string>());
+    return tags;
+}
+
+void TagManager::Changes::touch(const nlohmann::json& doc, const std::string& key) {
+    if (!before.count(key)) before[key] = tagList(filesOf(doc), key);
+}
+
+void TagManager::Changes::move(const nlohmann::json& doc, const std::string& from, const std::string& to) {
+    touch(doc, from);
+    touch(doc, to);
+    moved[to] = tagList(filesOf(doc), from);
+}
+
 TagManager::TagManager() {
-    metadata = nlohmann::json::object();
+    metadata.store(std::make_shared<const nlohmann::json>(emptyMetadata()));
+}
+
+TagManager::Snapshot TagManager::snapshot() const {
+    return metadata.load();
+}
+
+void TagManager::publish(Snapshot next) {
+    metadata.store(next);
+    if (changeListener) changeListener(next);
+}
+
+void TagManager::setChangeListener(ChangeListener listener) {
+    changeListener = std::move(listener);
 }
 
 void TagManager::loadTags(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    writer.flush(); // Reopening a folder must see our own unwritten edits
+    {
+        // Edits queued against the previous folder must not leak into this one
+        std::lock_guard<std::mutex> queue(queueMutex);
+        pendingOps.clear();
+    }
+
     currentDirectory = directory;
     metadataFile = getMetadataPath();
-    metadata.clear();
 
+    auto loaded = std::make_shared<nlohmann::json>(emptyMetadata());
     if (fs::exists(metadataFile)) {
         try {
             std::ifstream f(metadataFile);
-            metadata = nlohmann::json::parse(f);
+            *loaded = migrate(nlohmann::json::parse(f));
         } catch (const std::exception& e) {
             std::cerr << "Error loading metadata: " << e.what() << std::endl;
-            metadata = nlohmann::json::object();
+            *loaded = emptyMetadata();
         }
-    } else {
-        metadata = nlohmann::json::object();
     }
+
+    // One full pass on load; every later edit updates the statistics incrementally
+    stats.clear();
+    for (auto& element : filesOf(*loaded).items()) {
+        stats.update({}, tagList(filesOf(*loaded), element.key()), false);
+    }
+    stats.loadTrending(loaded->value("trending", nlohmann::json::object()));
+
+    publish(std::move(loaded));
 }
 
 void TagManager::saveTags() {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    writeMetadata(snapshot());
+}
+
+void TagManager::flush() {
+    writer.flush();
+}
+
+void TagManager::writeMetadata(Snapshot data) {
     if (currentDirectory.empty()) return;
+    writer.schedule(metadataFile, std::move(data));
+}
 
-    std::string smartfileDir = currentDirectory + "/.smartfile";
-    if (!fs::exists(smartfileDir)) {
-        fs::create_directory(smartfileDir);
+// Writers enqueue their edit and then compete for writerMutex. Whoever holds it
+// drains the whole queue onto one copy of the current snapshot, so by the time
+// a caller gets the lock its own edit has been applied either by itself or by
+// the writer before it. Readers never block: they keep the snapshot they loaded.
+void TagManager::mutate(Mutation op) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        pendingOps.push_back(std::move(op));
     }
-#ifdef _WIN32
-    SetFileAttributesA(smartfileDir.c_str(), FILE_ATTRIBUTE_HIDDEN);
-#endif
-
-    try {
-        std::ofstream f(metadataFile);
-        f << metadata.dump(4);
-    } catch (const std::exception& e) {
-        std::cerr << "Error saving metadata: " << e.what() << std::endl;
+
+    std::lock_guard<std::mutex> lock(writerMutex);
+    std::vector<Mutation> ops;
+    {
+        std::lock_guard<std::mutex> queue(queueMutex);
+        ops.swap(pendingOps);
     }
-}
+    if (ops.empty()) return; // Already applied by the previous writer
 
-void TagManager::addTag(const std::string& filename, const std::string& tag) {
-    if (!metadata.contains(filename)) {
-        metadata[filename] = nlohmann::json::array();
+    auto next = std::make_shared<nlohmann::json>(*snapshot());
+    Changes changes;
+    bool changed = false;
+    for (auto& apply : ops) {
+        changed |= apply(*next, changes);
     }
-    
-    // Check if tag already exists
-    bool exists = false;
-    for (const auto& t : metadata[filename]) {
-        if (t.get<std::string>() == tag) {
-            exists = true;
-            break;
+
+    if (changed) {
+        for (const auto& [key, before] : changes.before) {
+            auto moved = changes.moved.find(key);
+            if (moved == changes.moved.end()) {
+                stats.update(before, tagList(filesOf(*next), key));
+                continue;
+            }
+            // The moved tags only shift the counts; later edits in the batch still trend
+            stats.update(before, moved->second, false);
+            stats.update(moved->second, tagList(filesOf(*next), key));
         }
+        (*next)["trending"] = stats.trendingJson();
+
+        publish(next);
+        writeMetadata(next);
     }
-    
-    if (!exists) {
-        metadata[filename].push_back(tag);
-        saveTags();
+}
+
+std::string TagManager::keyFor(const std::string& path) const {
+    fs::path p(path);
+    if (p.is_relative()) return p.generic_string();
+
+    fs::path rel = p.lexically_relative(currentDirectory);
+    if (rel.empty() || *rel.begin() == "..") return p.generic_string(); // Outside the folder
+    return rel.generic_string();
+}
+
+std::string TagManager::absolutePath(const std::string& key) const {
+    return (fs::path(currentDirectory) / fs::path(key)).string();
+}
+
+// Reuses the stored fingerprint when size and mtime are unchanged, so re-tagging
+// a file does not re-read its content.
+FileIdentity TagManager::identityFor(const std::string& key) const {
+    std::string path = absolutePath(key);
+    FileIdentity current = FileIdentity::stat(path);
+
+    Snapshot data = snapshot();
+    const auto& files = filesOf(*data);
+    auto it = files.find(key);
+    if (it != files.end() && it->contains("id")) {
+        FileIdentity known = FileIdentity::fromJson((*it)["id"]);
+        if (!known.fingerprint.empty() && known.size == current.size && known.mtime == current.mtime) {
+            current.fingerprint = known.fingerprint;
+            return current;
+        }
     }
+
+    current.fingerprint = FileIdentity::fingerprintFile(path);
+    return current;
 }
 
-void TagManager::removeTag(const std::string& filename, const std::string& tag) {
-    if (metadata.contains(filename)) {
-        auto& tags = metadata[filename];
+void TagManager::addTag(const std::string& key, const std::string& tag) {
+    // Only a new entry needs an identity; computing it here keeps disk reads
+    // out of the writer lock
+    FileIdentity id;
+    bool known = filesOf(*snapshot()).contains(key);
+    if (!known) id = identityFor(key);
+
+    mutate([key, tag, known, id](nlohmann::json& data, Changes& changes) {
+        changes.touch(data, key);
+        auto& files = data["files"];
+        if (!files.contains(key)) {
+            files[key] = { {"tags", nlohmann::json::array()} };
+            if (!known) files[key]["id"] = id.toJson();
+        }
+
+        // Check if tag already exists
+        auto& tags = files[key]["tags"];
+        for (const auto& t : tags) {
+            if (t.get<std::string>() == tag) {
+                return false;
+            }
+        }
+
+        tags.push_back(tag);
+        return true;
+    });
+}
+
+void TagManager::removeTag(const std::string& key, const std::string& tag) {
+    mutate([key, tag](nlohmann::json& data, Changes& changes) {
+        auto& files = data["files"];
+        if (!files.contains(key)) return false;
+        changes.touch(data, key);
+
+        auto& tags = files[key]["tags"];
         for (auto it = tags.begin(); it != tags.end(); ++it) {
             if (it->get<std::string>() == tag) {
                 tags.erase(it);
-                saveTags();
-                break;
+                return true;
             }
         }
-    }
+        return false;
+    });
 }
 
 void TagManager::deleteTag(const std::string& tag) {
-    bool changed = false;
-    for (auto& element : metadata.items()) {
-        auto& tags = element.value();
-        for (auto it = tags.begin(); it != tags.end(); ) {
-            if (it->get<std::string>() == tag) {
-                it = tags.erase(it);
-                changed = true;
-            } else {
-                ++it;
+    mutate([tag](nlohmann::json& data, Changes& changes) {
+        bool changed = false;
+        for (auto& element : data["files"].items()) {
+            auto& tags = element.value()["tags"];
+            for (auto it = tags.begin(); it != tags.end(); ) {
+                if (it->get<std::string>() == tag) {
+                    changes.touch(data, element.key());
+                    it = tags.erase(it);
+                    changed = true;
+                } else {
+                    ++it;
+                }
             }
         }
-    }
-    if (changed) {
-        saveTags();
-    }
+        return changed;
+    });
 }
 
-std::vector<std::string> TagManager::getTags(const std::string& filename) const {
+std::vector<std::string> TagManager::getTags(const std::string& key) const {
+    Snapshot data = snapshot();
+    const auto& files = filesOf(*data);
     std::vector<std::string> tags;
-    if (metadata.contains(filename)) {
-        for (const auto& t : metadata[filename]) {
+    auto it = files.find(key);
+    if (it != files.end()) {
+        for (const auto& t : tagsOf(*it)) {
             tags.push_back(t.get<std::string>());
         }
     }
     return tags;
 }
 
-void TagManager::setTags(const std::string& filename, const std::vector<std::string>& tags) {
-    metadata[filename] = tags;
-    saveTags();
+void TagManager::setTags(const std::string& key, const std::vector<std::string>& tags, bool recordActivity) {
+    FileIdentity id = identityFor(key);
+    mutate([key, tags, id, recordActivity](nlohmann::json& data, Changes& changes) {
+        changes.touch(data, key);
+        if (!recordActivity) changes.moved[key] = tags;
+        data["files"][key] = { {"tags", tags}, {"id", id.toJson()} };
+        return true;
+    });
 }
 
-void TagManager::renameFile(const std::string& oldFilename, const std::string& newFilename) {
-    if (metadata.contains(oldFilename)) {
-        metadata[newFilename] = metadata[oldFilename];
-        metadata.erase(oldFilename);
-        saveTags();
-    }
+void TagManager::renameFile(const std::string& oldKey, const std::string& newKey) {
+    mutate([oldKey, newKey](nlohmann::json& data, Changes& changes) {
+        auto& files = data["files"];
+        if (!files.contains(oldKey)) return false;
+        changes.move(data, oldKey, newKey);
+
+        files[newKey] = files[oldKey];
+        files.erase(oldKey);
+        return true;
+    });
 }
 
-void TagManager::removeFile(const std::string& filename) {
-    if (metadata.contains(filename)) {
-        metadata.erase(filename);
-        saveTags();
+void TagManager::removeFile(const std::string& key) {
+    mutate([key](nlohmann::json& data, Changes& changes) {
+        changes.touch(data, key);
+        return data["files"].erase(key) > 0;
+    });
+}
+
+int TagManager::reconcile(const std::vector<std::string>& keys) {
+    struct Orphan {
+        std::string key;
+        FileIdentity id;
+        bool used = false;
+    };
+    struct Move {
+        std::string from;
+        std::string to;
+        FileIdentity id;
+    };
+
+    Snapshot data = snapshot();
+    const auto& files = filesOf(*data);
+    std::set<std::string> present(keys.begin(), keys.end());
+
+    // Entries whose file is gone. Anything not in `keys` is checked on disk,
+    // because a non-recursive scan does not list files in subfolders.
+    std::vector<Orphan> orphans;
+    std::vector<Move> backfill; // Legacy entries that are still in place
+    for (auto& element : files.items()) {
+        const std::string& key = element.key();
+        bool legacy = element.value().value("legacy", false);
+        std::error_code ec;
+        if (present.count(key) || fs::exists(absolutePath(key), ec)) {
+            if (legacy) backfill.push_back({key, key, FileIdentity::of(absolutePath(key))});
+            continue;
+        }
+        orphans.push_back({key, legacy ? FileIdentity() : FileIdentity::fromJson(element.value().value("id", nlohmann::json::object()))});
+    }
+
+    std::vector<Move> moves;
+    if (!orphans.empty()) {
+        std::map<std::pair<uint64_t, uint64_t>, size_t> byInode;
+        std::multimap<uint64_t, size_t> bySize;
+        std::multimap<std::string, size_t> byName; // Legacy entries: bare filename only
+        for (size_t i = 0; i < orphans.size(); ++i) {
+            const Orphan& o = orphans[i];
+            if (o.id.hasInode()) byInode[{o.id.device, o.id.inode}] = i;
+            if (!o.id.fingerprint.empty()) bySize.insert({o.id.size, i});
+            if (!o.id.hasInode() && o.id.fingerprint.empty()) byName.insert({o.key, i});
+        }
+
+        std::vector<std::string> untagged;
+        std::map<std::string, int> nameCount;
+        for (const auto& key : keys) {
+            if (files.contains(key)) continue;
+            untagged.push_back(key);
+            nameCount[fs::path(key).filename().generic_string()]++;
+        }
+
+        for (const auto& key : untagged) {
+            std::string path = absolutePath(key);
+            FileIdentity cur = FileIdentity::stat(path);
+            Orphan* match = nullptr;
+
+            // 1. Same inode: renamed or moved within the volume. Inode numbers are
+            //    reused after deletes, so the size or mtime must also agree.
+            auto inode = byInode.find({cur.device, cur.inode});
+            if (cur.hasInode() && inode != byInode.end()) {
+                Orphan& o = orphans[inode->second];
+                if (!o.used && (o.id.size == cur.size || o.id.mtime == cur.mtime)) match = &o;
+            }
+
+            // 2. Same content: moved across volumes, or copied and deleted
+            if (!match) {
+                auto range = bySize.equal_range(cur.size);
+                for (auto it = range.first; it != range.second && !match; ++it) {
+                    Orphan& o = orphans[it->second];
+                    if (o.used) continue;
+                    if (cur.fingerprint.empty()) cur.fingerprint = FileIdentity::fingerprintFile(path);
+                    if (o.id.fingerprint == cur.fingerprint) match = &o;
+                }
+            }
+
+            // 3. Legacy entry with the same filename, if the name is unambiguous
+            if (!match) {
+                std::string name = fs::path(key).filename().generic_string();
+                auto legacy = byName.find(name);
+                if (legacy != byName.end() && nameCount[name] == 1 && !orphans[legacy->second].used) {
+                    match = &orphans[legacy->second];
+                }
+            }
+
+            if (match) {
+                match->used = true;
+                if (cur.fingerprint.empty()) cur.fingerprint = FileIdentity::fingerprintFile(path);
+                moves.push_back({match->key, key, cur});
+            }
+        }
     }
+
+    if (moves.empty() && backfill.empty()) return 0;
+
+    int reattached = static_cast<int>(moves.size());
+    moves.insert(moves.end(), backfill.begin(), backfill.end());
+    mutate([moves](nlohmann::json& doc, Changes& changes) {
+        auto& entries = doc["files"];
+        bool changed = false;
+        for (const auto& m : moves) {
+            if (!entries.contains(m.from)) continue;
+            if (m.from != m.to && entries.contains(m.to)) continue; // Tagged meanwhile
+
+            changes.move(doc, m.from, m.to);
+            nlohmann::json entry = entries[m.from];
+            entry["id"] = m.id.toJson();
+            entry.erase("legacy");
+            entries.erase(m.from);
+            entries[m.to] = entry;
+            changed = true;
+        }
+        return changed;
+    });
+    return reattached;
 }
 
 std::vector<std::string> TagManager::getAllTags() const {
+    Snapshot data = snapshot();
     std::set<std::string> uniqueTags;
-    for (auto& element : metadata.items()) {
-        for (const auto& tag : element.value()) {
+    for (auto& element : filesOf(*data).items()) {
+        for (const auto& tag : tagsOf(element.value())) {
             uniqueTags.insert(tag.get<std::string>());
         }
     }
@@ -143,9 +435,10 @@ std::vector<std::string> TagManager::getAllTags() const {
 }
 
 std::vector<std::string> TagManager::getFilesByTag(const std::string& tag) const {
+    Snapshot data = snapshot();
     std::vector<std::string> files;
-    for (auto& element : metadata.items()) {
-        for (const auto& t : element.value()) {
+    for (auto& element : filesOf(*data).items()) {
+        for (const auto& t : tagsOf(element.value())) {
             if (t.get<std::string>() == tag) {
                 files.push_back(element.key());
                 break;
@@ -4,35 +4,97 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <functional>
 #include <nlohmann/json.hpp>
+#include "MetadataWriter.h"
+#include "FileIdentity.h"
+#include "TagStatistics.h"
 
+// Thread-safe tag store.
+// Readers work on immutable snapshots that are swapped atomically (RCU-style),
+// so background workers can query tags while the UI keeps editing them.
+// Mutations from any thread are queued and applied by a single writer, and
+// persisted write-behind so tag edits never wait on the disk.
+//
+// Files are keyed by their path relative to the loaded directory ('/'-separated)
+// and remember their FileIdentity, so reconcile() can reattach tags to files
+// that were renamed or moved instead of re-running the analysis.
 class TagManager {
 public:
+    using Snapshot = std::shared_ptr<const nlohmann::json>;
+    using ChangeListener = std::function<void(const Snapshot&)>;
+
     TagManager();
-    
+
     void loadTags(const std::string& directory);
-    void saveTags();
-    
-    void addTag(const std::string& filename, const std::string& tag);
-    void removeTag(const std::string& filename, const std::string& tag);
+    void saveTags(); // Schedules a background write of the current state
+    void flush();    // Blocks until every edit made so far is on disk
+
+    // Key for a file path (absolute or relative to the loaded directory)
+    std::string keyFor(const std::string& path) const;
+
+    void addTag(const std::string& key, const std::string& tag);
+    void removeTag(const std::string& key, const std::string& tag);
     void deleteTag(const std::string& tag); // Remove tag from all files
-    std::vector<std::string> getTags(const std::string& filename) const;
-    
-    void setTags(const std::string& filename, const std::vector<std::string>& tags);
-    
+    std::vector<std::string> getTags(const std::string& key) const;
+
+    // recordActivity = false for tags brought along from elsewhere, so they do not count as trending
+    void setTags(const std::string& key, const std::vector<std::string>& tags, bool recordActivity = true);
+
     // File operations support
-    void renameFile(const std::string& oldFilename, const std::string& newFilename);
-    void removeFile(const std::string& filename);
+    void renameFile(const std::string& oldKey, const std::string& newKey);
+    void removeFile(const std::string& key);
+
+    // Moves tags of files that no longer exist onto untagged files among `keys`
+    // with the same inode or content fingerprint. Returns the number reattached.
+    int reconcile(const std::vector<std::string>& keys);
 
     std::vector<std::string> getAllTags() const;
     std::vector<std::string> getFilesByTag(const std::string& tag) const;
 
+    // Consistent read-only view; safe to hold on any thread
+    Snapshot snapshot() const;
+
+    // Tag counts, co-occurrence and trending, kept current on every edit
+    const TagStatistics& statistics() const { return stats; }
+
+    // Called on the writing thread after every load and published change.
+    // Must be set before loadTags() and must not call back into this TagManager.
+    void setChangeListener(ChangeListener listener);
+
 private:
+    // Tags each file had before its first edit in a batch, for TagStatistics
+    struct Changes {
+        std::map<std::string, std::vector<std::string>> before;
+        std::map<std::string, std::vector<std::string>> moved; // Tags that arrived by a rename, by new key
+        void touch(const nlohmann::json& doc, const std::string& key);
+        // Call before moving the entry; the tags it carries are not new activity
+        void move(const nlohmann::json& doc, const std::string& from, const std::string& to);
+    };
+    // Returns true if the metadata was changed; must touch() every file it edits
+    using Mutation = std::function<bool(nlohmann::json&, Changes&)>;
+
     std::string currentDirectory;
     std::string metadataFile;
-    nlohmann::json metadata;
-    
+    std::atomic<Snapshot> metadata; // Swapped whole by publish(), read through snapshot()
+
+    std::mutex queueMutex;  // Guards pendingOps
+    std::vector<Mutation> pendingOps;
+    std::mutex writerMutex; // Held by the single writer applying pendingOps
+
+    MetadataWriter writer;
+    ChangeListener changeListener;
+    TagStatistics stats; // Updated by the writer only
+
+    void mutate(Mutation op);
+    void publish(Snapshot next);
+    void writeMetadata(Snapshot data);
     std::string getMetadataPath() const;
+    std::string absolutePath(const std::string& key) const;
+    FileIdentity identityFor(const std::string& key) const;
 };
 
 #endif // TAGMANAGER_H
@@ -0,0 +1,195 @@
+#include "TagStatistics.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+static constexpr double kHalfLifeSeconds = 7 * 24 * 3600.0;
+static const double kTau = kHalfLifeSeconds / std::log(2.0);
+static constexpr double kMaxExponent = 300.0; // Rebase before exp() gets near overflow
+
+TagStatistics::TagStatistics()
+    : epoch(now())
+{
+}
+
+double TagStatistics::now()
+{
+    using namespace std::chrono;
+    return duration<double>(system_clock::now().time_since_epoch()).count();
+}
+
+void TagStatistics::clear()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    counts.clear();
+    pairs.clear();
+    scores.clear();
+    ranking.clear();
+    epoch = now();
+}
+
+static std::vector<std::string> unique(const std::vector<std::string>& tags)
+{
+    std::vector<std::string> out(tags);
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+void TagStatistics::update(const std::vector<std::string>& beforeTags, const std::vector<std::string>& afterTags,
+                           bool recordActivity)
+{
+    std::vector<std::string> before = unique(beforeTags);
+    std::vector<std::string> after = unique(afterTags);
+    if (before == after) return;
+
+    std::vector<std::string> removed, added;
+    std::set_difference(before.begin(), before.end(), after.begin(), after.end(), std::back_inserter(removed));
+    std::set_difference(after.begin(), after.end(), before.begin(), before.end(), std::back_inserter(added));
+
+    auto adjustPair = [this](const std::string& a, const std::string& b, int delta) {
+        for (int side = 0; side < 2; ++side) {
+            const std::string& x = side ? b : a;
+            const std::string& y = side ? a : b;
+            auto& row = pairs[x];
+            if ((row[y] += delta) <= 0) row.erase(y);
+            if (row.empty()) pairs.erase(x);
+        }
+    };
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    // Only pairs involving a removed/added tag change; pairs within the
+    // unchanged tags are present both before and after
+    for (size_t i = 0; i < before.size(); ++i) {
+        for (size_t j = i + 1; j < before.size(); ++j) {
+            bool gone = std::binary_search(removed.begin(), removed.end(), before[i]) ||
+                        std::binary_search(removed.begin(), removed.end(), before[j]);
+            if (gone) adjustPair(before[i], before[j], -1);
+        }
+    }
+    for (size_t i = 0; i < after.size(); ++i) {
+        for (size_t j = i + 1; j < after.size(); ++j) {
+            bool fresh = std::binary_search(added.begin(), added.end(), after[i]) ||
+                         std::binary_search(added.begin(), added.end(), after[j]);
+            if (fresh) adjustPair(after[i], after[j], +1);
+        }
+    }
+
+    for (const auto& tag : removed) {
+        if (--counts[tag] <= 0) counts.erase(tag);
+    }
+
+    for (const auto& tag : added) {
+        counts[tag]++;
+    }
+    if (!recordActivity || added.empty()) return;
+
+    double t = now();
+    if ((t - epoch) / kTau > kMaxExponent) rebase(t);
+    double weight = std::exp((t - epoch) / kTau);
+    for (const auto& tag : added) {
+        bump(tag, weight);
+    }
+}
+
+void TagStatistics::bump(const std::string& tag, double amount)
+{
+    double& score = scores[tag];
+    if (score > 0) ranking.erase({score, tag});
+    score += amount;
+    ranking.insert({score, tag});
+}
+
+void TagStatistics::rebase(double t)
+{
+    double factor = std::exp(-(t - epoch) / kTau);
+    ranking.clear();
+    for (auto it = scores.begin(); it != scores.end(); ) {
+        it->second *= factor;
+        if (it->second < 1e-9) {
+            it = scores.erase(it); // Decayed to nothing
+        } else {
+            ranking.insert({it->second, it->first});
+            ++it;
+        }
+    }
+    epoch = t;
+}
+
+int TagStatistics::count(const std::string& tag) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = counts.find(tag);
+    return it != counts.end() ? it->second : 0;
+}
+
+std::map<std::string, int> TagStatistics::tagCounts() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return std::map<std::string, int>(counts.begin(), counts.end());
+}
+
+int TagStatistics::coCount(const std::string& a, const std::string& b) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto row = pairs.find(a);
+    if (row == pairs.end()) return 0;
+    auto it = row->second.find(b);
+    return it != row->second.end() ? it->second : 0;
+}
+
+std::vector<std::pair<std::string, int>> TagStatistics::coOccurring(const std::string& tag, size_t limit) const
+{
+    std::vector<std::pair<std::string, int>> out;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto row = pairs.find(tag);
+        if (row == pairs.end()) return out;
+        out.assign(row->second.begin(), row->second.end());
+    }
+
+    auto byCount = [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    };
+    if (limit > 0 && limit < out.size()) {
+        std::partial_sort(out.begin(), out.begin() + limit, out.end(), byCount);
+        out.resize(limit);
+    } else {
+        std::sort(out.begin(), out.end(), byCount);
+    }
+    return out;
+}
+
+std::vector<std::pair<std::string, double>> TagStatistics::trending(size_t limit) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    double decay = std::exp(-(now() - epoch) / kTau);
+    std::vector<std::pair<std::string, double>> out;
+    for (auto it = ranking.begin(); it != ranking.end() && out.size() < limit; ++it) {
+        out.push_back({it->second, it->first * decay});
+    }
+    return out;
+}
+
+nlohmann::json TagStatistics::trendingJson() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return { {"epoch", epoch}, {"scores", scores} };
+}
+
+void TagStatistics::loadTrending(const nlohmann::json& j)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    scores.clear();
+    ranking.clear();
+    epoch = j.value("epoch", now());
+    nlohmann::json saved = j.value("scores", nlohmann::json::object());
+    for (auto& element : saved.items()) {
+        double score = element.value().get<double>();
+        if (score <= 0) continue;
+        scores[element.key()] = score;
+        ranking.insert({score, element.key()});
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef TAGSTATISTICS_H
+#define TAGSTATISTICS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <shared_mutex>
+#include <nlohmann/json.hpp>
+
+// Per-tag file counts, a sparse tag co-occurrence matrix and decayed "trending"
+// scores, all maintained incrementally from per-file tag changes so queries
+// never have to scan the metadata.
+class TagStatistics
+{
+public:
+    TagStatistics();
+
+    void clear();
+    // One file's tags changed from `before` to `after`. recordActivity = false
+    // when replaying existing tags (loading), so they do not count as trending.
+    void update(const std::vector<std::string>& before, const std::vector<std::string>& after,
+                bool recordActivity = true);
+
+    int count(const std::string& tag) const;                        // Files carrying the tag
+    std::map<std::string, int> tagCounts() const;                   // count() of every tag
+    int coCount(const std::string& a, const std::string& b) const;  // Files carrying both
+    // Tags seen together with `tag`, most frequent first. limit == 0 returns all.
+    std::vector<std::pair<std::string, int>> coOccurring(const std::string& tag, size_t limit = 0) const;
+    // Tags added most often recently (exponential decay, 7-day half-life)
+    std::vector<std::pair<std::string, double>> trending(size_t limit) const;
+
+    // Trending scores are the only part that cannot be rebuilt from the tags
+    nlohmann::json trendingJson() const;
+    void loadTrending(const nlohmann::json& j);
+
+private:
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, int> counts;
+    std::unordered_map<std::string, std::unordered_map<std::string, int>> pairs; // Symmetric
+
+    // Forward decay: an add at time t weighs exp((t - epoch) / tau), so the
+    // order of scores never changes as time passes and can live in a sorted set
+    double epoch;
+    std::unordered_map<std::string, double> scores;
+    std::set<std::pair<double, std::string>, std::greater<>> ranking;
+
+    void bump(const std::string& tag, double amount);
+    void rebase(double now); // Requires unique lock
+    static double now();
+};
+
+#endif // TAGSTATISTICS_H
@@ -0,0 +1,339 @@
+#include "TagWorkspace.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+// { "version": 1, "roots": { "<root>": { "files": N, "tags": { "<tag>": count } } } }
+static nlohmann::json emptyIndex() {
+    return { {"version", 1}, {"roots", nlohmann::json::object()} };
+}
+
+TagWorkspace::TagWorkspace()
+    : index(emptyIndex())
+{
+}
+
+TagWorkspace::~TagWorkspace()
+{
+}
+
+std::string TagWorkspace::normalize(const std::string& path)
+{
+    std::string p = fs::path(path).lexically_normal().generic_string();
+    while (p.size() > 1 && p.back() == '/') p.pop_back();
+    return p;
+}
+
+bool TagWorkspace::inScope(const std::string& root, const std::string& scope)
+{
+    if (scope.empty() || root == scope) return true;
+    return root.size() > scope.size() && root.compare(0, scope.size(), scope) == 0 && root[scope.size()] == '/';
+}
+
+void TagWorkspace::open(const std::string& path)
+{
+    nlohmann::json loaded = emptyIndex();
+    if (fs::exists(path)) {
+        try {
+            std::ifstream f(path);
+            loaded = nlohmann::json::parse(f);
+            if (!loaded.contains("roots")) loaded = emptyIndex();
+        } catch (const std::exception& e) {
+            std::cerr << "Error loading workspace index: " << e.what() << std::endl;
+            loaded = emptyIndex();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    indexPath = path;
+    // Keep summaries of shards that were already loaded before open()
+    for (auto& element : index["roots"].items()) {
+        loaded["roots"][element.key()] = element.value();
+    }
+    index = std::move(loaded);
+}
+
+void TagWorkspace::flush()
+{
+    std::vector<TagManager*> loaded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [root, s] : shards) loaded.push_back(s->tags.get());
+    }
+    for (TagManager* tags : loaded) tags->flush();
+    writer.flush();
+}
+
+void TagWorkspace::registerRoot(const std::string& root)
+{
+    auto& roots = index["roots"];
+    if (!roots.contains(root)) {
+        roots[root] = { {"files", 0}, {"tags", nlohmann::json::object()} };
+        scheduleIndexWrite();
+    }
+    storeDirs[root] = true;
+}
+
+void TagWorkspace::addRoot(const std::string& root)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        registerRoot(normalize(root));
+    }
+    shard(root);
+}
+
+std::vector<std::string> TagWorkspace::roots() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> out;
+    for (auto& element : index.at("roots").items()) out.push_back(element.key());
+    return out;
+}
+
+TagManager& TagWorkspace::shard(const std::string& rootPath)
+{
+    std::string root = normalize(rootPath);
+    Shard* s = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& slot = shards[root];
+        if (!slot) {
+            slot = std::make_unique<Shard>();
+            slot->tags = std::make_unique<TagManager>();
+            TagManager* tags = slot->tags.get();
+            slot->tags->setChangeListener([this, root, tags](const TagManager::Snapshot& data) {
+                onShardChanged(root, *tags, data);
+            });
+            registerRoot(root);
+        }
+        s = slot.get();
+    }
+
+    // Load outside the lock: loading reports back through onShardChanged()
+    std::call_once(s->loaded, [&] { s->tags->loadTags(root); });
+    return *s->tags;
+}
+
+std::string TagWorkspace::ownerOf(const std::string& filePath)
+{
+    fs::path dir = fs::path(normalize(filePath)).parent_path();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (fs::path d = dir; !d.empty(); d = d.parent_path()) {
+        std::string key = d.generic_string();
+        auto cached = storeDirs.find(key);
+        bool isStore;
+        if (cached != storeDirs.end()) {
+            isStore = cached->second;
+        } else {
+            std::error_code ec;
+            isStore = fs::exists(d / ".smartfile" / "metadata.json", ec);
+            storeDirs[key] = isStore;
+        }
+        if (isStore) return key;
+        if (d == d.root_path()) break;
+    }
+    return "";
+}
+
+TagManager& TagWorkspace::shardFor(const std::string& filePath)
+{
+    std::string owner = ownerOf(filePath);
+    if (owner.empty()) owner = fs::path(normalize(filePath)).parent_path().generic_string();
+    return shard(owner);
+}
+
+TagManager* TagWorkspace::existingShardFor(const std::string& filePath)
+{
+    // A file outside every root has no tags; looking doesn't make its folder a root
+    std::string owner = ownerOf(filePath);
+    return owner.empty() ? nullptr : &shard(owner);
+}
+
+void TagWorkspace::onShardChanged(const std::string& root, const TagManager& tags, const TagManager::Snapshot& data)
+{
+    // The statistics are updated before every publish, so they match `data`
+    std::map<std::string, int> counts = tags.statistics().tagCounts();
+    size_t files = data->at("files").size();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    index["roots"][root] = { {"files", files}, {"tags", counts} };
+    scheduleIndexWrite();
+}
+
+void TagWorkspace::scheduleIndexWrite()
+{
+    if (indexPath.empty()) return;
+    writer.schedule(indexPath, std::make_shared<const nlohmann::json>(index));
+}
+
+std::vector<std::string> TagWorkspace::getTags(const std::string& filePath)
+{
+    TagManager* tags = existingShardFor(filePath);
+    return tags ? tags->getTags(tags->keyFor(normalize(filePath))) : std::vector<std::string>();
+}
+
+void TagWorkspace::addTag(const std::string& filePath, const std::string& tag)
+{
+    TagManager& tags = shardFor(filePath);
+    tags.addTag(tags.keyFor(normalize(filePath)), tag);
+}
+
+void TagWorkspace::removeTag(const std::string& filePath, const std::string& tag)
+{
+    TagManager* tags = existingShardFor(filePath);
+    if (tags) tags->removeTag(tags->keyFor(normalize(filePath)), tag);
+}
+
+void TagWorkspace::setTags(const std::string& filePath, const std::vector<std::string>& newTags)
+{
+    TagManager& tags = shardFor(filePath);
+    tags.setTags(tags.keyFor(normalize(filePath)), newTags);
+}
+
+void TagWorkspace::renameFile(const std::string& oldPath, const std::string& newPath)
+{
+    TagManager* source = existingShardFor(oldPath);
+    if (!source) return; // Had no tags to take along
+    TagManager& from = *source;
+    TagManager& to = shardFor(newPath);
+    std::string oldKey = from.keyFor(normalize(oldPath));
+    std::string newKey = to.keyFor(normalize(newPath));
+
+    if (&from == &to) {
+        from.renameFile(oldKey, newKey);
+        return;
+    }
+
+    // Moved into another root's folder: hand the entry over
+    std::vector<std::string> moved = from.getTags(oldKey);
+    from.removeFile(oldKey);
+    if (!moved.empty()) to.setTags(newKey, moved, false);
+}
+
+void TagWorkspace::removeFile(const std::string& filePath)
+{
+    TagManager* tags = existingShardFor(filePath);
+    if (tags) tags->removeFile(tags->keyFor(normalize(filePath)));
+}
+
+int TagWorkspace::reconcile(const std::vector<std::string>& filePaths)
+{
+    std::map<TagManager*, std::vector<std::string>> keysByShard;
+    for (const auto& path : filePaths) {
+        TagManager* tags = existingShardFor(path);
+        if (tags) keysByShard[tags].push_back(tags->keyFor(normalize(path)));
+    }
+
+    int reattached = 0;
+    for (auto& [tags, keys] : keysByShard) {
+        reattached += tags->reconcile(keys);
+    }
+    return reattached;
+}
+
+std::vector<std::string> TagWorkspace::rootsWithTag(const std::string& tag, const std::string& scope) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> candidates;
+    for (auto& element : index.at("roots").items()) {
+        if (inScope(element.key(), scope) && element.value().at("tags").contains(tag)) {
+            candidates.push_back(element.key());
+        }
+    }
+    return candidates;
+}
+
+std::vector<std::string> TagWorkspace::getAllTags(const std::string& scopePath) const
+{
+    std::string scope = scopePath.empty() ? "" : normalize(scopePath);
+    std::set<std::string> uniqueTags;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& element : index.at("roots").items()) {
+        if (!inScope(element.key(), scope)) continue;
+        for (auto& tag : element.value().at("tags").items()) uniqueTags.insert(tag.key());
+    }
+    return std::vector<std::string>(uniqueTags.begin(), uniqueTags.end());
+}
+
+std::vector<std::string> TagWorkspace::getFilesByTag(const std::string& tag, const std::string& scopePath)
+{
+    std::string scope = scopePath.empty() ? "" : normalize(scopePath);
+
+    // Only roots whose summary mentions the tag are worth loading
+    std::vector<std::string> files;
+    for (const auto& root : rootsWithTag(tag, scope)) {
+        for (const auto& key : shard(root).getFilesByTag(tag)) {
+            files.push_back(normalize(root + "/" + key));
+        }
+    }
+    return files;
+}
+
+void TagWorkspace::deleteTag(const std::string& tag, const std::string& scopePath)
+{
+    std::string scope = scopePath.empty() ? "" : normalize(scopePath);
+    for (const auto& root : rootsWithTag(tag, scope)) {
+        shard(root).deleteTag(tag);
+    }
+}
+
+int TagWorkspace::tagCount(const std::string& tag, const std::string& scopePath) const
+{
+    std::string scope = scopePath.empty() ? "" : normalize(scopePath);
+    int total = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& element : index.at("roots").items()) {
+        if (!inScope(element.key(), scope)) continue;
+        total += element.value().at("tags").value(tag, 0);
+    }
+    return total;
+}
+
+std::vector<std::pair<std::string, int>> TagWorkspace::coOccurring(const std::string& tag, size_t limit,
+                                                                   const std::string& scopePath)
+{
+    std::string scope = scopePath.empty() ? "" : normalize(scopePath);
+    std::vector<std::string> candidates = rootsWithTag(tag, scope);
+    if (candidates.size() == 1) return shard(candidates.front()).statistics().coOccurring(tag, limit);
+
+    std::map<std::string, int> merged;
+    for (const auto& root : candidates) {
+        for (const auto& [other, n] : shard(root).statistics().coOccurring(tag)) merged[other] += n;
+    }
+
+    std::vector<std::pair<std::string, int>> out(merged.begin(), merged.end());
+    std::stable_sort(out.begin(), out.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    if (limit > 0 && out.size() > limit) out.resize(limit);
+    return out;
+}
+
+std::vector<std::pair<std::string, double>> TagWorkspace::trending(size_t limit, const std::string& scopePath)
+{
+    std::string scope = scopePath.empty() ? "" : normalize(scopePath);
+    std::vector<TagManager*> loaded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [root, s] : shards) {
+            if (inScope(root, scope)) loaded.push_back(s->tags.get());
+        }
+    }
+
+    // Each shard's top `limit` is enough to find the merged top `limit`
+    // unless a tag is just below the cut in several roots
+    std::map<std::string, double> merged;
+    for (TagManager* tags : loaded) {
+        for (const auto& [tag, score] : tags->statistics().trending(limit)) merged[tag] += score;
+    }
+
+    std::vector<std::pair<std::string, double>> out(merged.begin(), merged.end());
+    std::stable_sort(out.begin(), out.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    if (out.size() > limit) out.resize(limit);
+    return out;
+}
@@ -0,0 +1,84 @@
+#ifndef TAGWORKSPACE_H
+#define TAGWORKSPACE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include "TagManager.h"
+#include "MetadataWriter.h"
+
+// Multi-root tag database.
+// Every root folder keeps its own shard (.smartfile/metadata.json, one TagManager)
+// which is only loaded when something touches it. A small global index stores a
+// per-root tag summary, so cross-root queries only open the shards that can match.
+class TagWorkspace
+{
+public:
+    TagWorkspace();
+    ~TagWorkspace();
+
+    // Global index location, e.g. <AppData>/workspace.json
+    void open(const std::string& indexPath);
+    void flush();
+
+    void addRoot(const std::string& root);
+    std::vector<std::string> roots() const;
+
+    // Shard of a root folder, loaded on first use
+    TagManager& shard(const std::string& root);
+    // Shard that owns a file: the deepest folder above it that is a registered root
+    // or already has a .smartfile store. Falls back to the file's own folder,
+    // which becomes a root; lookups and removals never get that far.
+    TagManager& shardFor(const std::string& filePath);
+
+    // File-level operations on absolute paths, routed to the owning shard
+    std::vector<std::string> getTags(const std::string& filePath);
+    void addTag(const std::string& filePath, const std::string& tag);
+    void removeTag(const std::string& filePath, const std::string& tag);
+    void setTags(const std::string& filePath, const std::vector<std::string>& tags);
+    void renameFile(const std::string& oldPath, const std::string& newPath);
+    void removeFile(const std::string& filePath);
+    // Runs TagManager::reconcile() on every shard owning one of the files
+    int reconcile(const std::vector<std::string>& filePaths);
+
+    // Cross-root queries. `scope` limits results to roots at or below that folder.
+    std::vector<std::string> getAllTags(const std::string& scope = "") const;
+    std::vector<std::string> getFilesByTag(const std::string& tag, const std::string& scope = "");
+    void deleteTag(const std::string& tag, const std::string& scope = "");
+
+    // TagStatistics merged over the roots in scope
+    int tagCount(const std::string& tag, const std::string& scope = "") const; // Index only, no shard loads
+    std::vector<std::pair<std::string, int>> coOccurring(const std::string& tag, size_t limit,
+                                                         const std::string& scope = "");
+    std::vector<std::pair<std::string, double>> trending(size_t limit, const std::string& scope = "");
+
+    static std::string normalize(const std::string& path);
+
+private:
+    struct Shard {
+        std::unique_ptr<TagManager> tags;
+        std::once_flag loaded;
+    };
+
+    mutable std::mutex mutex; // Guards everything below except the shards' own state
+    std::map<std::string, std::unique_ptr<Shard>> shards;
+    std::map<std::string, bool> storeDirs; // Cache: does <dir>/.smartfile exist
+    nlohmann::json index;
+    std::string indexPath;
+
+    MetadataWriter writer;
+
+    void registerRoot(const std::string& root); // Requires mutex
+    std::string ownerOf(const std::string& filePath); // Folder of the shard owning the file, empty if none
+    TagManager* existingShardFor(const std::string& filePath); // Null where shardFor() would start a root
+    // Summary from the shard's incrementally kept statistics, not a walk over its files
+    void onShardChanged(const std::string& root, const TagManager& tags, const TagManager::Snapshot& data);
+    void scheduleIndexWrite(); // Requires mutex
+    std::vector<std::string> rootsWithTag(const std::string& tag, const std::string& scope) const;
+    static bool inScope(const std::string& root, const std::string& scope);
+};
+
+#endif // TAGWORKSPACE_H
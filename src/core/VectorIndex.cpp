@@ -0,0 +1,661 @@
+#include "VectorIndex.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <queue>
+#include <unordered_set>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+namespace fs = std::filesystem;
+
+// Both data files start with this, followed by fixed-size rows:
+// vectors.bin: dim floats per node, graph.bin: 1 + M0 uint32 (count, links) per node
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t links;
+};
+static constexpr size_t kHeaderSize = sizeof(FileHeader);
+
+// One JSON object per line; a torn last line from a crash is skipped
+static size_t readLines(const std::string& file, const std::function<bool(const nlohmann::json&)>& fn)
+{
+    std::ifstream f(file, std::ios::binary);
+    size_t n = 0;
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.empty()) continue;
+        n++;
+        nlohmann::json j = nlohmann::json::parse(line, nullptr, false);
+        if (j.is_object() && !fn(j)) break;
+    }
+    return n;
+}
+
+static void normalizeVector(std::vector<float>& v)
+{
+    double norm = 0;
+    for (float x : v) norm += double(x) * x;
+    norm = std::sqrt(norm);
+    if (norm > 0) {
+        for (float& x : v) x = float(x / norm);
+    }
+}
+
+VectorIndex::VectorIndex()
+    : rng(std::random_device{}())
+{
+}
+
+VectorIndex::~VectorIndex()
+{
+    close();
+}
+
+std::string VectorIndex::path(const char* suffix) const
+{
+    return (fs::path(storeDir) / (baseName + suffix)).string();
+}
+
+bool VectorIndex::open(const std::string& directory, int dimension, const std::string& name)
+{
+    close();
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    storeDir = (fs::path(directory) / ".smartfile").string();
+    baseName = name;
+    dim = dimension;
+
+    // Keys, tombstones and upper layers
+    bool reset = true;
+    std::string metaPath = path(".json");
+    if (fs::exists(metaPath)) {
+        try {
+            std::ifstream f(metaPath);
+            nlohmann::json meta = nlohmann::json::parse(f);
+            if (meta.value("dim", 0) == dim) {
+                auto toNode = [](const nlohmann::json& n) {
+                    Node node;
+                    node.key = n.at("k").get<std::string>();
+                    node.stamp = n.value("s", "");
+                    node.deleted = n.value("d", false);
+                    if (n.contains("u")) node.upper = n.at("u").get<std::vector<std::vector<uint32_t>>>();
+                    return node;
+                };
+                for (const auto& n : meta.at("nodes")) nodes.push_back(toNode(n));
+                entry = meta.value("entry", int64_t(-1));
+                maxLevel = meta.value("maxLevel", 0);
+
+                // Changes since the snapshot: whole nodes by id, then where the graph starts
+                journalLines = readLines(path(".journal"), [&](const nlohmann::json& j) {
+                    if (j.contains("entry")) {
+                        entry = j.value("entry", int64_t(-1));
+                        maxLevel = j.value("maxLevel", 0);
+                        return true;
+                    }
+                    size_t id = j.value("i", size_t(-1));
+                    if (id > nodes.size()) return false; // Nodes are appended in order; anything else is damage
+                    if (id == nodes.size()) nodes.push_back(toNode(j));
+                    else nodes[id] = toNode(j);
+                    return true;
+                });
+                reset = false;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error loading vector index: " << e.what() << std::endl;
+            nodes.clear();
+            journalLines = 0;
+        }
+    }
+
+    if (!mapFiles(reset)) {
+        nodes.clear();
+        storeDir.clear();
+        return false;
+    }
+
+    for (uint32_t id = 0; id < nodes.size(); ++id) {
+        if (nodes[id].deleted) deleted++;
+        else byKey[nodes[id].key] = id;
+    }
+    return true;
+}
+
+bool VectorIndex::mapFiles(bool reset)
+{
+    std::error_code ec;
+    fs::create_directories(storeDir, ec);
+
+    vectorFile.setFileName(QString::fromStdString(path(".bin")));
+    graphFile.setFileName(QString::fromStdString(path(".graph.bin")));
+    if (!vectorFile.open(QIODevice::ReadWrite) || !graphFile.open(QIODevice::ReadWrite)) {
+        std::cerr << "Error opening vector index in " << storeDir << std::endl;
+        vectorFile.close();
+        graphFile.close();
+        return false;
+    }
+
+    auto valid = [this](QFile& f, const char* magic) {
+        FileHeader h;
+        f.seek(0);
+        if (f.read(reinterpret_cast<char*>(&h), kHeaderSize) != qint64(kHeaderSize)) return false;
+        return std::memcmp(h.magic, magic, 4) == 0 && h.version == 1 && h.dim == uint32_t(dim) && h.links == M0;
+    };
+    auto start = [this](QFile& f, const char* magic) {
+        FileHeader h;
+        std::memcpy(h.magic, magic, 4);
+        h.version = 1;
+        h.dim = dim;
+        h.links = M0;
+        f.resize(0);
+        f.seek(0);
+        f.write(reinterpret_cast<const char*>(&h), kHeaderSize);
+        f.flush();
+    };
+
+    if (reset || !valid(vectorFile, "SFVV") || !valid(graphFile, "SFVG")) {
+        nodes.clear();
+        entry = -1;
+        maxLevel = 0;
+        dirty.clear();
+        needSnapshot = true;
+        start(vectorFile, "SFVV");
+        start(graphFile, "SFVG");
+    }
+
+    const size_t vectorRow = size_t(dim) * sizeof(float);
+    const size_t graphRow = (M0 + 1) * sizeof(uint32_t);
+    capacity = uint32_t(std::min((vectorFile.size() - kHeaderSize) / vectorRow,
+                                 (graphFile.size() - kHeaderSize) / graphRow));
+    if (nodes.size() > capacity) {
+        // Keys without data behind them: start over rather than serve garbage
+        std::cerr << "Vector index files are truncated, rebuilding" << std::endl;
+        vectorFile.close();
+        graphFile.close();
+        return mapFiles(true);
+    }
+
+    vectorMap = vectorFile.map(0, vectorFile.size());
+    graphMap = graphFile.map(0, graphFile.size());
+    if (!vectorMap || !graphMap) {
+        std::cerr << "Error mapping vector index in " << storeDir << std::endl;
+        unmapFiles();
+        vectorFile.close();
+        graphFile.close();
+        return false;
+    }
+    return true;
+}
+
+void VectorIndex::unmapFiles()
+{
+    if (vectorMap) vectorFile.unmap(vectorMap);
+    if (graphMap) graphFile.unmap(graphMap);
+    vectorMap = nullptr;
+    graphMap = nullptr;
+}
+
+bool VectorIndex::reserve(uint32_t n)
+{
+    if (n <= capacity) return true;
+
+    uint32_t grown = std::max<uint32_t>(1024, capacity);
+    while (grown < n) grown *= 2;
+
+    unmapFiles();
+    bool ok = vectorFile.resize(kHeaderSize + size_t(grown) * dim * sizeof(float)) &&
+              graphFile.resize(kHeaderSize + size_t(grown) * (M0 + 1) * sizeof(uint32_t));
+    vectorMap = vectorFile.map(0, vectorFile.size());
+    graphMap = graphFile.map(0, graphFile.size());
+    if (!ok || !vectorMap || !graphMap) {
+        std::cerr << "Error growing vector index to " << grown << " entries" << std::endl;
+        return false;
+    }
+    capacity = grown;
+    return true;
+}
+
+void VectorIndex::close()
+{
+    if (!isOpen()) return;
+    flush();
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    unmapFiles();
+    vectorFile.close();
+    graphFile.close();
+    storeDir.clear();
+    nodes.clear();
+    byKey.clear();
+    dirty.clear();
+    journalLines = 0;
+    needSnapshot = false;
+    entry = -1;
+    maxLevel = 0;
+    deleted = 0;
+    capacity = 0;
+}
+
+nlohmann::json VectorIndex::nodeJson(const Node& node)
+{
+    nlohmann::json n = { {"k", node.key} };
+    if (!node.stamp.empty()) n["s"] = node.stamp;
+    if (node.deleted) n["d"] = true;
+    if (!node.upper.empty()) n["u"] = node.upper;
+    return n;
+}
+
+nlohmann::json VectorIndex::metaJson() const
+{
+    nlohmann::json list = nlohmann::json::array();
+    for (const auto& node : nodes) list.push_back(nodeJson(node));
+    return { {"version", 1}, {"dim", dim}, {"entry", entry}, {"maxLevel", maxLevel}, {"nodes", std::move(list)} };
+}
+
+void VectorIndex::writeSnapshot()
+{
+    // Temp file + rename like the other metadata; the old journal over the
+    // new snapshot after a crash in between only repeats what is in it
+    try {
+        std::string snapshot = path(".json");
+        std::string tmp = snapshot + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            f << metaJson().dump();
+            f.flush();
+            if (!f) {
+                std::cerr << "Error saving vector index: write failed for " << tmp << std::endl;
+                return;
+            }
+        }
+        fs::rename(tmp, snapshot);
+        std::ofstream(path(".journal"), std::ios::binary | std::ios::trunc);
+        journalLines = 0;
+        dirty.clear();
+        needSnapshot = false;
+    } catch (const std::exception& e) {
+        std::cerr << "Error saving vector index: " << e.what() << std::endl;
+    }
+}
+
+void VectorIndex::flush()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (storeDir.empty() || (dirty.empty() && !needSnapshot)) return;
+    if (needSnapshot || journalLines + dirty.size() > std::max<size_t>(4096, nodes.size())) {
+        writeSnapshot();
+        return;
+    }
+
+    // Ascending ids, so new nodes replay in the order they were appended
+    std::vector<uint32_t> ids(dirty.begin(), dirty.end());
+    std::sort(ids.begin(), ids.end());
+    std::ofstream f(path(".journal"), std::ios::binary | std::ios::app);
+    for (uint32_t id : ids) {
+        nlohmann::json n = nodeJson(nodes[id]);
+        n["i"] = id;
+        f << n.dump() << '\n';
+    }
+    f << nlohmann::json{ {"entry", entry}, {"maxLevel", maxLevel} }.dump() << '\n';
+    f.flush();
+    if (!f) {
+        std::cerr << "Error writing vector index journal in " << storeDir << std::endl;
+        return;
+    }
+    journalLines += ids.size() + 1;
+    dirty.clear();
+}
+
+bool VectorIndex::isOpen() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return !storeDir.empty();
+}
+
+int VectorIndex::dimension() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return dim;
+}
+
+std::string VectorIndex::name() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return baseName;
+}
+
+size_t VectorIndex::size() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return byKey.size();
+}
+
+size_t VectorIndex::tombstones() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return deleted;
+}
+
+float* VectorIndex::vec(uint32_t id) const
+{
+    return reinterpret_cast<float*>(vectorMap + kHeaderSize + size_t(id) * dim * sizeof(float));
+}
+
+uint32_t* VectorIndex::links0(uint32_t id) const
+{
+    return reinterpret_cast<uint32_t*>(graphMap + kHeaderSize + size_t(id) * (M0 + 1) * sizeof(uint32_t));
+}
+
+std::vector<uint32_t> VectorIndex::neighbours(uint32_t id, int level) const
+{
+    if (level > 0) return nodes[id].upper[level - 1];
+    const uint32_t* links = links0(id);
+    return std::vector<uint32_t>(links + 1, links + 1 + std::min(links[0], M0));
+}
+
+void VectorIndex::setNeighbours(uint32_t id, int level, const std::vector<uint32_t>& links)
+{
+    if (level > 0) {
+        nodes[id].upper[level - 1] = links;
+        dirty.insert(id);
+        return;
+    }
+    uint32_t* row = links0(id);
+    row[0] = uint32_t(std::min<size_t>(links.size(), M0));
+    std::copy(links.begin(), links.begin() + row[0], row + 1);
+}
+
+float VectorIndex::distance(const float* a, const float* b) const
+{
+    float dot = 0;
+    for (int i = 0; i < dim; ++i) dot += a[i] * b[i];
+    return 1.0f - dot; // Vectors are unit length
+}
+
+std::vector<VectorIndex::Candidate> VectorIndex::searchLayer(const float* q, const std::vector<uint32_t>& entryPoints,
+                                                             size_t ef, int level) const
+{
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> candidates; // Closest on top
+    std::priority_queue<Candidate> found;                                             // Farthest on top
+    std::unordered_set<uint32_t> visited;
+    const uint32_t n = nodes.size(); // Links past this were written by an unsaved session
+
+    for (uint32_t ep : entryPoints) {
+        if (ep >= n || !visited.insert(ep).second) continue;
+        float d = distance(q, vec(ep));
+        candidates.push({d, ep});
+        found.push({d, ep});
+    }
+
+    auto visit = [&](uint32_t e) {
+        if (e >= n || !visited.insert(e).second) return;
+        float d = distance(q, vec(e));
+        if (found.size() < ef || d < found.top().first) {
+            candidates.push({d, e});
+            found.push({d, e});
+            if (found.size() > ef) found.pop();
+        }
+    };
+
+    while (!candidates.empty()) {
+        auto [d, c] = candidates.top();
+        if (found.size() >= ef && d > found.top().first) break;
+        candidates.pop();
+
+        if (level == 0) {
+            const uint32_t* links = links0(c);
+            for (uint32_t i = 1; i <= std::min(links[0], M0); ++i) visit(links[i]);
+        } else if (size_t(level) <= nodes[c].upper.size()) {
+            for (uint32_t e : nodes[c].upper[level - 1]) visit(e);
+        }
+    }
+
+    std::vector<Candidate> out(found.size());
+    for (size_t i = out.size(); i-- > 0; found.pop()) out[i] = found.top();
+    return out;
+}
+
+// HNSW heuristic: skip candidates closer to an already chosen neighbour than to
+// the base node, which keeps links spread out and the graph navigable
+std::vector<uint32_t> VectorIndex::selectNeighbours(const std::vector<Candidate>& candidates, size_t m) const
+{
+    std::vector<uint32_t> out;
+    for (const auto& [d, c] : candidates) {
+        if (out.size() >= m) break;
+        bool keep = true;
+        for (uint32_t r : out) {
+            if (distance(vec(c), vec(r)) < d) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) out.push_back(c);
+    }
+    return out;
+}
+
+void VectorIndex::insert(const std::string& key, const float* v, const std::string& stamp)
+{
+    const uint32_t id = nodes.size();
+    if (!reserve(id + 1)) return;
+
+    std::memcpy(vec(id), v, size_t(dim) * sizeof(float));
+    links0(id)[0] = 0;
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    int level = int(-std::log(1.0 - uniform(rng)) / std::log(double(M)));
+
+    Node node;
+    node.key = key;
+    node.stamp = stamp;
+    node.upper.resize(level);
+    nodes.push_back(std::move(node));
+    byKey[key] = id;
+    dirty.insert(id);
+
+    if (entry < 0) {
+        entry = id;
+        maxLevel = level;
+        return;
+    }
+
+    const float* q = vec(id);
+    uint32_t ep = uint32_t(entry);
+    float epDist = distance(q, vec(ep));
+    for (int l = maxLevel; l > level; --l) {
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (uint32_t n : neighbours(ep, l)) {
+                if (n >= id) continue;
+                float d = distance(q, vec(n));
+                if (d < epDist) {
+                    ep = n;
+                    epDist = d;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<uint32_t> entryPoints{ep};
+    for (int l = std::min(level, maxLevel); l >= 0; --l) {
+        std::vector<Candidate> found = searchLayer(q, entryPoints, efConstruction, l);
+        const size_t maxLinks = l == 0 ? M0 : M;
+
+        std::vector<uint32_t> chosen = selectNeighbours(found, M);
+        setNeighbours(id, l, chosen);
+        for (uint32_t n : chosen) {
+            std::vector<uint32_t> links = neighbours(n, l);
+            links.push_back(id);
+            if (links.size() > maxLinks) {
+                std::vector<Candidate> ranked;
+                for (uint32_t x : links) ranked.push_back({distance(vec(n), vec(x)), x});
+                std::sort(ranked.begin(), ranked.end());
+                links = selectNeighbours(ranked, maxLinks);
+            }
+            setNeighbours(n, l, links);
+        }
+
+        entryPoints.clear();
+        for (const auto& c : found) entryPoints.push_back(c.second);
+    }
+
+    if (level > maxLevel) {
+        entry = id;
+        maxLevel = level;
+    }
+}
+
+void VectorIndex::upsert(const std::string& key, const std::vector<float>& vector, const std::string& stamp)
+{
+    std::vector<float> v(vector);
+    normalizeVector(v);
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (storeDir.empty()) return;
+    if (int(v.size()) != dim) {
+        std::cerr << "Vector index: expected dimension " << dim << ", got " << v.size() << std::endl;
+        return;
+    }
+
+    auto it = byKey.find(key);
+    if (it != byKey.end()) {
+        nodes[it->second].deleted = true;
+        dirty.insert(it->second);
+        deleted++;
+        byKey.erase(it);
+    }
+    insert(key, v.data(), stamp);
+}
+
+void VectorIndex::remove(const std::string& key)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = byKey.find(key);
+    if (it == byKey.end()) return;
+    nodes[it->second].deleted = true;
+    dirty.insert(it->second);
+    deleted++;
+    byKey.erase(it);
+}
+
+void VectorIndex::rename(const std::string& oldKey, const std::string& newKey)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = byKey.find(oldKey);
+    if (it == byKey.end() || oldKey == newKey) return;
+    uint32_t id = it->second;
+    byKey.erase(it);
+
+    auto existing = byKey.find(newKey);
+    if (existing != byKey.end()) {
+        nodes[existing->second].deleted = true;
+        dirty.insert(existing->second);
+        deleted++;
+    }
+    nodes[id].key = newKey;
+    byKey[newKey] = id;
+    dirty.insert(id);
+}
+
+bool VectorIndex::contains(const std::string& key) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return byKey.count(key) > 0;
+}
+
+std::string VectorIndex::stamp(const std::string& key) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = byKey.find(key);
+    return it != byKey.end() ? nodes[it->second].stamp : std::string();
+}
+
+std::vector<std::string> VectorIndex::keys() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    std::vector<std::string> out;
+    out.reserve(byKey.size());
+    for (const auto& [key, id] : byKey) out.push_back(key);
+    return out;
+}
+
+std::vector<float> VectorIndex::vectorOf(const std::string& key) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = byKey.find(key);
+    if (it == byKey.end()) return {};
+    const float* v = vec(it->second);
+    return std::vector<float>(v, v + dim);
+}
+
+std::vector<std::pair<std::string, float>> VectorIndex::search(const std::vector<float>& query, size_t k,
+                                                               size_t ef) const
+{
+    std::vector<float> q(query);
+    normalizeVector(q);
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    std::vector<std::pair<std::string, float>> out;
+    if (entry < 0 || int(q.size()) != dim || k == 0) return out;
+
+    // Greedy descent through the upper layers, then a wide search on layer 0
+    uint32_t ep = uint32_t(entry);
+    float epDist = distance(q.data(), vec(ep));
+    for (int l = maxLevel; l > 0; --l) {
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (uint32_t n : neighbours(ep, l)) {
+                if (n >= nodes.size()) continue;
+                float d = distance(q.data(), vec(n));
+                if (d < epDist) {
+                    ep = n;
+                    epDist = d;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (const auto& [d, id] : searchLayer(q.data(), {ep}, std::max(ef, k), 0)) {
+        if (nodes[id].deleted) continue;
+        out.push_back({nodes[id].key, 1.0f - d});
+        if (out.size() >= k) break;
+    }
+    return out;
+}
+
+void VectorIndex::compact()
+{
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (storeDir.empty() || deleted == 0) return;
+
+        std::vector<Node> live;
+        std::vector<float> data;
+        for (uint32_t id = 0; id < nodes.size(); ++id) {
+            if (nodes[id].deleted) continue;
+            live.push_back(nodes[id]);
+            data.insert(data.end(), vec(id), vec(id) + dim);
+        }
+
+        unmapFiles();
+        vectorFile.close();
+        graphFile.close();
+        byKey.clear();
+        deleted = 0;
+        capacity = 0;
+        if (!mapFiles(true)) {
+            storeDir.clear();
+            return;
+        }
+        for (size_t i = 0; i < live.size(); ++i) {
+            insert(live[i].key, data.data() + i * dim, live[i].stamp);
+        }
+    }
+    flush();
+}
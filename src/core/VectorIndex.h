@@ -0,0 +1,110 @@
+#ifndef VECTORINDEX_H
+#define VECTORINDEX_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <mutex>
+#include <random>
+#include <cstdint>
+#include <QFile>
+#include <nlohmann/json.hpp>
+
+// Approximate nearest-neighbour index (HNSW) over unit-length embeddings,
+// stored in <dir>/.smartfile/ as <name>.json, <name>.bin and <name>.graph.bin. Vectors and the bottom graph layer live in
+// memory-mapped files, so opening an index reads almost nothing; only keys and
+// the sparse upper layers are kept in memory. Those go to <name>.json as a
+// snapshot plus <name>.journal, which gets the nodes changed since the last
+// flush and is folded back into the snapshot once it grows, so flushing after
+// every file costs a few lines instead of rewriting every key.
+// Changing a file's vector appends a new node and tombstones the old one;
+// compact() rebuilds the index without tombstones.
+class VectorIndex
+{
+public:
+    VectorIndex();
+    ~VectorIndex();
+
+    // An existing index of another dimension is discarded. Indexes of different
+    // embedding models belong under different names; they can't be compared.
+    bool open(const std::string& directory, int dimension, const std::string& name = "vectors");
+    void close();
+    // Appends the changed keys and upper layers to the journal; mapped data is written back by the OS
+    void flush();
+    bool isOpen() const;
+    int dimension() const;
+    std::string name() const;
+    size_t size() const;       // Live vectors
+    size_t tombstones() const;
+
+    // `stamp` records what the vector was computed from, so callers can tell stale entries
+    void upsert(const std::string& key, const std::vector<float>& vec, const std::string& stamp = "");
+    void remove(const std::string& key);
+    void rename(const std::string& oldKey, const std::string& newKey);
+    bool contains(const std::string& key) const;
+    std::string stamp(const std::string& key) const;
+    std::vector<std::string> keys() const;
+    std::vector<float> vectorOf(const std::string& key) const; // Empty if unknown
+
+    // k most similar keys by cosine similarity, best first. Larger ef = better recall, slower.
+    std::vector<std::pair<std::string, float>> search(const std::vector<float>& query, size_t k,
+                                                      size_t ef = 64) const;
+
+    void compact();
+
+private:
+    static constexpr uint32_t M = 16;      // Links per node on upper layers
+    static constexpr uint32_t M0 = 2 * M;  // Links per node on layer 0
+    static constexpr size_t efConstruction = 100;
+
+    struct Node {
+        std::string key;
+        std::string stamp;
+        bool deleted = false;
+        std::vector<std::vector<uint32_t>> upper; // upper[l - 1] = links on layer l
+    };
+    using Candidate = std::pair<float, uint32_t>; // Distance, node
+
+    mutable std::shared_mutex mutex;
+    std::string storeDir;
+    std::string baseName;
+    int dim = 0;
+    QFile vectorFile;
+    QFile graphFile;
+    uchar* vectorMap = nullptr;
+    uchar* graphMap = nullptr;
+    uint32_t capacity = 0;
+
+    std::vector<Node> nodes;
+    std::unordered_map<std::string, uint32_t> byKey; // Live nodes only
+    int64_t entry = -1;
+    int maxLevel = 0;
+    size_t deleted = 0;
+    std::mt19937 rng;
+
+    std::unordered_set<uint32_t> dirty; // Nodes changed since the last flush
+    size_t journalLines = 0;
+    bool needSnapshot = false;          // The journal would apply to an older snapshot
+
+    float* vec(uint32_t id) const;
+    uint32_t* links0(uint32_t id) const; // [0] = count, then up to M0 ids
+    std::vector<uint32_t> neighbours(uint32_t id, int level) const;
+    void setNeighbours(uint32_t id, int level, const std::vector<uint32_t>& links);
+    float distance(const float* a, const float* b) const;
+
+    std::vector<Candidate> searchLayer(const float* q, const std::vector<uint32_t>& entryPoints,
+                                       size_t ef, int level) const;
+    std::vector<uint32_t> selectNeighbours(const std::vector<Candidate>& candidates, size_t m) const;
+    void insert(const std::string& key, const float* v, const std::string& stamp); // Requires unique lock
+    bool reserve(uint32_t n);                                                         // Requires unique lock
+    bool mapFiles(bool reset);
+    void unmapFiles();
+    nlohmann::json metaJson() const;
+    static nlohmann::json nodeJson(const Node& node);
+    void writeSnapshot(); // Requires unique lock; also empties the journal
+    std::string path(const char* suffix) const; // <storeDir>/<baseName><suffix>
+};
+
+#endif // VECTORINDEX_H
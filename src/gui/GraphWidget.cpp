@@ -1,5 +1,5 @@
 #include "GraphWidget.h"
-#include "../core/TagManager.h"
+#include "../core/TagWorkspace.h"
 #include <QGraphicsScene>
 #include <QPainter>
 #include <QTimer>
@@ -221,8 +221,8 @@ void Node::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 }
 
 // --- GraphWidget Implementation ---
-GraphWidget::GraphWidget(TagManager* tagMgr, QWidget *parent)
-    : QGraphicsView(parent), timerId(0), tagManager(tagMgr)
+GraphWidget::GraphWidget(TagWorkspace* tagWorkspace, QWidget *parent)
+    : QGraphicsView(parent), timerId(0), workspace(tagWorkspace)
 {
     QGraphicsScene *scene = new QGraphicsScene(this);
     scene->setItemIndexMethod(QGraphicsScene::NoIndex);
@@ -306,14 +306,19 @@ void GraphWidget::zoomOut()
     scaleView(1 / 1.2);
 }
 
+void GraphWidget::setScope(const QString& folder)
+{
+    scope = folder;
+}
+
 void GraphWidget::buildGraph() {
     scene()->clear();
     fileNodes.clear();
     tagNodes.clear();
 
-    if (!tagManager) return;
+    if (!workspace || scope.isEmpty()) return;
     
-    std::vector<std::string> allTags = tagManager->getAllTags();
+    std::vector<std::string> allTags = workspace->getAllTags(scope.toStdString());
     if (allTags.empty()) {
         //scene()->addText("No tags found.", QFont("Arial", 20))->setDefaultTextColor(Qt::white);
         return;
@@ -325,6 +330,7 @@ void GraphWidget::buildGraph() {
     for (const auto& tagStr : allTags) {
         QString qTag = QString::fromStdString(tagStr);
         Node* tagNode = new Node(this, Node::Tag, qTag);
+        tagNode->setToolTip(QString("%1 個檔案").arg(workspace->tagCount(tagStr, scope.toStdString())));
         
         // Distribute in a circle
         double angle = 2.0 * M_PI * i / count;
@@ -341,13 +347,14 @@ void GraphWidget::buildGraph() {
         QString qTag = QString::fromStdString(tagStr);
         Node* tagNode = tagNodes[qTag];
         
-        std::vector<std::string> files = tagManager->getFilesByTag(tagStr);
+        std::vector<std::string> files = workspace->getFilesByTag(tagStr, scope.toStdString());
         for (const auto& f : files) {
-            QString qFile = QString::fromStdString(std::filesystem::path(f).filename().string());
+            // Key by full path so same-named files in different folders stay apart
+            QString qFile = QString::fromStdString(f);
             
             Node* fileNode;
             if (fileNodes.find(qFile) == fileNodes.end()) {
-                fileNode = new Node(this, Node::File, qFile);
+                fileNode = new Node(this, Node::File, QString::fromStdString(std::filesystem::path(f).filename().string()));
                 fileNode->setPos(
                     QRandomGenerator::global()->bounded(400) - 200, 
                     QRandomGenerator::global()->bounded(400) - 200
@@ -8,7 +8,7 @@
 
 class Node;
 class Edge;
-class TagManager;
+class TagWorkspace;
 class GraphWidget; // Forward declaration
 
 // --- Edge Class ---
@@ -78,10 +78,11 @@ class GraphWidget : public QGraphicsView
     Q_OBJECT
 
 public:
-    GraphWidget(TagManager* tagMgr, QWidget *parent = nullptr);
+    GraphWidget(TagWorkspace* tagWorkspace, QWidget *parent = nullptr);
     
     void itemMoved();
-    void buildGraph(); // Rebuilds graph from TagManager
+    void setScope(const QString& folder); // Only show roots at or below this folder
+    void buildGraph(); // Rebuilds graph from TagWorkspace
 
 public slots:
     void zoomIn();
@@ -95,7 +96,8 @@ protected:
 
 private:
     int timerId;
-    TagManager* tagManager;
+    TagWorkspace* workspace;
+    QString scope;
     Node *centerNode;
     
     std::map<QString, Node*> fileNodes;
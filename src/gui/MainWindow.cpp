@@ -1,6 +1,8 @@
 #include "MainWindow.h"
 #include "../core/FileScanner.h"
 #include "../core/DocumentParser.h"
+#include "../core/FileIdentity.h"
+#include "../core/ImageLoader.h"
 
 #include <QFileDialog>
 #include <QMessageBox>
@@ -11,9 +13,31 @@
 #include <QMenu>
 #include <QAction>
 #include <QCursor>
+#include <QStandardPaths>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QSpinBox>
+#include <QComboBox>
+#include <QTableWidget>
+#include <QHeaderView>
+#include <QTimer>
 #include <fstream>
 #include <algorithm>
 #include <set>
+#include <map>
+#include <chrono>
+#include <thread>
+
+// Longest a single analysis may take, waiting for a context included
+static constexpr auto kAnalysisDeadline = std::chrono::minutes(5);
+
+// Changes whenever the file content is likely to have changed
+static std::string contentStamp(const std::string& path)
+{
+    FileIdentity id = FileIdentity::stat(path);
+    return std::to_string(id.size) + ":" + std::to_string(id.mtime);
+}
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -23,12 +47,37 @@ MainWindow::MainWindow(QWidget *parent)
     mainLayout = new QVBoxLayout(centralWidget);
     mainLayout->setContentsMargins(0, 0, 0, 0);
 
+    // Global tag index across every folder ever opened
+    workspace.open(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation).toStdString() + "/workspace.json");
+
+    InferenceProfile profile;
+    profile.load(profilePath());
+    llamaEngine.setProfile(profile);
+
+    inferenceCache.open(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation).toStdString() + "/inference_cache.json");
+    llamaEngine.setCache(&inferenceCache);
+    llamaEngine.setTelemetry(&telemetry);
+    llamaEngine.setImageCacheDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation).toStdString() + "/image_embeddings");
+    httpBackend.setCache(&inferenceCache);
+    applyBackend(profile);
+
     setupToolbar();
     setupLayout();
 
-    // Initialize watcher
-    watcher = new QFutureWatcher<std::string>(this);
-    connect(watcher, &QFutureWatcher<std::string>::finished, this, &MainWindow::onAnalysisFinished);
+    indexWatcher = new QFutureWatcher<int>(this);
+    connect(indexWatcher, &QFutureWatcher<int>::finished, this, &MainWindow::onIndexFinished);
+
+    searchWatcher = new QFutureWatcher<SearchResult>(this);
+    connect(searchWatcher, &QFutureWatcher<SearchResult>::finished, this, &MainWindow::onSearchFinished);
+
+    reconcileWatcher = new QFutureWatcher<int>(this);
+    connect(reconcileWatcher, &QFutureWatcher<int>::finished, this, &MainWindow::onReconcileFinished);
+
+    loadWatcher = new QFutureWatcher<bool>(this);
+    connect(loadWatcher, &QFutureWatcher<bool>::finished, this, &MainWindow::onModelLoaded);
+
+    pipelineTimer = new QTimer(this);
+    connect(pipelineTimer, &QTimer::timeout, this, &MainWindow::onPipelineProgress);
 
     resize(1200, 800);
     setWindowTitle("Smart File Organizer");
@@ -36,6 +85,24 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    cancelLoad = true;
+    loadWatcher->waitForFinished();
+    indexWatcher->waitForFinished();
+    searchWatcher->waitForFinished();
+    reconcileWatcher->waitForFinished();
+    vectorSweep.waitForFinished();
+    for (auto& a : analyses) *a.cancel = true;
+    for (auto& a : analyses) a.watcher->waitForFinished();
+    if (pipeline) {
+        jobs.stop();
+        pipeline->cancel();
+        pipeline->wait();
+    }
+    jobSync.waitForFinished();
+    syncJobs();
+    jobs.close();
+    vectorIndex.close();
+    inferenceCache.flush();
 }
 
 void MainWindow::setupToolbar()
@@ -52,6 +119,35 @@ void MainWindow::setupToolbar()
     actLoadModel->setToolTip("請選擇 ggml-model-*.gguf 檔案");
     connect(actLoadModel, &QAction::triggered, this, &MainWindow::loadModel);
 
+    QAction *actDraft = toolbar->addAction("載入草稿模型 (Load Draft Model)");
+    actDraft->setToolTip("同詞彙表的小模型，用於推測解碼加速生成 (speculative decoding)");
+    connect(actDraft, &QAction::triggered, this, &MainWindow::loadDraftModel);
+
+    QAction *actVision = toolbar->addAction("載入視覺投影 (Load Vision Projector)");
+    actVision->setToolTip("與主模型配套的 mmproj-*.gguf，可依圖片內容產生標籤");
+    connect(actVision, &QAction::triggered, this, &MainWindow::loadProjector);
+
+    QAction *actProfile = toolbar->addAction("推論設定 (Inference Settings)");
+    actProfile->setToolTip("執行緒、批次大小、KV 快取等設定，可自動調校");
+    connect(actProfile, &QAction::triggered, this, &MainWindow::editInferenceProfile);
+
+    actAnalyzeFolder = toolbar->addAction("分析整個資料夾 (Analyze Folder)");
+    actAnalyzeFolder->setToolTip("為目前資料夾中尚無標籤的檔案產生標籤；進度存於 .smartfile，關閉程式後可接續");
+    connect(actAnalyzeFolder, &QAction::triggered, this, &MainWindow::analyzeFolder);
+
+    actPauseFolder = toolbar->addAction("暫停 (Pause)");
+    actPauseFolder->setToolTip("暫停資料夾分析；已送出的檔案仍會完成");
+    actPauseFolder->setEnabled(false);
+    connect(actPauseFolder, &QAction::triggered, this, &MainWindow::pauseFolder);
+
+    QAction *actTelemetry = toolbar->addAction("效能統計 (Performance)");
+    actTelemetry->setToolTip("每次推論的排隊、預填、解碼時間與速度分佈，可匯出 JSON/CSV");
+    connect(actTelemetry, &QAction::triggered, this, &MainWindow::showTelemetry);
+
+    QAction *actIndex = toolbar->addAction("建立語意索引 (Build Index)");
+    actIndex->setToolTip("為目前資料夾的檔案計算語意向量，以便用意思搜尋");
+    connect(actIndex, &QAction::triggered, this, &MainWindow::buildSemanticIndex);
+
     toolbar->addSeparator();
     
     // Add Checkbox to Toolbar
@@ -62,6 +158,16 @@ void MainWindow::setupToolbar()
         if (!currentPath.isEmpty()) scanFiles();
     });
     toolbar->addWidget(chkRecursive);
+
+    chkPropagate = new QCheckBox("沿用相似檔案標籤 (Reuse similar files' tags)", this);
+    chkPropagate->setToolTip("分析時先參考語意索引中最相似且已標註的檔案，信心不足時才呼叫模型生成");
+    chkPropagate->setChecked(true);
+    toolbar->addWidget(chkPropagate);
+
+    chkFollowSelection = new QCheckBox("僅分析選取的檔案 (Follow selection)", this);
+    chkFollowSelection->setToolTip("選取其他檔案時，取消仍在進行的分析");
+    chkFollowSelection->setChecked(false);
+    toolbar->addWidget(chkFollowSelection);
 }
 
 void MainWindow::setupLayout()
@@ -110,7 +216,16 @@ void MainWindow::setupLayout()
     txtSearch = new QLineEdit(this);
     txtSearch->setPlaceholderText("搜尋檔案... (Search)");
     connect(txtSearch, &QLineEdit::textChanged, this, &MainWindow::filterFiles);
-    midLayout->addWidget(txtSearch);
+    connect(txtSearch, &QLineEdit::returnPressed, this, &MainWindow::semanticSearch);
+
+    chkSemantic = new QCheckBox("語意搜尋 (Semantic, 按 Enter)", this);
+    chkSemantic->setToolTip("依內容意思搜尋，例如「去年的報價單」");
+    connect(chkSemantic, &QCheckBox::toggled, [this](bool) { filterFiles(txtSearch->text()); });
+
+    QHBoxLayout *searchLayout = new QHBoxLayout();
+    searchLayout->addWidget(txtSearch);
+    searchLayout->addWidget(chkSemantic);
+    midLayout->addLayout(searchLayout);
 
     fileList = new QListWidget(this);
     fileList->setContextMenuPolicy(Qt::CustomContextMenu); // Enable context menu
@@ -191,6 +306,18 @@ void MainWindow::setupLayout()
     lblStatus->setWordWrap(true);
     rightLayout->addWidget(lblStatus);
 
+    // Model loading progress, only visible while loading
+    QHBoxLayout *loadLayout = new QHBoxLayout();
+    progressLoad = new QProgressBar(this);
+    progressLoad->setRange(0, 100);
+    loadLayout->addWidget(progressLoad);
+    btnCancelLoad = new QPushButton("取消 (Cancel)", this);
+    connect(btnCancelLoad, &QPushButton::clicked, this, &MainWindow::cancelModelLoad);
+    loadLayout->addWidget(btnCancelLoad);
+    rightLayout->addLayout(loadLayout);
+    progressLoad->setVisible(false);
+    btnCancelLoad->setVisible(false);
+
     rightLayout->addStretch();
     mainSplitter->addWidget(rightPanel);
 
@@ -203,7 +330,7 @@ void MainWindow::setupLayout()
     tabWidget->addTab(explorerTab, "📁 資料夾視圖 (Explorer)");
 
     // === Tab 2: Graph View ===
-    graphWidget = new GraphWidget(&tagManager, this);
+    graphWidget = new GraphWidget(&workspace, this);
     tabWidget->addTab(graphWidget, "🕸️ 關聯視圖 (Graph)");
 }
 
@@ -221,9 +348,29 @@ void MainWindow::openFolder()
                                                     | QFileDialog::DontResolveSymlinks);
 
     if (!dir.isEmpty()) {
+        if (indexWatcher->isRunning()) {
+            QMessageBox::warning(this, "Warning", "語意索引建立中，請稍候 (Index build in progress)");
+            return;
+        }
+        if (pipelineRunning()) {
+            QMessageBox::warning(this, "Warning", "資料夾分析中，請稍候或取消 (Folder analysis in progress)");
+            return;
+        }
+        vectorSweep.waitForFinished(); // Still on the old folder's index
         currentPath = dir;
-        tagManager.loadTags(currentPath.toStdString());
+        vectorIndex.close(); // Reopened for the new folder on first use
+        workspace.addRoot(currentPath.toStdString());
+        graphWidget->setScope(currentPath);
         scanFiles();
+
+        // A job cut short by closing the app or a crash picks up where it left off
+        jobs.open(currentPath.toStdString());
+        JobQueue::Counts job = jobs.counts();
+        if (job.remaining() > 0) {
+            lblStatus->setText(lblStatus->text() +
+                               QString(" - 資料夾分析尚有 %1 個檔案，按「分析整個資料夾」繼續 (%1 files left, Analyze Folder resumes)")
+                                   .arg(job.remaining()));
+        }
     }
 }
 
@@ -240,23 +387,86 @@ void MainWindow::scanFiles()
         item->setData(Qt::UserRole, QString::fromStdString(file)); // Store full relative path
         fileList->addItem(item);
     }
+
+    // Reattach tags of files that were moved or renamed outside the app. That
+    // stats and may fingerprint files, so it runs on a worker.
+    reconcileLater(files);
+
+    // Drop vectors of files that are gone; changed files are re-embedded by Build Index.
+    // That is a disk lookup per key, so it runs on a worker.
+    if (!indexWatcher->isRunning() && !vectorSweep.isRunning() && !backendBusy()) {
+        InferenceBackend *engine = backend;
+        std::string root = currentPath.toStdString();
+        vectorSweep = QtConcurrent::run([this, engine, root]() {
+            if (!ensureVectorIndex(engine, root)) return;
+            for (const auto& key : vectorIndex.keys()) {
+                std::error_code ec;
+                if (!std::filesystem::exists(std::filesystem::path(root) / key, ec)) vectorIndex.remove(key);
+            }
+            if (vectorIndex.tombstones() > vectorIndex.size()) vectorIndex.compact();
+            vectorIndex.flush();
+        });
+    }
     
     updateTagList();
     lblStatus->setText(QString("目前資料夾: %1 (找到 %2 個檔案)").arg(currentPath).arg(files.size()));
 }
 
+void MainWindow::reconcileLater(const std::vector<std::string>& files)
+{
+    if (reconcileWatcher->isRunning()) {
+        reconcileQueued = files; // Only the latest scan matters
+        reconcileAgain = true;
+        return;
+    }
+    reconcileWatcher->setFuture(QtConcurrent::run([this, files]() { return workspace.reconcile(files); }));
+}
+
+void MainWindow::onReconcileFinished()
+{
+    int moved = reconcileWatcher->result();
+    if (reconcileAgain) {
+        reconcileAgain = false;
+        std::vector<std::string> files;
+        files.swap(reconcileQueued);
+        reconcileLater(files);
+    }
+    if (moved <= 0) return;
+
+    updateTagList();
+    QString selected = selectedPath();
+    if (!selected.isEmpty()) updateTagDisplay(selected);
+    lblStatus->setText(lblStatus->text() + QString(" - 已找回 %1 個移動檔案的標籤").arg(moved));
+}
+
 void MainWindow::updateTagList()
 {
     tagListWidget->clear();
-    std::vector<std::string> tags = tagManager.getAllTags();
+    std::vector<std::string> tags = workspace.getAllTags(currentPath.toStdString());
     
     // Always add an "All Files" option
     QListWidgetItem* allItem = new QListWidgetItem("All Files");
     allItem->setData(Qt::UserRole, "ALL");
     tagListWidget->addItem(allItem);
 
+    // Counts come from the workspace index - no metadata scans here. Co-occurrence
+    // is looked up for the selected tag only, in onTagSelected().
+    std::string scope = currentPath.toStdString();
+    std::set<std::string> hot;
+    for (const auto& [tag, score] : workspace.trending(3, scope)) hot.insert(tag);
+
     for (const auto& tag : tags) {
-        tagListWidget->addItem(QString::fromStdString(tag));
+        QListWidgetItem* item = new QListWidgetItem(QString::fromStdString(tag));
+
+        QString tip = QString("%1 個檔案").arg(workspace.tagCount(tag, scope));
+        if (hot.count(tag)) {
+            tip += "\n🔥 近期熱門 (Trending)";
+            QFont font = item->font();
+            font.setBold(true);
+            item->setFont(font);
+        }
+        item->setToolTip(tip);
+        tagListWidget->addItem(item);
     }
 }
 
@@ -272,19 +482,32 @@ void MainWindow::onTagSelected(QListWidgetItem *item)
         }
     } else {
         // Filter by tag
-        std::vector<std::string> filesWithTag = tagManager.getFilesByTag(tag.toStdString());
+        std::vector<std::string> filesWithTag = workspace.getFilesByTag(tag.toStdString(), currentPath.toStdString());
         std::set<std::string> fileSet(filesWithTag.begin(), filesWithTag.end());
         
         for(int i=0; i<fileList->count(); ++i) {
             QListWidgetItem *fItem = fileList->item(i);
-            QString fname = fItem->text(); 
             
             // Check if this file is in the tag set
-            std::filesystem::path p(fname.toStdString());
-            std::string filenameOnly = p.filename().string();
+            std::string path = TagWorkspace::normalize(fItem->data(Qt::UserRole).toString().toStdString());
             
-            fItem->setHidden(fileSet.find(filenameOnly) == fileSet.end());
+            fItem->setHidden(fileSet.find(path) == fileSet.end());
+        }
+
+        // From the shards' incrementally maintained statistics
+        QStringList notes;
+        auto related = workspace.coOccurring(tag.toStdString(), 5, currentPath.toStdString());
+        if (!related.empty()) {
+            QStringList parts;
+            for (const auto& [other, n] : related) parts << QString("%1 (%2)").arg(QString::fromStdString(other)).arg(n);
+            notes << "常一起出現: " + parts.join(", ");
         }
+
+        // From the index's per-root counts; the other roots' shards stay unloaded
+        int elsewhere = workspace.tagCount(tag.toStdString()) - workspace.tagCount(tag.toStdString(), currentPath.toStdString());
+        if (elsewhere > 0) notes << QString("其他資料夾另有 %1 個檔案").arg(elsewhere);
+
+        if (!notes.isEmpty()) lblStatus->setText(QString("標籤 %1: ").arg(tag) + notes.join(" - "));
     }
 }
 
@@ -295,19 +518,465 @@ void MainWindow::loadModel()
                                                     "GGUF Models (*.gguf);;All Files (*)");
 
     if (!fileName.isEmpty()) {
-        lblStatus->setText("正在載入模型... (Loading Model...)");
-        QApplication::processEvents(); // Force update UI
+        startModelLoad(fileName);
+    }
+}
 
-        if (llamaEngine.loadModel(fileName.toStdString())) {
-            lblStatus->setText("模型載入成功! (Model loaded!)");
-            QMessageBox::information(this, "Success", "模型載入成功！");
+bool MainWindow::modelReady() const
+{
+    return !loadWatcher->isRunning() && llamaEngine.isModelLoaded();
+}
+
+bool MainWindow::backendBusy() const
+{
+    return backend == &llamaEngine && loadWatcher->isRunning();
+}
+
+void MainWindow::applyBackend(const InferenceProfile& profile)
+{
+    HttpBackend::Config config = httpBackend.getConfig();
+    config.endpoint = profile.endpoint;
+    config.model = profile.endpointModel;
+    config.apiKey = profile.resolveApiKey();
+    config.maxInFlight = profile.maxInFlight;
+    httpBackend.setConfig(config);
+
+    InferenceBackend *next = &llamaEngine;
+    if (profile.backend == "http") next = &httpBackend;
+    else if (profile.backend == "mock") next = &mockBackend;
+
+    // Vectors from different backends can't be compared; ensureVectorIndex()
+    // switches to the new backend's own index and leaves this one on disk
+    backend = next;
+    propagator.setBackend(*backend);
+}
+
+void MainWindow::startModelLoad(const QString& path)
+{
+    // The engine is replaced underneath anything still using it; searches and
+    // the vector sweep embed with it too
+    if (loadWatcher->isRunning() || !analyses.isEmpty() || indexWatcher->isRunning() || pipelineRunning() ||
+        searchWatcher->isRunning() || vectorSweep.isRunning()) {
+        QMessageBox::warning(this, "Warning", "請等待目前的工作完成 (Wait for the running task to finish)");
+        return;
+    }
+
+    lblStatus->setText("正在載入模型... (Loading Model...)");
+    progressLoad->setValue(0);
+    progressLoad->setVisible(true);
+    btnCancelLoad->setVisible(true);
+    btnCancelLoad->setEnabled(true);
+    cancelLoad = false;
+
+    loadWatcher->setFuture(QtConcurrent::run([this, path]() {
+        bool loaded = llamaEngine.loadModel(path.toStdString(), [this](float p) {
+            QMetaObject::invokeMethod(progressLoad, "setValue", Qt::QueuedConnection, Q_ARG(int, int(p * 100)));
+            return !cancelLoad;
+        });
+        if (loaded && llamaEngine.getProfile().warmUp && !cancelLoad) {
+            QMetaObject::invokeMethod(lblStatus, "setText", Qt::QueuedConnection,
+                                      Q_ARG(QString, "正在預熱模型... (Warming up...)"));
+            llamaEngine.warmUp();
+        }
+        return loaded;
+    }));
+}
+
+void MainWindow::cancelModelLoad()
+{
+    cancelLoad = true;
+    btnCancelLoad->setEnabled(false);
+    lblStatus->setText("正在取消... (Cancelling...)");
+}
+
+void MainWindow::onModelLoaded()
+{
+    progressLoad->setVisible(false);
+    btnCancelLoad->setVisible(false);
+
+    if (!loadWatcher->result()) {
+        pendingAnalyses.clear();
+        if (cancelLoad) {
+            lblStatus->setText(llamaEngine.isModelLoaded() ? "已取消載入，沿用原模型 (Model loading cancelled, previous model kept)"
+                                                           : "已取消載入模型 (Model loading cancelled)");
         } else {
             lblStatus->setText("模型載入失敗 (Failed to load model)");
             QMessageBox::critical(this, "Error", "模型載入失敗 (Failed to load model)");
         }
+        return;
+    }
+
+    const LlamaEngine::LoadReport& load = llamaEngine.getLoadReport();
+    QString status = "模型載入成功! (Model loaded!) " + QString::fromStdString(llamaEngine.getProfile().describe()) +
+                     QString(" - n_ctx %1 x%2").arg(llamaEngine.contextSize()).arg(llamaEngine.contextCount()) +
+                     " - " + QString::fromStdString(load.estimate.describe(load.contexts));
+    if (load.contexts < llamaEngine.getProfile().contexts) {
+        status += QString(" - 記憶體只夠 %1 個上下文 (Only %1 contexts fit)").arg(load.contexts);
+    }
+    if (load.f16Fallback) status += " - 無 flash attention，V 快取改用 f16 (No flash attention, f16 V cache)";
+    lblStatus->setText(status);
+    // All at once; they wait for a free context inside the engine
+    while (!pendingAnalyses.isEmpty()) {
+        startAnalysis(pendingAnalyses.takeFirst());
+    }
+}
+
+void MainWindow::loadDraftModel()
+{
+    if (!modelReady()) {
+        QMessageBox::warning(this, "Warning", "請先載入主模型 (Load the main model first)");
+        return;
+    }
+    QString fileName = QFileDialog::getOpenFileName(this, "載入草稿模型 (Load Draft Model)",
+                                                    QString(),
+                                                    "GGUF Models (*.gguf);;All Files (*)");
+
+    if (!fileName.isEmpty()) {
+        if (llamaEngine.loadDraftModel(fileName.toStdString())) {
+            lblStatus->setText("草稿模型載入成功 (Draft model loaded)");
+        } else {
+            lblStatus->setText("草稿模型載入失敗，詞彙表需與主模型相同 (Draft model failed; vocab must match)");
+        }
+    }
+}
+
+void MainWindow::loadProjector()
+{
+    if (!modelReady()) {
+        QMessageBox::warning(this, "Warning", "請先載入主模型 (Load the main model first)");
+        return;
+    }
+    if (!analyses.isEmpty() || pipelineRunning()) {
+        QMessageBox::warning(this, "Warning", "請等待分析完成 (Wait for the running analysis)");
+        return;
+    }
+    QString fileName = QFileDialog::getOpenFileName(this, "載入視覺投影 (Load Vision Projector)",
+                                                    QString(),
+                                                    "GGUF Models (mmproj*.gguf *.gguf);;All Files (*)");
+
+    if (!fileName.isEmpty()) {
+        if (llamaEngine.loadProjector(fileName.toStdString())) {
+            lblStatus->setText("視覺投影載入成功，圖片將依內容分析 (Vision projector loaded)");
+        } else {
+            lblStatus->setText("視覺投影載入失敗，需與主模型配套 (Projector failed; it must match the model)");
+        }
     }
 }
 
+std::string MainWindow::profilePath() const
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation).toStdString() + "/inference.json";
+}
+
+void MainWindow::editInferenceProfile()
+{
+    QDialog dialog(this);
+    dialog.setWindowTitle("推論設定 (Inference Settings)");
+    QFormLayout *form = new QFormLayout(&dialog);
+
+    auto spin = [&dialog](int min, int max) {
+        QSpinBox *box = new QSpinBox(&dialog);
+        box->setRange(min, max);
+        return box;
+    };
+    QComboBox *cmbBackend = new QComboBox(&dialog);
+    cmbBackend->addItem("llama.cpp (本機 in process)", "llama");
+    cmbBackend->addItem("HTTP (OpenAI 相容 compatible)", "http");
+    cmbBackend->addItem("Mock (測試 testing)", "mock");
+    QLineEdit *txtEndpoint = new QLineEdit(&dialog);
+    txtEndpoint->setPlaceholderText("http://localhost:8080/v1");
+    QLineEdit *txtEndpointModel = new QLineEdit(&dialog);
+    QLineEdit *txtApiKey = new QLineEdit(&dialog);
+    txtApiKey->setEchoMode(QLineEdit::Password);
+    txtApiKey->setToolTip("以純文字儲存於設定檔；留空則使用環境變數 SMARTFILE_API_KEY "
+                          "(Stored in plain text in the profile; leave empty to use SMARTFILE_API_KEY)");
+    QSpinBox *spinInFlight = spin(1, 256);
+
+    QSpinBox *spinGpu = spin(0, 999);
+    QSpinBox *spinCtx = spin(0, 262144);
+    spinCtx->setSingleStep(1024);
+    spinCtx->setSpecialValueText("自動 (auto)");
+    QSpinBox *spinContexts = spin(1, 64);
+    QSpinBox *spinThreads = spin(0, 1024);
+    spinThreads->setSpecialValueText("自動 (auto)");
+    QSpinBox *spinBatchThreads = spin(0, 1024);
+    spinBatchThreads->setSpecialValueText("自動 (auto)");
+    QSpinBox *spinBatch = spin(32, 65536);
+    QSpinBox *spinUbatch = spin(32, 65536);
+    QComboBox *cmbFlash = new QComboBox(&dialog);
+    cmbFlash->addItems({"auto", "on", "off"});
+    QComboBox *cmbKv = new QComboBox(&dialog);
+    cmbKv->addItems({"f16", "q8_0", "q4_0"});
+    QCheckBox *chkMmap = new QCheckBox(&dialog);
+    QCheckBox *chkMlock = new QCheckBox(&dialog);
+    QCheckBox *chkWarmUp = new QCheckBox(&dialog);
+    QCheckBox *chkSummarize = new QCheckBox(&dialog);
+    chkSummarize->setToolTip("超出提示長度的內容分段摘要後再產生標籤，而非只取開頭、中段與結尾");
+    QSpinBox *spinFolderRate = spin(0, 100000);
+    spinFolderRate->setSpecialValueText("不限 (unlimited)");
+    spinFolderRate->setSuffix(" / min");
+    QSpinBox *spinDraft = spin(0, 64);
+    spinDraft->setSpecialValueText("關閉 (off)");
+    spinDraft->setToolTip("載入草稿模型後，每步預測的 token 數 (Tokens the draft model proposes per step)");
+
+    auto fill = [&](const InferenceProfile& p) {
+        cmbBackend->setCurrentIndex(std::max(0, cmbBackend->findData(QString::fromStdString(p.backend))));
+        txtEndpoint->setText(QString::fromStdString(p.endpoint));
+        txtEndpointModel->setText(QString::fromStdString(p.endpointModel));
+        txtApiKey->setText(QString::fromStdString(p.apiKey));
+        spinInFlight->setValue(p.maxInFlight);
+        spinGpu->setValue(p.gpuLayers);
+        spinCtx->setValue(p.contextSize);
+        spinContexts->setValue(p.contexts);
+        spinThreads->setValue(p.threads);
+        spinBatchThreads->setValue(p.batchThreads);
+        spinBatch->setValue(p.batchSize);
+        spinUbatch->setValue(p.ubatchSize);
+        cmbFlash->setCurrentText(QString::fromStdString(p.flashAttention));
+        cmbKv->setCurrentText(QString::fromStdString(p.kvCacheType));
+        chkMmap->setChecked(p.useMmap);
+        chkMlock->setChecked(p.useMlock);
+        chkWarmUp->setChecked(p.warmUp);
+        chkSummarize->setChecked(p.summarizeLongContent);
+        spinFolderRate->setValue(p.folderFilesPerMinute);
+        spinDraft->setValue(p.draftLength);
+    };
+    fill(llamaEngine.getProfile());
+
+    auto read = [&]() {
+        InferenceProfile p = llamaEngine.getProfile();
+        p.backend = cmbBackend->currentData().toString().toStdString();
+        p.endpoint = txtEndpoint->text().trimmed().toStdString();
+        p.endpointModel = txtEndpointModel->text().trimmed().toStdString();
+        p.apiKey = txtApiKey->text().toStdString();
+        p.maxInFlight = spinInFlight->value();
+        p.gpuLayers = spinGpu->value();
+        p.contextSize = spinCtx->value();
+        p.contexts = spinContexts->value();
+        p.threads = spinThreads->value();
+        p.batchThreads = spinBatchThreads->value();
+        p.batchSize = spinBatch->value();
+        p.ubatchSize = spinUbatch->value();
+        p.flashAttention = cmbFlash->currentText().toStdString();
+        p.kvCacheType = cmbKv->currentText().toStdString();
+        p.useMmap = chkMmap->isChecked();
+        p.useMlock = chkMlock->isChecked();
+        p.warmUp = chkWarmUp->isChecked();
+        p.summarizeLongContent = chkSummarize->isChecked();
+        p.folderFilesPerMinute = spinFolderRate->value();
+        p.draftLength = spinDraft->value();
+        return p;
+    };
+
+    form->addRow("推論後端 (Backend)", cmbBackend);
+    form->addRow("伺服器位址 (Endpoint)", txtEndpoint);
+    form->addRow("伺服器模型 (Endpoint model)", txtEndpointModel);
+    form->addRow("API 金鑰 (API key)", txtApiKey);
+    form->addRow("同時請求數 (Requests in flight)", spinInFlight);
+    auto updateBackend = [&]() {
+        bool http = cmbBackend->currentData().toString() == "http";
+        for (QWidget *w : std::initializer_list<QWidget*>{txtEndpoint, txtEndpointModel, txtApiKey, spinInFlight}) {
+            w->setEnabled(http);
+        }
+    };
+    connect(cmbBackend, &QComboBox::currentIndexChanged, &dialog, updateBackend);
+    updateBackend();
+
+    form->addRow("GPU 層數 (GPU layers)", spinGpu);
+    form->addRow("上下文長度 (Context size)", spinCtx);
+    form->addRow("並行工作數 (Parallel contexts)", spinContexts);
+    form->addRow("生成執行緒 (Threads)", spinThreads);
+    form->addRow("提示執行緒 (Batch threads)", spinBatchThreads);
+    form->addRow("批次大小 (Batch size)", spinBatch);
+    form->addRow("實體批次 (Ubatch size)", spinUbatch);
+    form->addRow("Flash attention", cmbFlash);
+    form->addRow("KV 快取類型 (KV cache type)", cmbKv);
+    form->addRow("記憶體映射 (mmap)", chkMmap);
+    form->addRow("鎖定記憶體 (mlock)", chkMlock);
+    form->addRow("載入後預熱 (Warm up after loading)", chkWarmUp);
+    form->addRow("長文件分段摘要 (Summarize long documents)", chkSummarize);
+    form->addRow("資料夾分析速率 (Folder analysis rate)", spinFolderRate);
+    form->addRow("推測解碼長度 (Draft length)", spinDraft);
+
+    // What the settings would cost with the loaded model, updated as they change
+    QLabel *lblMemory = new QLabel(&dialog);
+    lblMemory->setWordWrap(true);
+    form->addRow("預估記憶體 (Memory estimate)", lblMemory);
+    auto updateMemory = [&]() {
+        if (!modelReady()) {
+            lblMemory->setText("載入模型後顯示 (Shown once a model is loaded)");
+            return;
+        }
+        InferenceProfile p = read();
+        InferenceProfile::MemoryEstimate e = llamaEngine.estimateMemory(p);
+        int fit = p.contextsThatFit(e);
+        QString text = QString::fromStdString(e.describe(fit));
+        if (fit < p.contexts) text += QString("\n記憶體只夠 %1 個上下文 (Only %1 contexts fit)").arg(fit);
+        lblMemory->setText(text);
+    };
+    for (QSpinBox *box : {spinCtx, spinContexts, spinUbatch}) {
+        connect(box, &QSpinBox::valueChanged, &dialog, updateMemory);
+    }
+    for (QComboBox *box : {cmbFlash, cmbKv}) {
+        connect(box, &QComboBox::currentTextChanged, &dialog, updateMemory);
+    }
+    updateMemory();
+
+    // Benchmarks on a worker thread; the dialog stays responsive and shows each measurement
+    QPushButton *btnTune = new QPushButton("自動調校 (Auto-Tune)", &dialog);
+    QLabel *lblTune = new QLabel(&dialog);
+    lblTune->setWordWrap(true);
+    form->addRow(btnTune, lblTune);
+
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+    form->addRow(buttons);
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+
+    QFutureWatcher<InferenceProfile> tuneWatcher;
+    connect(&tuneWatcher, &QFutureWatcher<InferenceProfile>::finished, &dialog, [&]() {
+        fill(tuneWatcher.result());
+        lblTune->setText("已套用最快的穩定設定 (Fastest stable settings applied)");
+        btnTune->setEnabled(true);
+        buttons->setEnabled(true);
+    });
+    connect(btnTune, &QPushButton::clicked, &dialog, [&]() {
+        if (!modelReady()) {
+            QMessageBox::warning(&dialog, "Warning", "請先載入模型 (Load a model first)");
+            return;
+        }
+        if (!analyses.isEmpty() || indexWatcher->isRunning() || pipelineRunning()) {
+            QMessageBox::warning(&dialog, "Warning", "請等待分析完成 (Wait for the running analysis)");
+            return;
+        }
+        btnTune->setEnabled(false);
+        buttons->setEnabled(false);
+        lblTune->setText("測試中... (Benchmarking...)");
+        tuneWatcher.setFuture(QtConcurrent::run([this, lblTune]() {
+            return llamaEngine.autoTune([lblTune](const std::string& line) {
+                QMetaObject::invokeMethod(lblTune, "setText", Qt::QueuedConnection,
+                                          Q_ARG(QString, QString::fromStdString(line)));
+            });
+        }));
+    });
+
+    bool accepted = dialog.exec() == QDialog::Accepted;
+    tuneWatcher.waitForFinished();
+    if (!accepted) return;
+
+    InferenceProfile profile = read();
+    if (profile.backend != llamaEngine.getProfile().backend &&
+        (!analyses.isEmpty() || indexWatcher->isRunning() || pipelineRunning())) {
+        QMessageBox::warning(this, "Warning", "分析進行中，推論後端未變更 (Backend not changed while analyses are running)");
+        profile.backend = llamaEngine.getProfile().backend;
+    }
+    llamaEngine.setProfile(profile);
+    profile.save(profilePath());
+    jobs.setRateLimit(profile.folderFilesPerMinute); // Applies to a running job right away
+    applyBackend(profile);
+    lblStatus->setText("推論後端 (Backend): " + QString::fromStdString(backend->name()));
+
+    // Contexts only pick the profile up when created
+    if (profile.backend == "llama" && modelReady()) {
+        startModelLoad(QString::fromStdString(llamaEngine.getModelPath()));
+    }
+}
+
+void MainWindow::showTelemetry()
+{
+    QDialog dialog(this);
+    dialog.setWindowTitle("效能統計 (Performance)");
+    dialog.resize(760, 460);
+    QVBoxLayout *layout = new QVBoxLayout(&dialog);
+
+    QLabel *lblSummary = new QLabel(&dialog);
+    lblSummary->setWordWrap(true);
+    layout->addWidget(lblSummary);
+
+    const QStringList columns = {"次數 (Count)", "平均 (Mean)", "p50", "p90", "p99", "最大 (Max)"};
+    QTableWidget *table = new QTableWidget(InferenceTelemetry::MetricCount, columns.size(), &dialog);
+    table->setHorizontalHeaderLabels(columns);
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    for (int m = 0; m < InferenceTelemetry::MetricCount; ++m) {
+        table->setVerticalHeaderItem(m, new QTableWidgetItem(InferenceTelemetry::metricName(InferenceTelemetry::Metric(m))));
+    }
+    layout->addWidget(table);
+
+    auto refresh = [this, table, lblSummary]() {
+        QString text = QString::fromStdString(telemetry.summary()) +
+                       QString("\n快取命中 (cache hits) %1, 未命中 (misses) %2")
+                           .arg(inferenceCache.hits()).arg(inferenceCache.misses());
+        // Single-file generations, where a draft model speeds up decoding
+        LlamaEngine::DecodeStats decode = llamaEngine.getDecodeStats();
+        if (decode.tokens > 0) {
+            text += QString("\n解碼 (decode) %1 tok/s").arg(decode.tokensPerSecond(), 0, 'f', 1);
+            if (decode.drafted > 0) {
+                text += QString(", 草稿接受率 (draft acceptance) %1% (%2/%3)")
+                            .arg(decode.acceptanceRate() * 100, 0, 'f', 1).arg(decode.accepted).arg(decode.drafted);
+            }
+        }
+        lblSummary->setText(text);
+        for (int m = 0; m < InferenceTelemetry::MetricCount; ++m) {
+            Histogram h = telemetry.histogram(InferenceTelemetry::Metric(m));
+            const double values[] = {double(h.count()), h.mean(), h.percentile(50), h.percentile(90),
+                                     h.percentile(99), h.max()};
+            for (int c = 0; c < 6; ++c) {
+                QString text = c == 0 ? QString::number(h.count()) : QString::number(values[c], 'f', 1);
+                table->setItem(m, c, new QTableWidgetItem(h.count() ? text : "-"));
+            }
+        }
+    };
+    refresh();
+
+    // Live while open, analyses keep running meanwhile
+    QTimer timer;
+    connect(&timer, &QTimer::timeout, &dialog, refresh);
+    timer.start(1000);
+
+    QHBoxLayout *buttons = new QHBoxLayout();
+    QPushButton *btnJson = new QPushButton("匯出 JSON (Export JSON)", &dialog);
+    QPushButton *btnCsv = new QPushButton("匯出 CSV (Export CSV)", &dialog);
+    QPushButton *btnReset = new QPushButton("清除 (Reset)", &dialog);
+    QPushButton *btnClose = new QPushButton("關閉 (Close)", &dialog);
+    buttons->addWidget(btnJson);
+    buttons->addWidget(btnCsv);
+    buttons->addWidget(btnReset);
+    buttons->addStretch();
+    buttons->addWidget(btnClose);
+    layout->addLayout(buttons);
+
+    connect(btnJson, &QPushButton::clicked, &dialog, [this, &dialog]() {
+        QString file = QFileDialog::getSaveFileName(&dialog, "匯出 (Export)", "telemetry.json", "JSON (*.json)");
+        if (file.isEmpty()) return;
+        // What the numbers were measured with, for comparing machines and builds
+        nlohmann::json extra;
+        extra["backend"] = backend->name();
+        extra["model"] = llamaEngine.getModelPath();
+        extra["profile"] = llamaEngine.getProfile().toJson();
+        extra["contexts"] = llamaEngine.contextCount();
+        extra["context_size"] = llamaEngine.contextSize();
+        if (!telemetry.writeJson(file.toStdString(), extra)) {
+            QMessageBox::critical(&dialog, "Error", "無法寫入檔案 (Cannot write file)");
+        }
+    });
+    connect(btnCsv, &QPushButton::clicked, &dialog, [this, &dialog]() {
+        QString file = QFileDialog::getSaveFileName(&dialog, "匯出 (Export)", "telemetry.csv", "CSV (*.csv)");
+        if (file.isEmpty()) return;
+        if (!telemetry.writeCsv(file.toStdString())) {
+            QMessageBox::critical(&dialog, "Error", "無法寫入檔案 (Cannot write file)");
+        }
+    });
+    connect(btnReset, &QPushButton::clicked, &dialog, [this, refresh]() {
+        telemetry.reset();
+        llamaEngine.resetDecodeStats();
+        refresh();
+    });
+    connect(btnClose, &QPushButton::clicked, &dialog, &QDialog::accept);
+
+    dialog.exec();
+}
+
 void MainWindow::analyzeFile()
 {
     QList<QListWidgetItem*> selectedItems = fileList->selectedItems();
@@ -316,97 +985,406 @@ void MainWindow::analyzeFile()
         return;
     }
 
-    QString relPath = selectedItems.first()->data(Qt::UserRole).toString();
-    QString filename = selectedItems.first()->text();
+    // The button doubles as Cancel while this file is being analyzed
+    auto running = analyses.find(selectedPath());
+    if (running != analyses.end()) {
+        *running->cancel = true;
+        lblStatus->setText("正在取消分析... (Cancelling...)");
+        return;
+    }
 
-    std::filesystem::path path(currentPath.toStdString());
-    path /= relPath.toStdString();
-    QString filePath = QString::fromStdString(path.string());
-    
-    std::string content = "";
-    std::string ext = path.extension().string();
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-    
-    static const std::set<std::string> textExts = {
-        ".txt", ".md", ".log", ".tex", ".rtf",
-        ".cpp", ".h", ".c", ".hpp", ".cs", ".java", ".py", ".js", ".ts", 
-        ".html", ".css", ".json", ".xml", ".yaml", ".yml", ".ini", ".conf", ".env",
-        ".bat", ".sh", ".ps1", ".go", ".rs", ".lua", ".sql", ".php"
+    QString path = selectedPath();
+    if (backendBusy()) {
+        // Runs as soon as the model is ready, even if another folder is open by then
+        if (!pendingAnalyses.contains(path)) pendingAnalyses.append(path);
+        lblStatus->setText(QString("模型載入中，已排入佇列 (Queued until the model is ready): %1 個檔案")
+                               .arg(pendingAnalyses.size()));
+        return;
+    }
+    startAnalysis(path);
+}
+
+void MainWindow::analyzeFolder()
+{
+    // The action doubles as Cancel while a run is going
+    if (pipelineRunning()) {
+        jobs.stop();
+        pipeline->cancel();
+        lblStatus->setText("正在取消資料夾分析... (Cancelling...)");
+        return;
+    }
+    if (currentPath.isEmpty()) {
+        QMessageBox::warning(this, "Warning", "請先開啟資料夾 (Open a folder first)");
+        return;
+    }
+    if (backendBusy() || !backend->isReady()) {
+        QMessageBox::warning(this, "Warning", "請先載入模型 (Load a model first)");
+        return;
+    }
+    if (indexWatcher->isRunning()) {
+        QMessageBox::warning(this, "Warning", "語意索引建立中，請稍候 (Index build in progress)");
+        return;
+    }
+    if (pipeline) pipeline->wait();
+
+    // Parsing gets a few cores, decoding keeps the rest
+    AnalysisPipeline::Config config;
+    int hw = (int) std::max(1u, std::thread::hardware_concurrency());
+    config.extractWorkers = std::clamp(hw / 4, 1, 4);
+    config.maxImageSide = LlamaEngine::kMaxImageSide;
+    if (backend == &llamaEngine) {
+        config.inferWorkers = std::max(1, llamaEngine.contextCount());
+        config.batchSize = LlamaEngine::kParallelSequences;
+    } else if (backend == &httpBackend) {
+        config.batchSize = std::max(1, llamaEngine.getProfile().maxInFlight);
+    }
+    // Pause and priorities act on what the job hands out, so only about a batch runs ahead
+    config.feedCapacity = size_t(config.batchSize) * config.inferWorkers;
+
+    std::string root = currentPath.toStdString();
+    std::vector<std::string> files;
+    for (int i = 0; i < fileList->count(); ++i) {
+        files.push_back((std::filesystem::path(root) / fileList->item(i)->data(Qt::UserRole).toString().toStdString()).string());
+    }
+    jobs.setRateLimit(llamaEngine.getProfile().folderFilesPerMinute);
+    jobs.setPaused(false);
+    jobs.start();
+    updateJobPriorities();
+
+    // Looking up the tags of every file is left to the scan thread, on its first call
+    auto prepared = std::make_shared<bool>(false);
+    AnalysisPipeline::Source source = [this, root, files, prepared](std::string& path) {
+        if (!*prepared) {
+            *prepared = true;
+            // Untagged files join the job; what an earlier run finished stays finished
+            if (jobs.root() != root) jobs.open(root);
+            std::vector<std::string> untagged;
+            for (const auto& file : files) {
+                if (workspace.getTags(file).empty()) untagged.push_back(file);
+            }
+            jobs.add(untagged);
+            jobs.retryFailed(); // Asking again gives failed files another round
+        }
+        while (jobs.next(path)) {
+            if (workspace.getTags(path).empty()) return true;
+            jobs.complete(path, "(tagged meanwhile)"); // Someone was quicker; leave their tags alone
+        }
+        return false;
     };
 
-    if (textExts.count(ext)) {
-        try {
-            std::ifstream f(filePath.toStdString());
-            if (f.is_open()) {
-                std::stringstream buffer;
-                buffer << f.rdbuf(); // Read full content
-                content = buffer.str();
-                lblStatus->setText(QString("正在分析檔案內容... (%1 chars)").arg(content.length()));
+    InferenceBackend *engine = backend;
+
+    // Files whose nearest tagged neighbours agree take their tags; only the rest are generated
+    AnalysisPipeline::PropagateFn propagate;
+    if (chkPropagate->isChecked()) {
+        propagate = [this, engine, root](std::vector<AnalysisPipeline::Item*>& items) {
+            if (!ensureVectorIndex(engine, root)) return;
+            std::vector<std::string> texts;
+            for (const auto* item : items) texts.push_back(TagPropagator::embeddingText(item->filename, item->content));
+            std::vector<std::vector<float>> vectors = engine->embedBatch(texts);
+            auto tagsOf = [this, root](const std::string& k) {
+                return workspace.getTags((std::filesystem::path(root) / k).string());
+            };
+            for (size_t i = 0; i < items.size() && i < vectors.size(); ++i) {
+                AnalysisPipeline::Item& item = *items[i];
+                item.embedding = std::move(vectors[i]);
+                TagPropagator::Result r;
+                if (propagator.vote(indexKey(item.path), item.embedding, tagsOf, r)) item.result = r.text;
             }
-        } catch (...) {}
-    } 
-    else if (ext == ".docx" || ext == ".xlsx" || ext == ".pptx" || 
-             ext == ".odt" || ext == ".odf" || 
-             ext == ".html" || ext == ".htm" || ext == ".shtml" || ext == ".xhtml" || 
-             ext == ".pdf") {
-        lblStatus->setText(QString("正在解析文件內容: %1").arg(filename));
-        content = DocumentParser::extractText(filePath.toStdString());
-    }
-    else {
-        lblStatus->setText("正在分析檔名...");
+        };
+    }
+
+    auto persist = [this, engine, root](const AnalysisPipeline::Item& item) {
+        if (item.result.empty() || item.result.rfind("Error:", 0) == 0) {
+            jobs.complete(item.path, item.result); // Retried later, with backoff
+            return;
+        }
+        std::vector<std::string> tags;
+        for (const QString& t : QString::fromStdString(item.result).split(',', Qt::SkipEmptyParts)) {
+            tags.push_back(t.trimmed().toStdString());
+        }
+        workspace.setTags(item.path, tags);
+
+        // Same text as a single analysis indexes; tags stand in for files without content
+        if (ensureVectorIndex(engine, root)) {
+            std::vector<float> v = item.embedding; // Left by propagation
+            if (v.empty()) {
+                const std::string& text = item.content.empty() ? item.result : item.content;
+                v = engine->embed(TagPropagator::embeddingText(item.filename, text));
+            }
+            if (!v.empty()) vectorIndex.upsert(indexKey(item.path), v, contentStamp(item.path));
+        }
+        jobs.complete(item.path, item.result);
+    };
+
+    pipeline = std::make_unique<AnalysisPipeline>(*engine);
+    pipeline->start(source, persist, config, propagate);
+    actAnalyzeFolder->setText("⏹ 取消資料夾分析 (Cancel Folder)");
+    actPauseFolder->setText("暫停 (Pause)");
+    actPauseFolder->setEnabled(true);
+    lblStatus->setText("資料夾分析中... (Analyzing folder...)");
+    pipelineTicks = 0;
+    pipelineTimer->start(500);
+}
+
+void MainWindow::pauseFolder()
+{
+    if (!pipelineRunning()) return;
+    bool paused = !jobs.isPaused();
+    jobs.setPaused(paused);
+    actPauseFolder->setText(paused ? "▶ 繼續 (Resume)" : "暫停 (Pause)");
+    onPipelineProgress();
+}
+
+void MainWindow::updateJobPriorities()
+{
+    QString selected = selectedPath();
+    std::vector<std::string> chosen;
+    if (!selected.isEmpty()) chosen.push_back(selected.toStdString());
+    jobs.prioritize(chosen, JobQueue::Selected);
+
+    // Rows currently on screen
+    std::vector<std::string> visible;
+    QRect view = fileList->viewport()->rect();
+    QListWidgetItem *top = fileList->itemAt(view.topLeft());
+    QListWidgetItem *bottom = fileList->itemAt(view.bottomLeft());
+    int first = top ? fileList->row(top) : 0;
+    int last = bottom ? fileList->row(bottom) : fileList->count() - 1;
+    for (int i = first; top && i <= last; ++i) {
+        QListWidgetItem *item = fileList->item(i);
+        if (item->isHidden()) continue;
+        std::filesystem::path p(currentPath.toStdString());
+        p /= item->data(Qt::UserRole).toString().toStdString();
+        visible.push_back(p.string());
     }
+    jobs.prioritize(visible, JobQueue::Visible);
+}
+
+void MainWindow::syncJobs()
+{
+    jobs.sync([this]() { workspace.flush(); });
+}
 
-    // Unified safety truncation (16000 chars)
-    if (content.length() > 16000) {
-        content = content.substr(0, 16000) + "... [Truncated]";
+void MainWindow::syncJobsLater()
+{
+    // Flushing the tags and compacting the journal take a while on big folders
+    if (jobSync.isRunning()) return; // That one picks up these changes too
+    jobSync = QtConcurrent::run([this]() { syncJobs(); });
+}
+
+void MainWindow::onPipelineProgress()
+{
+    if (!pipeline) return;
+    JobQueue::Counts job = jobs.counts();
+    QString report = QString("%1/%2 個檔案 (files)").arg(job.done).arg(job.total());
+    if (job.waiting) report += QString(", %1 個待重試 (retrying)").arg(job.waiting);
+    if (job.failed) report += QString(", %1 個失敗 (failed)").arg(job.failed);
+    report += " - " + QString::fromStdString(pipeline->report());
+    if (pipeline->isRunning()) {
+        updateJobPriorities();
+        if (++pipelineTicks % 20 == 0) syncJobsLater(); // Every 10 s; a crash redoes at most that much
+        lblStatus->setText((jobs.isPaused() ? "資料夾分析已暫停 (Folder analysis paused): "
+                                            : "資料夾分析中 (Analyzing folder): ") + report);
+        return;
     }
 
-    btnAnalyzeFile->setEnabled(false);
+    pipelineTimer->stop();
+    pipeline->wait();
+    jobSync.waitForFinished();
+    syncJobsLater();
+    actPauseFolder->setEnabled(false);
+    actPauseFolder->setText("暫停 (Pause)");
+    if (vectorIndex.isOpen()) vectorIndex.flush();
+    updateTagList();
+    QString selected = selectedPath();
+    if (!selected.isEmpty()) updateTagDisplay(selected);
+    actAnalyzeFolder->setText("分析整個資料夾 (Analyze Folder)");
+    lblStatus->setText("資料夾分析完成 (Folder analysis finished): " + report);
+}
+
+void MainWindow::startAnalysis(const QString& fullPath)
+{
+    std::filesystem::path path(fullPath.toStdString());
+    QString filename = QString::fromStdString(path.filename().string());
+    if (analyses.contains(fullPath)) {
+        lblStatus->setText(QString("已在分析中 (Already being analyzed): %1").arg(filename));
+        return;
+    }
+
+    lblStatus->setText(QString("正在解析檔案內容: %1").arg(filename));
+    QApplication::processEvents();
+    auto t_parse = std::chrono::steady_clock::now();
+    std::string content = DocumentParser::extractContent(path.string());
+    telemetry.recordParse(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_parse).count());
+    if (content.empty()) {
+        lblStatus->setText("正在分析檔名...");
+    } else {
+        lblStatus->setText(QString("正在分析檔案內容... (%1 chars)").arg(content.length()));
+    }
+
+    // No truncation here: the backend packs the content into its own budget
+
+    // Other files stay selectable and can be analyzed meanwhile
     btnSaveTags->setEnabled(false);
-    fileList->setEnabled(false);
-    
-    QFuture<std::string> future = QtConcurrent::run([this, filename, content]() {
-        return llamaEngine.suggestTags(filename.toStdString(), content);
+
+    // Index the file for semantic search while its content is at hand
+    bool propagateWanted = chkPropagate->isChecked();
+    std::string root = currentPath.toStdString();
+    std::string key = indexKey(path.string());
+    bool inFolder = key.rfind("..", 0) != 0; // Queued before another folder was opened: not in this index
+    std::string stamp = contentStamp(path.string());
+    std::string imagePath = ImageLoader::isImage(path.string()) && backend->canSeeImages() ? path.string() : "";
+
+    // Pieces are shown as they arrive; the cancel flag is set by the Cancel button or a selection change
+    InferenceOptions options;
+    options.cancel = std::make_shared<std::atomic<bool>>(false);
+    options.deadline = std::chrono::steady_clock::now() + kAnalysisDeadline;
+    options.onToken = [this, fullPath](const std::string& piece) {
+        QString text = QString::fromStdString(piece);
+        QMetaObject::invokeMethod(this, [this, fullPath, text]() { onAnalysisToken(fullPath, text); },
+                                  Qt::QueuedConnection);
+    };
+
+    InferenceBackend *engine = backend;
+    QFuture<std::string> future = QtConcurrent::run([this, engine, filename, content, propagateWanted, root, key, inFolder,
+                                                     stamp, imagePath, options]() {
+        bool index = inFolder && ensureVectorIndex(engine, root);
+        bool propagate = index && propagateWanted;
+        if (!imagePath.empty()) {
+            // Tagged by what the picture shows; decoded at reduced size, which is most of the load time saved
+            ImageData image;
+            if (!ImageLoader::load(imagePath, LlamaEngine::kMaxImageSide, image)) return std::string("Error: Cannot read image");
+            image.key = FileIdentity::fingerprintFile(imagePath);
+            std::string tags = engine->suggestImageTags(filename.toStdString(), image, options);
+            // Indexed by name and tags, the closest thing to content an image has
+            if (index && tags.rfind("Error:", 0) != 0) {
+                std::vector<float> v = engine->embed(TagPropagator::embeddingText(filename.toStdString(), tags));
+                if (!v.empty()) {
+                    vectorIndex.upsert(key, v, stamp);
+                    vectorIndex.flush();
+                }
+            }
+            return tags;
+        }
+        if (propagate) {
+            // Neighbours' tags when they agree, generation otherwise
+            auto tagsOf = [this, root](const std::string& k) {
+                return workspace.getTags((std::filesystem::path(root) / k).string());
+            };
+            TagPropagator::Result r = propagator.suggest(key, filename.toStdString(), content, tagsOf, options);
+            if (!r.embedding.empty()) {
+                vectorIndex.upsert(key, r.embedding, stamp);
+                vectorIndex.flush();
+            }
+            return r.text;
+        }
+
+        std::string tags = engine->suggestTags(filename.toStdString(), content, options);
+        if (index && tags.rfind("Error:", 0) != 0) {
+            std::vector<float> v = engine->embed(TagPropagator::embeddingText(filename.toStdString(), content));
+            if (!v.empty()) {
+                vectorIndex.upsert(key, v, stamp);
+                vectorIndex.flush();
+            }
+        }
+        return tags;
     });
 
-    watcher->setFuture(future);
+    Analysis analysis;
+    analysis.watcher = new QFutureWatcher<std::string>(this);
+    analysis.cancel = options.cancel;
+    connect(analysis.watcher, &QFutureWatcher<std::string>::finished, this, [this, fullPath]() {
+        onAnalysisFinished(fullPath);
+    });
+    analyses.insert(fullPath, analysis);
+    analysis.watcher->setFuture(future);
+    updateAnalyzeButton();
+    if (analyses.size() > 1) {
+        lblStatus->setText(QString("正在分析 %1 個檔案... (Analyzing %1 files)").arg(analyses.size()));
+    }
 }
 
-void MainWindow::onAnalysisFinished()
+void MainWindow::onAnalysisToken(const QString& path, const QString& piece)
 {
-    std::string result = watcher->result();
-    
-    // Re-enable UI
-    btnAnalyzeFile->setEnabled(true);
-    fileList->setEnabled(true);
+    auto it = analyses.find(path);
+    if (it == analyses.end()) return; // Finished meanwhile
+    it->partial += piece;
+    if (selectedPath() == path) {
+        lblTags->setText("標籤 (生成中 generating): " + it->partial);
+    }
+}
+
+QString MainWindow::selectedPath() const
+{
+    QList<QListWidgetItem*> selectedItems = fileList->selectedItems();
+    if (selectedItems.isEmpty()) return QString();
+    std::filesystem::path p(currentPath.toStdString());
+    p /= selectedItems.first()->data(Qt::UserRole).toString().toStdString();
+    return QString::fromStdString(p.string());
+}
 
-    if (result.rfind("Error:", 0) == 0) { // Starts with "Error:"
+void MainWindow::updateAnalyzeButton()
+{
+    if (analyses.contains(selectedPath())) {
+        btnAnalyzeFile->setText("⏹ 取消分析 (Cancel)");
+    } else {
+        btnAnalyzeFile->setText("✨ 分析檔案 (Analyze)");
+    }
+}
+
+void MainWindow::onAnalysisFinished(const QString& path)
+{
+    Analysis analysis = analyses.take(path);
+    std::string result = analysis.watcher->result();
+    analysis.watcher->deleteLater();
+    updateAnalyzeButton();
+
+    if (result == "Error: Cancelled") {
+        lblStatus->setText("已取消分析 (Analysis cancelled)");
+        if (selectedPath() == path) updateTagDisplay(path);
+    } else if (result.rfind("Error:", 0) == 0) { // Starts with "Error:"
+        if (selectedPath() == path) updateTagDisplay(path);
         lblStatus->setText("分析失敗 (Analysis Failed)");
         QMessageBox::critical(this, "Analysis Error", QString::fromStdString(result));
-        return;
+    } else {
+        // Auto-save tags to the analyzed file, which may no longer be the selected one
+        applyTags(path.toStdString(), QString::fromStdString(result));
+        lblStatus->setText("分析完成 (Analysis complete) - " + QString::fromStdString(propagator.report()) +
+                           QString(", 快取命中 (cache hits) %1").arg(inferenceCache.hits()));
+        // One message for the whole burst, not one per file
+        if (analyses.isEmpty()) {
+            QMessageBox::information(this, "Analysis Finished", "分析完成並已自動儲存標籤！\n(Analysis complete and tags saved!)");
+        } else {
+            lblStatus->setText(lblStatus->text() + QString(" - 尚有 %1 個 (%1 remaining)").arg(analyses.size()));
+        }
     }
-
-    lblStatus->setText("分析完成 (Analysis complete)");
-    
-    // Auto-save tags
-    btnSaveTags->setProperty("pendingTags", QString::fromStdString(result));
-    saveTags(); // Automatically save
-    
-    // Update UI to show success
-    lblTags->setText("標籤: " + QString::fromStdString(result));
-    QMessageBox::information(this, "Analysis Finished", "分析完成並已自動儲存標籤！\n(Analysis complete and tags saved!)");
 }
 
 void MainWindow::onFileSelected(QListWidgetItem *item)
 {
-    QString filePathStr = item->text();
-    // Resolve full path if item text is relative
+    QString filePathStr = item->data(Qt::UserRole).toString();
+    // Resolve full path if item path is relative
     std::filesystem::path p(currentPath.toStdString());
     p /= filePathStr.toStdString();
     
-    updateTagDisplay(QString::fromStdString(p.filename().string()));
-    updateFilePreview(QString::fromStdString(p.string()));
+    QString path = QString::fromStdString(p.string());
+
+    // Analyses of files the user has moved away from are stale
+    if (chkFollowSelection->isChecked()) {
+        for (auto it = analyses.begin(); it != analyses.end(); ++it) {
+            if (it.key() != path) *it->cancel = true;
+        }
+    }
+
+    updateTagDisplay(path);
+    auto running = analyses.find(path);
+    if (running != analyses.end() && !running->partial.isEmpty()) {
+        lblTags->setText("標籤 (生成中 generating): " + running->partial);
+    }
+    updateFilePreview(path);
+    updateAnalyzeButton();
     btnSaveTags->setEnabled(false);
+    if (pipelineRunning()) updateJobPriorities(); // Its tags are wanted now
 }
 
 void MainWindow::updateFilePreview(const QString& filePath)
@@ -455,9 +1433,7 @@ void MainWindow::updateFilePreview(const QString& filePath)
 
 void MainWindow::updateTagDisplay(const QString& filePath)
 {
-    std::filesystem::path path(filePath.toStdString());
-    std::string filename = path.filename().string();
-    std::vector<std::string> tags = tagManager.getTags(filename);
+    std::vector<std::string> tags = workspace.getTags(filePath.toStdString());
     
     QString tagStr = "標籤: ";
     if (tags.empty()) {
@@ -481,36 +1457,45 @@ void MainWindow::saveTags()
     std::filesystem::path path(currentPath.toStdString());
     path /= relPath.toStdString();
     
-    QString filePath = QString::fromStdString(path.string());
-    std::string filename = path.filename().string();
-    
     QString pendingTags = btnSaveTags->property("pendingTags").toString();
     if (pendingTags.isEmpty()) return;
     
+    applyTags(path.string(), pendingTags);
+    lblStatus->setText("標籤已儲存 (Tags saved)");
+    btnSaveTags->setEnabled(false);
+}
+
+void MainWindow::applyTags(const std::string& path, const QString& tags)
+{
     // Simple parsing of comma-separated tags
-    QStringList tagList = pendingTags.split(',', Qt::SkipEmptyParts);
+    QStringList tagList = tags.split(',', Qt::SkipEmptyParts);
     std::vector<std::string> newTags;
     for (const QString& t : tagList) {
         newTags.push_back(t.trimmed().toStdString());
     }
-    
-    tagManager.setTags(filename, newTags);
-    updateTagDisplay(filePath);
+
+    workspace.setTags(path, newTags);
     updateTagList(); // Refresh left panel to show new tags immediately
-    
-    lblStatus->setText("標籤已儲存 (Tags saved)");
-    btnSaveTags->setEnabled(false);
+
+    // Only touch the details panel if it shows this file
+    QList<QListWidgetItem*> selectedItems = fileList->selectedItems();
+    if (!selectedItems.isEmpty()) {
+        std::filesystem::path selected(currentPath.toStdString());
+        selected /= selectedItems.first()->data(Qt::UserRole).toString().toStdString();
+        if (selected.string() == path) updateTagDisplay(QString::fromStdString(path));
+    }
 }
 
 void MainWindow::filterFiles(const QString &text)
 {
+    if (chkSemantic->isChecked()) return; // Runs on Enter, see semanticSearch()
+
     QString query = text.trimmed().toLower();
     
     for (int i = 0; i < fileList->count(); ++i) {
         QListWidgetItem *item = fileList->item(i);
-        QString filePath = item->text();
-        std::filesystem::path path(filePath.toStdString());
-        QString filename = QString::fromStdString(path.filename().string()).toLower();
+        std::string filePath = item->data(Qt::UserRole).toString().toStdString();
+        QString filename = item->text().toLower();
         
         bool match = false;
         
@@ -519,7 +1504,7 @@ void MainWindow::filterFiles(const QString &text)
             match = true;
         } else {
             // 2. Check tags
-            std::vector<std::string> tags = tagManager.getTags(path.filename().string());
+            std::vector<std::string> tags = workspace.getTags(filePath);
             for (const auto& tag : tags) {
                 if (QString::fromStdString(tag).toLower().contains(query)) {
                     match = true;
@@ -540,9 +1525,8 @@ void MainWindow::addTag()
         return;
     }
 
-    QString filename = selectedItems.first()->text();
-    std::filesystem::path path(filename.toStdString());
-    std::string fnameOnly = path.filename().string();
+    QString filename = selectedItems.first()->data(Qt::UserRole).toString();
+    std::string path = filename.toStdString();
 
     QInputDialog dialog(this);
     dialog.setWindowTitle("Add Tag");
@@ -554,7 +1538,7 @@ void MainWindow::addTag()
     if (dialog.exec() == QDialog::Accepted) {
         QString text = dialog.textValue();
         if (!text.isEmpty()) {
-            tagManager.addTag(fnameOnly, text.toStdString());
+            workspace.addTag(path, text.toStdString());
             updateTagDisplay(filename);
             updateTagList(); // Refresh left panel
             lblStatus->setText(QString("已新增標籤: %1").arg(text));
@@ -570,11 +1554,10 @@ void MainWindow::removeTag()
         return;
     }
 
-    QString filename = selectedItems.first()->text();
-    std::filesystem::path path(filename.toStdString());
-    std::string fnameOnly = path.filename().string();
+    QString filename = selectedItems.first()->data(Qt::UserRole).toString();
+    std::string path = filename.toStdString();
 
-    std::vector<std::string> tags = tagManager.getTags(fnameOnly);
+    std::vector<std::string> tags = workspace.getTags(path);
     if (tags.empty()) {
         QMessageBox::information(this, "Info", "This file has no tags.");
         return;
@@ -594,7 +1577,7 @@ void MainWindow::removeTag()
     if (dialog.exec() == QDialog::Accepted) {
         QString item = dialog.textValue();
         if (!item.isEmpty()) {
-            tagManager.removeTag(fnameOnly, item.toStdString());
+            workspace.removeTag(path, item.toStdString());
             updateTagDisplay(filename);
             updateTagList(); // Refresh left panel
             lblStatus->setText(QString("已移除標籤: %1").arg(item));
@@ -625,13 +1608,13 @@ void MainWindow::removeGlobalTag()
                                   QMessageBox::Yes|QMessageBox::No);
     
     if (reply == QMessageBox::Yes) {
-        tagManager.deleteTag(tag.toStdString());
+        workspace.deleteTag(tag.toStdString(), currentPath.toStdString());
         updateTagList();
         
         // Refresh right panel if a file is selected
         QList<QListWidgetItem*> selectedFiles = fileList->selectedItems();
         if (!selectedFiles.isEmpty()) {
-            updateTagDisplay(selectedFiles.first()->text());
+            updateTagDisplay(selectedFiles.first()->data(Qt::UserRole).toString());
         }
         
         lblStatus->setText(QString("已刪除標籤: %1 (Global)").arg(tag));
@@ -695,8 +1678,12 @@ void MainWindow::renameFile()
 
         try {
             std::filesystem::rename(oldFull, newFull);
-            // Update Tag Manager (Using filenames as keys)
-            tagManager.renameFile(oldName.toStdString(), newName.toStdString());
+            // Update Tag Manager (Using relative paths as keys)
+            workspace.renameFile(oldFull.string(), newFull.string());
+            if (vectorIndex.isOpen()) {
+                vectorIndex.rename(indexKey(oldFull.string()), indexKey(newFull.string()));
+                vectorIndex.flush();
+            }
             // Refresh UI
             scanFiles(); 
             lblStatus->setText(QString("已更名: %1 -> %2").arg(oldName).arg(newName));
@@ -725,8 +1712,12 @@ void MainWindow::deleteFile()
         
         try {
             if (std::filesystem::remove(path)) {
-                // Update Tag Manager (Using filename as key)
-                tagManager.removeFile(filename.toStdString());
+                // Update Tag Manager (Using relative path as key)
+                workspace.removeFile(path.string());
+                if (vectorIndex.isOpen()) {
+                    vectorIndex.remove(indexKey(path.string()));
+                    vectorIndex.flush();
+                }
                 // Refresh UI
                 scanFiles();
                 // Clear Preview
@@ -745,6 +1736,159 @@ void MainWindow::deleteFile()
     }
 }
 
+std::string MainWindow::indexKey(const std::string& filePath) const
+{
+    return std::filesystem::path(filePath).lexically_normal()
+        .lexically_relative(std::filesystem::path(currentPath.toStdString()).lexically_normal())
+        .generic_string();
+}
+
+bool MainWindow::ensureVectorIndex(InferenceBackend *engine, const std::string& root)
+{
+    if (root.empty() || !engine->canEmbed()) return false;
+    int dim = engine->embeddingSize();
+    if (dim <= 0) return false;
+    // One index per embedding model, so switching backends and back finds the old vectors again
+    std::string name = "vectors-" + FileIdentity::fingerprintData(engine->embeddingId()).substr(0, 16);
+    std::lock_guard<std::mutex> lock(indexOpenMutex);
+    if (vectorIndex.isOpen() && vectorIndex.dimension() == dim && vectorIndex.name() == name) return true;
+    return vectorIndex.open(root, dim, name);
+}
+
+void MainWindow::buildSemanticIndex()
+{
+    if (indexWatcher->isRunning()) return;
+    // Both embed every file; one at a time
+    if (pipelineRunning()) {
+        QMessageBox::warning(this, "Warning", "資料夾分析中，請稍候或取消 (Folder analysis in progress)");
+        return;
+    }
+    if (currentPath.isEmpty() || backendBusy() || !backend->canEmbed()) {
+        QMessageBox::warning(this, "Warning", "請先開啟資料夾並載入模型 (Open a folder and load a model first)");
+        return;
+    }
+
+    std::vector<std::string> paths;
+    std::vector<std::string> allKeys;
+    for (int i = 0; i < fileList->count(); ++i) {
+        std::string path = fileList->item(i)->data(Qt::UserRole).toString().toStdString();
+        paths.push_back(path);
+        allKeys.push_back(indexKey(path));
+    }
+    lblStatus->setText("正在建立語意索引... (Building index...)");
+
+    // Asking the backend for its embedding size may go over the network, so everything runs on the worker
+    InferenceBackend *engine = backend;
+    std::string root = currentPath.toStdString();
+    indexWatcher->setFuture(QtConcurrent::run([this, engine, root, paths, allKeys]() {
+        if (!ensureVectorIndex(engine, root)) return -1;
+
+        // Only files that are new or changed since they were embedded
+        std::vector<std::pair<std::string, std::string>> todo; // Full path, stamp
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            std::string stamp = contentStamp(paths[i]);
+            if (vectorIndex.stamp(allKeys[i]) == stamp) continue;
+            todo.push_back({paths[i], stamp});
+            keys.push_back(allKeys[i]);
+        }
+
+        const size_t chunk = 16;
+        int indexed = 0;
+        for (size_t first = 0; first < todo.size(); first += chunk) {
+            std::vector<std::string> texts;
+            size_t last = std::min(todo.size(), first + chunk);
+            for (size_t i = first; i < last; ++i) {
+                std::string name = std::filesystem::path(todo[i].first).filename().string();
+                texts.push_back(TagPropagator::embeddingText(name, DocumentParser::extractContent(todo[i].first)));
+            }
+            std::vector<std::vector<float>> vectors = engine->embedBatch(texts);
+            for (size_t i = first; i < last; ++i) {
+                if (vectors[i - first].empty()) continue;
+                vectorIndex.upsert(keys[i], vectors[i - first], todo[i].second);
+                indexed++;
+            }
+        }
+        if (vectorIndex.tombstones() > vectorIndex.size()) vectorIndex.compact();
+        vectorIndex.flush();
+        return indexed;
+    }));
+}
+
+void MainWindow::onIndexFinished()
+{
+    if (indexWatcher->result() < 0) {
+        lblStatus->setText("無法建立語意索引：後端不支援向量 (The backend can't embed)");
+        return;
+    }
+    lblStatus->setText(QString("語意索引完成: 更新 %1 個檔案, 共 %2 個")
+                       .arg(indexWatcher->result()).arg(vectorIndex.size()));
+}
+
+void MainWindow::semanticSearch()
+{
+    if (!chkSemantic->isChecked()) return;
+
+    QString query = txtSearch->text().trimmed();
+    if (query.isEmpty()) {
+        for (int i = 0; i < fileList->count(); ++i) fileList->item(i)->setHidden(false);
+        return;
+    }
+    if (currentPath.isEmpty() || backendBusy() || !backend->canEmbed()) {
+        QMessageBox::information(this, "Info", "請先建立語意索引 (Build the semantic index first)");
+        return;
+    }
+    // The query is embedded by the backend, possibly over the network
+    if (searchWatcher->isRunning()) {
+        searchAgain = true; // With whatever the query is by then
+        return;
+    }
+    InferenceBackend *engine = backend;
+    std::string root = currentPath.toStdString();
+    std::string text = query.toStdString();
+    lblStatus->setText("語意搜尋中... (Searching...)");
+    searchWatcher->setFuture(QtConcurrent::run([this, engine, root, text]() {
+        SearchResult result;
+        if (!ensureVectorIndex(engine, root) || vectorIndex.size() == 0) return result;
+        result.indexed = true;
+        std::vector<float> q = engine->embed(text);
+        if (q.empty()) return result;
+        result.embedded = true;
+        result.hits = vectorIndex.search(q, 20);
+        return result;
+    }));
+}
+
+void MainWindow::onSearchFinished()
+{
+    if (searchAgain) {
+        searchAgain = false;
+        semanticSearch();
+        return;
+    }
+    if (!chkSemantic->isChecked() || txtSearch->text().trimmed().isEmpty()) return;
+
+    SearchResult result = searchWatcher->result();
+    if (!result.indexed) {
+        QMessageBox::information(this, "Info", "請先建立語意索引 (Build the semantic index first)");
+        return;
+    }
+    if (!result.embedded) {
+        lblStatus->setText("無法計算查詢向量 (Embedding failed)");
+        return;
+    }
+
+    std::map<std::string, float> hits(result.hits.begin(), result.hits.end());
+
+    for (int i = 0; i < fileList->count(); ++i) {
+        QListWidgetItem *item = fileList->item(i);
+        auto hit = hits.find(indexKey(item->data(Qt::UserRole).toString().toStdString()));
+        item->setHidden(hit == hits.end());
+        item->setToolTip(hit == hits.end() ? QString() : QString("相似度 %1").arg(hit->second, 0, 'f', 2));
+    }
+    lblStatus->setText(QString("語意搜尋: %1 個結果").arg(hits.size()));
+}
+
 bool MainWindow::eventFilter(QObject *watched, QEvent *event)
 {
     // No longer strictly needed for resize as fitToWindow handles it, 
@@ -15,10 +15,22 @@
 #include <QTabWidget>
 #include <QTextEdit>
 #include <QFutureWatcher>
+#include <QMap>
+#include <QProgressBar>
 #include <QtConcurrent>
+#include <QTimer>
 #include "GraphWidget.h"
 #include "../ai/LlamaEngine.h"
-#include "../core/TagManager.h"
+#include "../ai/HttpBackend.h"
+#include "../ai/MockBackend.h"
+#include "../ai/TagPropagator.h"
+#include "../ai/AnalysisPipeline.h"
+#include "../core/TagWorkspace.h"
+#include "../core/JobQueue.h"
+#include "../core/VectorIndex.h"
+#include <atomic>
+#include <mutex>
+#include <memory>
 
 class MainWindow : public QMainWindow
 {
@@ -32,8 +44,15 @@ private slots:
     void openFolder();
     void scanFiles();
     void loadModel();
+    void onModelLoaded();
+    void cancelModelLoad();
+    void loadDraftModel();
+    void loadProjector();
+    void editInferenceProfile();
+    void showTelemetry();
     void analyzeFile();
-    void onAnalysisFinished();
+    void analyzeFolder();
+    void pauseFolder(); // Toggles; files in flight still finish
     void saveTags();
     void openFile(QListWidgetItem* item); // Double click
     void renameFile(); // Context menu
@@ -43,6 +62,11 @@ private slots:
     void removeTag();
     void removeGlobalTag();
     void filterFiles(const QString &text);
+    void semanticSearch();
+    void onSearchFinished();
+    void onReconcileFinished();
+    void buildSemanticIndex();
+    void onIndexFinished();
     void onFileSelected(QListWidgetItem *item);
     void onTagSelected(QListWidgetItem *item);
     void onTabChanged(int index);
@@ -58,6 +82,8 @@ private:
     QVBoxLayout *mainLayout;
     QToolBar *toolbar;
     QCheckBox *chkRecursive;
+    QCheckBox *chkPropagate;
+    QCheckBox *chkFollowSelection;
     QTabWidget *tabWidget;
     QScrollArea *scrollArea;
     
@@ -74,6 +100,7 @@ private:
     // Middle Panel (Files)
     QWidget *middlePanel;
     QLineEdit *txtSearch;
+    QCheckBox *chkSemantic;
     QListWidget *fileList;
     
     // Right Panel (Details)
@@ -82,6 +109,8 @@ private:
     QTextEdit *txtPreviewText;
     QLabel *lblTags;
     QLabel *lblStatus;
+    QProgressBar *progressLoad;
+    QPushButton *btnCancelLoad;
     QPushButton *btnAnalyzeFile;
     QPushButton *btnSaveTags;
     QPushButton *btnAddTag;
@@ -92,9 +121,45 @@ private:
 
     // Data
     QString currentPath;
+    InferenceCache inferenceCache; // Tags by content + model + prompt, across folders
+    InferenceTelemetry telemetry;  // Per-request timings of the llama.cpp engine, since startup
     LlamaEngine llamaEngine;
-    TagManager tagManager;
-    QFutureWatcher<std::string> *watcher;
+    HttpBackend httpBackend;
+    MockBackend mockBackend;
+    InferenceBackend *backend = &llamaEngine; // Answers analyses and embeds; picked by the profile
+    TagWorkspace workspace;
+    // Running analyses by full path; with llama.cpp they share its context pool
+    struct Analysis {
+        QFutureWatcher<std::string> *watcher = nullptr;
+        InferenceBackend::CancelFlag cancel;
+        QString partial; // Streamed so far
+    };
+    QMap<QString, Analysis> analyses;
+    QStringList pendingAnalyses; // Full paths requested while the model was loading
+    QFutureWatcher<bool> *loadWatcher;
+    std::atomic<bool> cancelLoad{false};
+    VectorIndex vectorIndex; // Semantic index of currentPath, opened on first use
+    QFutureWatcher<int> *indexWatcher; // Files embedded, -1 if the backend can't embed
+    std::mutex indexOpenMutex; // ensureVectorIndex() runs on workers
+    struct SearchResult {
+        bool indexed = false;  // There was an index to search
+        bool embedded = false; // The query could be embedded
+        std::vector<std::pair<std::string, float>> hits;
+    };
+    QFutureWatcher<SearchResult> *searchWatcher;
+    bool searchAgain = false; // The query changed while a search was running
+    QFuture<void> vectorSweep; // Drops vectors of deleted files after a scan
+    QFutureWatcher<int> *reconcileWatcher; // Tags reattached to moved files after a scan
+    std::vector<std::string> reconcileQueued; // Files of a scan made while one was running
+    bool reconcileAgain = false;
+    TagPropagator propagator{llamaEngine, vectorIndex};
+    std::unique_ptr<AnalysisPipeline> pipeline; // Analyze Folder; one run at a time
+    QTimer *pipelineTimer;
+    QAction *actAnalyzeFolder;
+    QAction *actPauseFolder;
+    JobQueue jobs; // Analyze Folder work list of currentPath, kept in .smartfile/ across restarts
+    int pipelineTicks = 0;
+    QFuture<void> jobSync; // syncJobsLater() in flight
     
     // State
     QPixmap currentPreviewPixmap; // Store original for resizing logic
@@ -107,8 +172,29 @@ private:
     void setupToolbar();
     void setupLayout();
     void updateTagList();
+    void reconcileLater(const std::vector<std::string>& files); // Looks for moved files on a worker
     void updateFilePreview(const QString& filePath);
     void updateTagDisplay(const QString& filename);
+    std::string indexKey(const std::string& filePath) const; // Path relative to currentPath
+    // The index of `engine`'s embedding model in `root`, opened if needed. May ask
+    // the backend over the network, so it is called on worker threads only.
+    bool ensureVectorIndex(InferenceBackend *engine, const std::string& root);
+    std::string profilePath() const; // <AppData>/inference.json
+    void startModelLoad(const QString& path); // On a worker thread, see onModelLoaded()
+    bool modelReady() const; // llama.cpp model loaded and not being replaced
+    bool backendBusy() const; // The backend can't take requests right now, e.g. its model is loading
+    void applyBackend(const InferenceProfile& profile);
+    void startAnalysis(const QString& fullPath);
+    void onPipelineProgress(); // Status while a folder is analyzed, cleanup once done
+    bool pipelineRunning() const { return pipeline && pipeline->isRunning(); }
+    void updateJobPriorities(); // The selected file first, then the ones on screen
+    void syncJobs(); // Flushes the tags, then records the finished files in the job journal
+    void syncJobsLater(); // syncJobs() on a worker
+    void onAnalysisFinished(const QString& path);
+    void onAnalysisToken(const QString& path, const QString& piece);
+    QString selectedPath() const; // Full path of the selected file, empty if none
+    void updateAnalyzeButton();    // "Cancel" while the selected file is being analyzed
+    void applyTags(const std::string& path, const QString& tags); // Comma-separated
 };
 
 #endif // MAINWINDOW_H